@@ -18,6 +18,15 @@ BuildRequires: libmodbus-devel
 %description
 Client and server CLI utilities to work with Modbus devices
 
+%package -n libmbu-devel-static
+Summary: Static library for in-process use of modbus-utils backends
+Group: Development/C
+Requires: libmodbus-devel
+
+%description -n libmbu-devel-static
+libmbu static library and headers: modbus-utils backends, persistent sessions
+and batched requests for polling Modbus devices from other programs
+
 %prep
 %setup -q
 
@@ -28,6 +37,13 @@ Client and server CLI utilities to work with Modbus devices
 %files
 %_bindir/modbus_client
 %_bindir/modbus_server
+%_bindir/modbus_tsdump
+%_bindir/modbus_tracedump
+%_bindir/modbus_broker
+
+%files -n libmbu-devel-static
+%_libdir/libmbu.a
+%_includedir/mbu/
 
 %changelog
 * Tue Aug 10 2021 Aleksey Saprunov <sa@altlinux.org> 1.0.0-alt1
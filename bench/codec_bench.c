@@ -0,0 +1,158 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+/*
+ * Microbenchmark of the frame codec: CRC16 (bytewise as libmodbus does it vs slicing-by-4),
+ * rtu and tcp parsing and encoding of typical frames. Prints one JSON line per case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mbu-common.h"
+#include "mbu-codec.h"
+#include "mbu-frame.h"
+
+typedef struct {
+    const char *name;
+    int frameLen;//unit id + PDU
+} FrameCase;
+
+static const FrameCase frameCases[] = {
+    {"read-request", 6},
+    {"read-10-registers-response", 23},
+    {"read-125-registers-response", 253},
+};
+
+//keeps the compiler from dropping the measured work
+static volatile uint32_t sink;
+
+static void report(const char name[], int frameLen, uint64_t opsNo, uint64_t elapsedNs) {
+    printf("{\"case\":\"%s\",\"frame_bytes\":%d,\"ops\":%llu,\"ns_per_op\":%.2f,\"mb_per_s\":%.1f}\n",
+           name, frameLen, (unsigned long long)opsNo, (double)elapsedNs / opsNo,
+           (double)opsNo * frameLen * 1e3 / elapsedNs);
+    fflush(stdout);
+}
+
+static void benchFrame(const FrameCase *fc, uint64_t opsNo) {
+    uint8_t frame[MBU_MAX_FRAME_LENGTH];
+    uint8_t rtu[CODEC_RTU_MAX_ADU_LENGTH + 2];
+    uint8_t tcp[CODEC_TCP_MAX_ADU_LENGTH];
+    char name[96];
+    uint64_t startNs, i;
+    int rtuLen, tcpLen, isRequest = (6 == fc->frameLen);
+    CodecFrame parsed;
+
+    for (i = 0; i < (uint64_t)fc->frameLen; ++i)
+        frame[i] = (uint8_t)(i * 37 + 11);
+    frame[0] = 1;
+    frame[1] = MbuReadHoldingRegisters;
+    if (!isRequest)
+        frame[2] = fc->frameLen - 3;
+    rtuLen = codecEncodeRtu(rtu, frame, fc->frameLen);
+    tcpLen = codecEncodeTcp(tcp, 1, frame, fc->frameLen);
+
+    startNs = mbuClockNs(CLOCK_MONOTONIC);
+    for (i = 0; i < opsNo; ++i) {
+        rtu[2] = (uint8_t)i;
+        sink += codecCrc16Bytewise(rtu, fc->frameLen);
+    }
+    snprintf(name, sizeof(name), "crc16-bytewise-%s", fc->name);
+    report(name, fc->frameLen, opsNo, mbuClockNs(CLOCK_MONOTONIC) - startNs);
+
+    startNs = mbuClockNs(CLOCK_MONOTONIC);
+    for (i = 0; i < opsNo; ++i) {
+        rtu[2] = (uint8_t)i;
+        sink += codecCrc16(rtu, fc->frameLen);
+    }
+    snprintf(name, sizeof(name), "crc16-slicing4-%s", fc->name);
+    report(name, fc->frameLen, opsNo, mbuClockNs(CLOCK_MONOTONIC) - startNs);
+
+    codecEncodeRtu(rtu, frame, fc->frameLen);
+    startNs = mbuClockNs(CLOCK_MONOTONIC);
+    for (i = 0; i < opsNo; ++i) {
+        sink += codecParseRtu(rtu, rtuLen, isRequest, &parsed);
+        sink += parsed.len;
+    }
+    snprintf(name, sizeof(name), "parse-rtu-%s", fc->name);
+    report(name, fc->frameLen, opsNo, mbuClockNs(CLOCK_MONOTONIC) - startNs);
+
+    startNs = mbuClockNs(CLOCK_MONOTONIC);
+    for (i = 0; i < opsNo; ++i) {
+        sink += codecParseTcp(tcp, tcpLen, &parsed);
+        sink += parsed.len;
+    }
+    snprintf(name, sizeof(name), "parse-tcp-%s", fc->name);
+    report(name, fc->frameLen, opsNo, mbuClockNs(CLOCK_MONOTONIC) - startNs);
+
+    startNs = mbuClockNs(CLOCK_MONOTONIC);
+    for (i = 0; i < opsNo; ++i) {
+        frame[fc->frameLen - 1] = (uint8_t)i;
+        sink += codecEncodeRtu(rtu, frame, fc->frameLen) + rtu[fc->frameLen];
+    }
+    snprintf(name, sizeof(name), "encode-rtu-%s", fc->name);
+    report(name, fc->frameLen, opsNo, mbuClockNs(CLOCK_MONOTONIC) - startNs);
+}
+
+void printUsage(const char progName[]) {
+    printf("%s [-n<operations-per-case>=1000000] [-s<case-name-part>]\n", progName);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int ok = 1;
+    int opsNo = 1000000;
+    const char *only = NULL;
+    size_t i;
+
+    while (-1 != (c = getopt(argc, argv, "n:s:"))) {
+        switch (c) {
+        case 'n':
+            opsNo = mbuGetInt(optarg, &ok);
+            ok = ok && opsNo > 0;
+            break;
+        case 's':
+            only = optarg;
+            break;
+        default:
+            ok = 0;
+        }
+        if (0 == ok) {
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < sizeof(frameCases) / sizeof(frameCases[0]); ++i) {
+        if (NULL != only && NULL == strstr(frameCases[i].name, only))
+            continue;
+        benchFrame(&frameCases[i], opsNo);
+    }
+
+    return 0;
+}
@@ -0,0 +1,379 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+/*
+ * Loopback benchmark: starts modbus_server and runs request scenarios against it,
+ * each scenario prints one JSON line with throughput and latency figures.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <modbus.h>
+
+#include "mbu-common.h"
+
+#define BENCH_REGISTERS_NO 200
+#define BENCH_MAX_CONNECTIONS 64
+
+//0x10 followed by 0x03 as two transactions, the cycle 0x17 does in one
+#define WriteThenReadRegisters 0x100
+
+typedef struct {
+    const char *name;
+    int fType;
+    int nb;
+    int connections;
+    int rtu;
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"read-1-register", MbuReadHoldingRegisters, 1, 1, 0},
+    {"read-125-registers", MbuReadHoldingRegisters, 125, 1, 0},
+    {"write-1-coil", MbuWriteSingleCoil, 1, 1, 0},
+    {"write-100-coils", MbuWriteMultipleCoils, 100, 1, 0},
+    {"read-100-discrete-inputs", MbuReadDiscreteInput, 100, 1, 0},
+    {"mask-write-1-register", MbuMaskWriteRegister, 1, 1, 0},
+    {"write-then-read-10-registers", WriteThenReadRegisters, 10, 1, 0},
+    {"write-and-read-10-registers", MbuWriteAndReadRegisters, 10, 1, 0},
+    {"fan-in-32-connections", MbuReadHoldingRegisters, 10, 32, 0},
+    {"rtu-pty-read-10-registers", MbuReadHoldingRegisters, 10, 1, 1},
+};
+
+typedef struct {
+    const Scenario *scenario;
+    const char *device;
+    int port;
+    int requestsNo;
+    uint64_t *latencies;//requestsNo entries, filled in by the worker
+    int errors;
+} Worker;
+
+static int doRequest(modbus_t *ctx, int fType, int nb) {
+    uint16_t regs[MODBUS_MAX_READ_REGISTERS];
+    uint8_t bits[MODBUS_MAX_WRITE_BITS];
+
+    switch (fType) {
+    case MbuReadHoldingRegisters:
+        return modbus_read_registers(ctx, 0, nb, regs);
+    case MbuReadDiscreteInput:
+        return modbus_read_input_bits(ctx, 0, nb, bits);
+    case MbuMaskWriteRegister:
+        return modbus_mask_write_register(ctx, 0, 0xfffe, 0x0001);
+    case WriteThenReadRegisters:
+        memset(regs, 0, nb * sizeof(uint16_t));
+        if (-1 == modbus_write_registers(ctx, 0, nb, regs))
+            return -1;
+        return modbus_read_registers(ctx, nb, nb, regs);
+    case MbuWriteAndReadRegisters:
+        memset(regs, 0, nb * sizeof(uint16_t));
+        return modbus_write_and_read_registers(ctx, 0, nb, regs, nb, nb, regs);
+    case MbuWriteSingleCoil:
+        return modbus_write_bit(ctx, 0, 1);
+    case MbuWriteMultipleCoils:
+        memset(bits, 1, nb);
+        return modbus_write_bits(ctx, 0, nb, bits);
+    }
+
+    return -1;
+}
+
+static modbus_t *connectToServer(const Worker *w) {
+    int attempt;
+    modbus_t *ctx = w->scenario->rtu ? modbus_new_rtu(w->device, 9600, 'N', 8, 1)
+                                     : modbus_new_tcp("127.0.0.1", w->port);
+    if (NULL == ctx)
+        return NULL;
+    modbus_set_slave(ctx, 1);
+
+    //server may still be starting up
+    for (attempt = 0; attempt < 50; ++attempt) {
+        if (0 == modbus_connect(ctx))
+            return ctx;
+        usleep(20000);
+    }
+    modbus_free(ctx);
+
+    return NULL;
+}
+
+static void *runWorker(void *arg) {
+    Worker *w = (Worker*)arg;
+    int i;
+
+    modbus_t *ctx = connectToServer(w);
+    if (NULL == ctx) {
+        w->errors = w->requestsNo;
+        memset(w->latencies, 0, w->requestsNo * sizeof(uint64_t));
+        return NULL;
+    }
+
+    for (i = 0; i < w->requestsNo; ++i) {
+        uint64_t start = mbuClockNs(CLOCK_MONOTONIC);
+        if (-1 == doRequest(ctx, w->scenario->fType, w->scenario->nb))
+            w->errors++;
+        w->latencies[i] = mbuClockNs(CLOCK_MONOTONIC) - start;
+    }
+
+    modbus_close(ctx);
+    modbus_free(ctx);
+
+    return NULL;
+}
+
+static pid_t startServer(const char serverPath[], int port, const char rtuDevice[]) {
+    char portArg[16];
+    char hrArg[16];
+    char coArg[16];
+    pid_t pid = fork();
+
+    if (0 != pid)
+        return pid;
+
+    snprintf(portArg, sizeof(portArg), "-p%d", port);
+    snprintf(hrArg, sizeof(hrArg), "--hr=%d", BENCH_REGISTERS_NO);
+    snprintf(coArg, sizeof(coArg), "--co=%d", BENCH_REGISTERS_NO);
+
+    //keep per-connection messages of the server out of the results
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+
+    if (NULL == rtuDevice)
+        execl(serverPath, serverPath, "-mtcp", portArg, hrArg, coArg, "127.0.0.1", (char*)NULL);
+    else
+        execl(serverPath, serverPath, "-mrtu", "-pnone", hrArg, coArg, rtuDevice, (char*)NULL);
+    fprintf(stderr, "Cannot start %s (%s)\n", serverPath, strerror(errno));
+    _exit(EXIT_FAILURE);
+}
+
+static void stopServer(pid_t pid) {
+    kill(pid, SIGINT);
+    waitpid(pid, NULL, 0);
+}
+
+/*
+ * RTU over a pseudo terminal pair: libmodbus needs a device path on both ends,
+ * so two ptys are created and their master sides are bridged with a thread.
+ */
+typedef struct {
+    int masters[2];
+    int slaves[2];//held open, otherwise masters report hangup until both ends connect
+    char slaveNames[2][64];
+    pthread_t thread;
+} PtyBridge;
+
+static void *runPtyBridge(void *arg) {
+    PtyBridge *bridge = (PtyBridge*)arg;
+    struct pollfd fds[2];
+    uint8_t buf[MODBUS_RTU_MAX_ADU_LENGTH];
+    int i;
+
+    for (;;) {
+        for (i = 0; i < 2; ++i) {
+            fds[i].fd = bridge->masters[i];
+            fds[i].events = POLLIN;
+        }
+        if (poll(fds, 2, -1) < 0) {
+            if (EINTR == errno)
+                continue;
+            break;
+        }
+        for (i = 0; i < 2; ++i) {
+            if (fds[i].revents & POLLIN) {
+                ssize_t len = read(bridge->masters[i], buf, sizeof(buf));
+                if (len > 0 && write(bridge->masters[1 - i], buf, len) != len)
+                    return NULL;
+            }
+            else if (fds[i].revents & POLLNVAL) {
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int openPtyBridge(PtyBridge *bridge) {
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        struct termios tio;
+        bridge->masters[i] = posix_openpt(O_RDWR | O_NOCTTY);
+        if (-1 == bridge->masters[i] || 0 != grantpt(bridge->masters[i]) || 0 != unlockpt(bridge->masters[i])) {
+            fprintf(stderr, "Cannot create pty (%s)\n", strerror(errno));
+            return 0;
+        }
+        tcgetattr(bridge->masters[i], &tio);
+        cfmakeraw(&tio);
+        tcsetattr(bridge->masters[i], TCSANOW, &tio);
+        snprintf(bridge->slaveNames[i], sizeof(bridge->slaveNames[i]), "%s", ptsname(bridge->masters[i]));
+        bridge->slaves[i] = open(bridge->slaveNames[i], O_RDWR | O_NOCTTY);
+    }
+
+    return (0 == pthread_create(&bridge->thread, NULL, runPtyBridge, bridge));
+}
+
+static void closePtyBridge(PtyBridge *bridge) {
+    pthread_cancel(bridge->thread);
+    pthread_join(bridge->thread, NULL);
+    for (int i = 0; i < 2; ++i) {
+        close(bridge->slaves[i]);
+        close(bridge->masters[i]);
+    }
+}
+
+static int compareLatencies(const void *a, const void *b) {
+    uint64_t la = *(const uint64_t*)a;
+    uint64_t lb = *(const uint64_t*)b;
+    return (la > lb) - (la < lb);
+}
+
+static void runScenario(const Scenario *s, const char serverPath[], int port, int requestsNo) {
+    Worker workers[BENCH_MAX_CONNECTIONS];
+    pthread_t threads[BENCH_MAX_CONNECTIONS];
+    PtyBridge bridge;
+    uint64_t *latencies;
+    uint64_t start, elapsed;
+    int perWorker = requestsNo / s->connections;
+    int total = perWorker * s->connections;
+    int errors = 0;
+    int i;
+    pid_t server;
+
+    if (0 == total)
+        return;
+
+    if (s->rtu) {
+        if (0 == openPtyBridge(&bridge))
+            return;
+        server = startServer(serverPath, port, bridge.slaveNames[0]);
+    }
+    else {
+        server = startServer(serverPath, port, NULL);
+    }
+
+    latencies = (uint64_t*)malloc(total * sizeof(uint64_t));
+    for (i = 0; i < s->connections; ++i) {
+        workers[i].scenario = s;
+        workers[i].device = s->rtu ? bridge.slaveNames[1] : NULL;
+        workers[i].port = port;
+        workers[i].requestsNo = perWorker;
+        workers[i].latencies = latencies + i * perWorker;
+        workers[i].errors = 0;
+    }
+
+    start = mbuClockNs(CLOCK_MONOTONIC);
+    for (i = 0; i < s->connections; ++i) {
+        pthread_create(&threads[i], NULL, runWorker, &workers[i]);
+    }
+    for (i = 0; i < s->connections; ++i) {
+        pthread_join(threads[i], NULL);
+        errors += workers[i].errors;
+    }
+    elapsed = mbuClockNs(CLOCK_MONOTONIC) - start;
+
+    stopServer(server);
+    if (s->rtu)
+        closePtyBridge(&bridge);
+
+    qsort(latencies, total, sizeof(uint64_t), compareLatencies);
+    printf("{\"scenario\":\"%s\",\"connections\":%d,\"requests\":%d,\"errors\":%d,\"seconds\":%.6f,"
+           "\"rps\":%.1f,\"min_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+           s->name, s->connections, total, errors, elapsed / 1e9, total * 1e9 / elapsed,
+           latencies[0] / 1e3, latencies[total / 2] / 1e3, latencies[total * 9 / 10] / 1e3,
+           latencies[total * 99 / 100] / 1e3, latencies[total - 1] / 1e3);
+    fflush(stdout);
+    free(latencies);
+}
+
+void printUsage(const char progName[]) {
+    printf("%s [-n<requests-no>=20000] [-r<rtu-requests-no>=2000] [-p<port>=15020] [-s<scenario-name>] <modbus_server-path>\n", progName);
+    printf("scenarios:\n");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i) {
+        printf("\t%s\n", scenarios[i].name);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int ok;
+    int requestsNo = 20000;
+    int rtuRequestsNo = 2000;
+    int port = 15020;
+    const char *only = NULL;
+    size_t i;
+
+    while (-1 != (c = getopt(argc, argv, "n:r:p:s:"))) {
+        switch (c) {
+        case 'n':
+            requestsNo = mbuGetInt(optarg, &ok);
+            break;
+        case 'r':
+            rtuRequestsNo = mbuGetInt(optarg, &ok);
+            break;
+        case 'p':
+            port = mbuGetInt(optarg, &ok);
+            break;
+        case 's':
+            only = optarg;
+            ok = 1;
+            break;
+        default:
+            ok = 0;
+        }
+        if (0 == ok) {
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (1 != argc - optind) {
+        printUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i) {
+        if (NULL != only && 0 != strcmp(only, scenarios[i].name))
+            continue;
+        //each scenario gets its own server, so a port in TIME_WAIT is not reused
+        runScenario(&scenarios[i], argv[optind], port + (int)i,
+                    scenarios[i].rtu ? rtuRequestsNo : requestsNo);
+    }
+
+    return 0;
+}
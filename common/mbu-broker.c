@@ -0,0 +1,466 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "mbu-broker.h"
+
+int brokerInit(Broker *broker, int sessionsNo, int depth, int timeoutMs, int idleS) {
+    memset(broker, 0, sizeof(*broker));
+    broker->sessionsNo = sessionsNo;
+    broker->depth = depth;
+    broker->timeoutMs = timeoutMs;
+    broker->idleS = idleS;
+    if (-1 == pipe(broker->wakePipe)) {
+        printf("Cannot create broker pipe: %s\n", strerror(errno));
+        return 0;
+    }
+    fcntl(broker->wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(broker->wakePipe[1], F_SETFL, O_NONBLOCK);
+    return 1;
+}
+
+static int parseTarget(const char name[], struct sockaddr_in *addr) {
+    char ip[32];
+    const char *colon = strrchr(name, ':');
+    int ok = 0;
+    int port;
+
+    if (0 == colon || colon - name >= (int)sizeof(ip))
+        return 0;
+    memcpy(ip, name, colon - name);
+    ip[colon - name] = '\0';
+    port = mbuGetInt(colon + 1, &ok);
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    return ok && port > 0 && port < 65536 && 1 == inet_pton(AF_INET, ip, &addr->sin_addr);
+}
+
+static void setTimeout(int fd, int option, int ms) {
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+}
+
+//connect() is limited by the send timeout
+static int connectSession(BrokerSession *session) {
+    BrokerTarget *target = session->target;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (-1 == fd)
+        return 0;
+    setTimeout(fd, SO_RCVTIMEO, target->broker->timeoutMs);
+    setTimeout(fd, SO_SNDTIMEO, target->broker->timeoutMs);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (-1 == connect(fd, (struct sockaddr*)&target->addr, sizeof(target->addr))) {
+        printf("Cannot connect to %s: %s\n", target->name, strerror(errno));
+        close(fd);
+        return 0;
+    }
+    session->fd = fd;
+    return 1;
+}
+
+static void closeSession(BrokerSession *session) {
+    if (-1 != session->fd) {
+        close(session->fd);
+        session->fd = -1;
+    }
+}
+
+static BrokerRequest *nextQueued(BrokerTarget *target) {
+    BrokerRequest *next = 0;
+    int i;
+
+    for (i = 0; i < BROKER_QUEUE_LENGTH; ++i) {
+        BrokerRequest *r = &target->requests[i];
+        if (BrokerRequestQueued == r->state && (0 == next || (int32_t)(r->seq - next->seq) < 0))
+            next = r;
+    }
+    return next;
+}
+
+//builds exception answer to the request frame
+static void fail(BrokerRequest *r, int code) {
+    r->rsp[0] = r->frame[0];
+    r->rsp[1] = r->frame[1] | 0x80;
+    r->rsp[2] = code;
+    r->rspLen = 3;
+    r->state = BrokerRequestDone;
+}
+
+static void wake(Broker *broker) {
+    if (-1 == write(broker->wakePipe[1], "", 1) && EAGAIN != errno)
+        printf("Broker wake up failed: %s\n", strerror(errno));
+}
+
+//waits for a request, a session left idle for too long is closed meanwhile
+static BrokerRequest *waitQueued(BrokerSession *session) {
+    BrokerTarget *target = session->target;
+    BrokerRequest *r;
+
+    while (0 == target->stop && 0 == (r = nextQueued(target))) {
+        if (-1 != session->fd) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += target->broker->idleS;
+            if (ETIMEDOUT == pthread_cond_timedwait(&target->cond, &target->lock, &deadline))
+                closeSession(session);
+        }
+        else {
+            pthread_cond_wait(&target->cond, &target->lock);
+        }
+    }
+    return r;
+}
+
+static void *sessionWorker(void *arg) {
+    BrokerSession *session = (BrokerSession*)arg;
+    BrokerTarget *target = session->target;
+    Broker *broker = target->broker;
+    BrokerRequest *inFlight[BROKER_MAX_DEPTH];
+    int inFlightNo = 0;
+    uint8_t adu[MODBUS_TCP_MAX_ADU_LENGTH];
+
+    pthread_mutex_lock(&target->lock);
+    for (;;) {
+        BrokerRequest *sending[BROKER_MAX_DEPTH];
+        BrokerRequest *r;
+        int sendingNo = 0;
+        int reconnected, connected, sent = 1;
+        int rc = 0;
+        int i;
+
+        if (0 == inFlightNo)
+            waitQueued(session);
+        if (target->stop)
+            break;
+        //fill the pipeline, frames are not changed once queued
+        while (inFlightNo < broker->depth && 0 != (r = nextQueued(target))) {
+            r->state = BrokerRequestInFlight;
+            r->targetTid = session->nextTid++;
+            inFlight[inFlightNo++] = r;
+            sending[sendingNo++] = r;
+        }
+        pthread_mutex_unlock(&target->lock);
+
+        reconnected = (-1 == session->fd);
+        connected = (-1 != session->fd || connectSession(session));
+        for (i = 0; connected && sent && i < sendingNo; ++i)
+            sent = mbuSendMbapFrame(session->fd, sending[i]->targetTid, sending[i]->frame, sending[i]->len);
+        if (connected && sent) {
+            errno = 0;
+            rc = mbuReadMbapAdu(session->fd, adu, sizeof(adu));
+        }
+
+        pthread_mutex_lock(&target->lock);
+        if (0 == connected) {
+            for (i = 0; i < inFlightNo; ++i)
+                fail(inFlight[i], MODBUS_EXCEPTION_GATEWAY_PATH);
+            target->failedNo += inFlightNo;
+            inFlightNo = 0;
+            wake(broker);
+            continue;
+        }
+        if (0 != reconnected)
+            target->connectsNo++;
+        if (rc > 0) {
+            uint16_t tid = (adu[0] << 8) | adu[1];
+            //late answers to failed requests are not expected, the session is closed on timeout
+            for (i = 0; i < inFlightNo && inFlight[i]->targetTid != tid; ++i)
+                ;
+            if (i < inFlightNo) {
+                r = inFlight[i];
+                r->rspLen = rc - MBU_MBAP_HEADER_LENGTH;
+                memcpy(r->rsp, adu + MBU_MBAP_HEADER_LENGTH, r->rspLen);
+                r->state = BrokerRequestDone;
+                inFlight[i] = inFlight[--inFlightNo];
+                target->requestsNo++;
+                wake(broker);
+            }
+            continue;
+        }
+
+        //no answer in time - give up the requests, broken session - send them once more on a new one
+        {
+            int timedOut = sent && (EAGAIN == errno || EWOULDBLOCK == errno);
+            closeSession(session);
+            for (i = 0; i < inFlightNo; ++i) {
+                r = inFlight[i];
+                if (0 == timedOut && 0 == r->retried) {
+                    r->retried = 1;
+                    r->state = BrokerRequestQueued;
+                }
+                else {
+                    fail(r, MODBUS_EXCEPTION_GATEWAY_TARGET);
+                    target->failedNo++;
+                }
+            }
+            inFlightNo = 0;
+            wake(broker);
+        }
+    }
+    pthread_mutex_unlock(&target->lock);
+    closeSession(session);
+
+    return 0;
+}
+
+BrokerTarget *brokerTarget(Broker *broker, const char name[]) {
+    BrokerTarget *target;
+    int i;
+
+    for (i = 0; i < broker->targetsNo; ++i) {
+        if (0 == strcmp(broker->targets[i]->name, name))
+            return broker->targets[i];
+    }
+    if (BROKER_MAX_TARGETS == broker->targetsNo) {
+        printf("At most %d targets are supported, %s is refused\n", BROKER_MAX_TARGETS, name);
+        return 0;
+    }
+
+    target = (BrokerTarget*)calloc(1, sizeof(BrokerTarget));
+    if (0 == target)
+        return 0;
+    if (strlen(name) >= sizeof(target->name) || 0 == parseTarget(name, &target->addr)) {
+        printf("Target %s is invalid, expecting <ip>:<port>\n", name);
+        free(target);
+        return 0;
+    }
+    strcpy(target->name, name);
+    target->broker = broker;
+    pthread_mutex_init(&target->lock, 0);
+    pthread_cond_init(&target->cond, 0);
+
+    for (i = 0; i < broker->sessionsNo; ++i) {
+        BrokerSession *session = &target->sessions[i];
+        session->target = target;
+        session->fd = -1;
+        session->nextTid = (uint16_t)(i << 12);
+        if (0 != pthread_create(&session->worker, 0, &sessionWorker, session)) {
+            printf("Cannot start session worker for %s\n", name);
+            break;
+        }
+        target->sessionsNo++;
+    }
+    if (0 == target->sessionsNo) {
+        free(target);
+        return 0;
+    }
+    broker->targets[broker->targetsNo++] = target;
+    printf("Target %s: %d sessions\n", name, target->sessionsNo);
+    return target;
+}
+
+void brokerSubmit(BrokerTarget *target, int fd, const uint8_t adu[], int len) {
+    const uint8_t *frame = adu + MBU_MBAP_HEADER_LENGTH;
+    int frameLen = len - MBU_MBAP_HEADER_LENGTH;
+    uint16_t transactionId = (adu[0] << 8) | adu[1];
+    BrokerRequest *r = 0;
+    uint8_t rsp[3];
+    int i;
+
+    if (frameLen < 2 || frameLen > MBU_MAX_FRAME_LENGTH) {
+        //answer right away, the client would wait out its timeout otherwise
+        rsp[0] = (frameLen > 0) ? frame[0] : 0;
+        rsp[1] = ((frameLen > 1) ? frame[1] : 0) | 0x80;
+        rsp[2] = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+        mbuSendMbapFrame(fd, transactionId, rsp, sizeof(rsp));
+        return;
+    }
+
+    pthread_mutex_lock(&target->lock);
+    for (i = 0; 0 == r && i < BROKER_QUEUE_LENGTH; ++i) {
+        if (BrokerRequestFree == target->requests[i].state)
+            r = &target->requests[i];
+    }
+    if (0 != r) {
+        r->state = BrokerRequestQueued;
+        r->seq = target->seq++;
+        r->retried = 0;
+        r->fd = fd;
+        r->clientTid = transactionId;
+        memcpy(r->frame, frame, frameLen);
+        r->len = frameLen;
+        pthread_cond_signal(&target->cond);
+    }
+    pthread_mutex_unlock(&target->lock);
+
+    if (0 == r) {
+        rsp[0] = frame[0];
+        rsp[1] = frame[1] | 0x80;
+        rsp[2] = MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY;
+        mbuSendMbapFrame(fd, transactionId, rsp, sizeof(rsp));
+    }
+}
+
+void brokerDeliver(Broker *broker) {
+    char buf[64];
+    int i, j;
+
+    while (read(broker->wakePipe[0], buf, sizeof(buf)) > 0)
+        ;
+
+    for (i = 0; i < broker->targetsNo; ++i) {
+        BrokerTarget *target = broker->targets[i];
+        for (j = 0; j < BROKER_QUEUE_LENGTH; ++j) {
+            BrokerRequest *r = &target->requests[j];
+            uint8_t rsp[MBU_MAX_FRAME_LENGTH];
+            uint16_t transactionId;
+            int fd, rspLen;
+
+            pthread_mutex_lock(&target->lock);
+            if (BrokerRequestDone != r->state) {
+                pthread_mutex_unlock(&target->lock);
+                continue;
+            }
+            fd = r->fd;
+            transactionId = r->clientTid;
+            rspLen = r->rspLen;
+            memcpy(rsp, r->rsp, rspLen);
+            r->state = BrokerRequestFree;
+            pthread_mutex_unlock(&target->lock);
+
+            if (-1 != fd)
+                mbuSendMbapFrame(fd, transactionId, rsp, rspLen);
+        }
+    }
+}
+
+void brokerDrop(Broker *broker, int fd) {
+    int i, j;
+
+    for (i = 0; i < broker->targetsNo; ++i) {
+        BrokerTarget *target = broker->targets[i];
+        pthread_mutex_lock(&target->lock);
+        for (j = 0; j < BROKER_QUEUE_LENGTH; ++j) {
+            BrokerRequest *r = &target->requests[j];
+            if (BrokerRequestFree == r->state || fd != r->fd)
+                continue;
+            //the one in flight is finished by the worker
+            if (BrokerRequestInFlight == r->state)
+                r->fd = -1;
+            else
+                r->state = BrokerRequestFree;
+        }
+        pthread_mutex_unlock(&target->lock);
+    }
+}
+
+void brokerPrintStats(Broker *broker, FILE *out) {
+    int i;
+
+    for (i = 0; i < broker->targetsNo; ++i) {
+        BrokerTarget *target = broker->targets[i];
+        pthread_mutex_lock(&target->lock);
+        fprintf(out, "%s: %llu answered, %llu failed requests, %llu connects\n", target->name,
+                (unsigned long long)target->requestsNo, (unsigned long long)target->failedNo,
+                (unsigned long long)target->connectsNo);
+        pthread_mutex_unlock(&target->lock);
+    }
+    fflush(out);
+}
+
+void brokerStop(Broker *broker) {
+    int i, j;
+
+    for (i = 0; i < broker->targetsNo; ++i) {
+        BrokerTarget *target = broker->targets[i];
+        pthread_mutex_lock(&target->lock);
+        target->stop = 1;
+        pthread_cond_broadcast(&target->cond);
+        pthread_mutex_unlock(&target->lock);
+        for (j = 0; j < target->sessionsNo; ++j)
+            pthread_join(target->sessions[j].worker, 0);
+        pthread_mutex_destroy(&target->lock);
+        pthread_cond_destroy(&target->cond);
+        free(target);
+    }
+    broker->targetsNo = 0;
+    close(broker->wakePipe[0]);
+    close(broker->wakePipe[1]);
+}
+
+static int connectBrokerCtxt(void *backend, modbus_t *ctx) {
+    BrokerBackend *broker = (BrokerBackend*)backend;
+    struct sockaddr_un addr;
+    BrokerHello hello;
+    int s;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, broker->path);
+    memset(&hello, 0, sizeof(hello));
+    memcpy(hello.magic, BROKER_MAGIC, sizeof(hello.magic));
+    snprintf(hello.target, sizeof(hello.target), "%s:%d", broker->tcp.ip, broker->tcp.port);
+
+    s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == s)
+        return -1;
+    if (-1 == connect(s, (struct sockaddr*)&addr, sizeof(addr))
+            || sizeof(hello) != send(s, &hello, sizeof(hello), MSG_NOSIGNAL)) {
+        close(s);
+        return -1;
+    }
+    modbus_set_socket(ctx, s);
+
+    return 0;
+}
+
+MbuBackendParams *initBrokerBackend(BrokerBackend *broker, const MbuBackendParams *tcp, const char path[]) {
+    if (strlen(path) >= sizeof(broker->path)) {
+        printf("Broker socket path %s is too long\n", path);
+        return 0;
+    }
+    memcpy(&broker->tcp, tcp, sizeof(MbuTcpBackend));
+    strcpy(broker->path, path);
+    //contexts are still tcp ones, only their socket leads to the broker
+    broker->tcp.base.connectCtxt = &connectBrokerCtxt;
+
+    return (MbuBackendParams*)broker;
+}
+
+MbuBackendParams *createBrokerBackend(MbuBackendParams *tcp, const char path[]) {
+    BrokerBackend *broker = (BrokerBackend*)malloc(sizeof(BrokerBackend));
+
+    if (0 == initBrokerBackend(broker, tcp, path)) {
+        free(broker);
+        return 0;
+    }
+    //del of the tcp backend frees the broker one, which begins with it
+    free(tcp);
+    return (MbuBackendParams*)broker;
+}
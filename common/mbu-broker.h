@@ -0,0 +1,149 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_BROKER_H
+#define MBU_BROKER_H
+
+/*
+ * Connection broker: keeps a pool of tcp sessions per target device open and shares them
+ * among short-lived clients, which connect to the broker over a unix socket. A client
+ * names its target in a hello message and then talks modbus tcp (MBAP) as to the device.
+ * Requests to a target are queued and taken by its session workers; each session sends
+ * at most depth requests before waiting for their answers (1 - serialized), under own
+ * transaction ids. Answers are handed back to the select() loop through a pipe, as with
+ * the gateway. A request lost to a broken session is sent once more on a new one; no
+ * answer gives exception 0x0B, no connection to the target 0x0A.
+ */
+
+#include <stdio.h>
+#include <netinet/in.h>
+
+#include "mbu-common.h"
+#include "mbu-frame.h"
+
+#define BROKER_MAX_TARGETS 64
+#define BROKER_MAX_SESSIONS 8
+#define BROKER_MAX_DEPTH 16
+#define BROKER_QUEUE_LENGTH 256
+#define BROKER_DEFAULT_TIMEOUT_MS 1000
+#define BROKER_DEFAULT_IDLE_S 60
+#define BROKER_MAGIC "MBUBRK1"
+
+//first message of a client
+typedef struct {
+    char magic[8];
+    char target[56];//"<ip>:<port>"
+} BrokerHello;
+
+typedef enum {
+    BrokerRequestFree,
+    BrokerRequestQueued,
+    BrokerRequestInFlight,
+    BrokerRequestDone
+} BrokerRequestState;
+
+typedef struct {
+    BrokerRequestState state;
+    uint32_t seq;//fifo order
+    int retried;
+    int fd;//client, -1 when it is gone
+    uint16_t clientTid;
+    uint16_t targetTid;
+    uint8_t frame[MBU_MAX_FRAME_LENGTH];
+    int len;
+    uint8_t rsp[MBU_MAX_FRAME_LENGTH];
+    int rspLen;
+} BrokerRequest;
+
+struct Broker;
+struct BrokerTarget;
+
+typedef struct {
+    struct BrokerTarget *target;
+    pthread_t worker;
+    int fd;//-1 when not connected
+    uint16_t nextTid;
+} BrokerSession;
+
+typedef struct BrokerTarget {
+    struct Broker *broker;
+    char name[56];
+    struct sockaddr_in addr;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    uint32_t seq;
+    BrokerRequest requests[BROKER_QUEUE_LENGTH];
+    BrokerSession sessions[BROKER_MAX_SESSIONS];
+    int sessionsNo;
+
+    uint64_t requestsNo;
+    uint64_t failedNo;
+    uint64_t connectsNo;
+} BrokerTarget;
+
+typedef struct Broker {
+    BrokerTarget *targets[BROKER_MAX_TARGETS];
+    int targetsNo;
+    int sessionsNo;//per target
+    int depth;
+    int timeoutMs;
+    int idleS;//sessions unused that long are closed
+    int wakePipe[2];//[0] is watched by the select() loop
+} Broker;
+
+int brokerInit(Broker *broker, int sessionsNo, int depth, int timeoutMs, int idleS);
+
+//finds the target named "<ip>:<port>" or starts sessions for it, returns NULL if it is invalid
+BrokerTarget *brokerTarget(Broker *broker, const char name[]);
+
+//queues tcp ADU of client fd for the target (or answers it with exception if the queue is full)
+void brokerSubmit(BrokerTarget *target, int fd, const uint8_t adu[], int len);
+
+//to be called when wakePipe[0] is readable, sends answers of finished requests
+void brokerDeliver(Broker *broker);
+
+//forgets the closed client, so no answer is sent to its descriptor
+void brokerDrop(Broker *broker, int fd);
+
+void brokerPrintStats(Broker *broker, FILE *out);
+
+void brokerStop(Broker *broker);
+
+typedef struct {
+    MbuTcpBackend tcp;//has to be first, the backend is used as tcp one
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+} BrokerBackend;
+
+/*
+ * Client side: wraps tcp backend (taking it over), so that its contexts are connected
+ * through the broker listening on path instead of directly to ip:port.
+ */
+MbuBackendParams *createBrokerBackend(MbuBackendParams *tcp, const char path[]);
+
+//as above, in storage of the caller; tcp backend is copied and stays with the caller
+MbuBackendParams *initBrokerBackend(BrokerBackend *broker, const MbuBackendParams *tcp, const char path[]);
+
+#endif //MBU_BROKER_H
@@ -0,0 +1,239 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "mbu-bulk.h"
+#include "mbu-codec.h"
+
+//reads whole stdin into malloc'ed buffer
+static int readStdin(MbuMappedFile *file) {
+    size_t capacity = 1 << 16;
+    char *buf = (char*)malloc(capacity);
+    size_t len = 0;
+
+    if (0 == buf) {
+        printf("Cannot allocate stdin buffer\n");
+        return 0;
+    }
+    for (;;) {
+        ssize_t ret;
+        if (len == capacity) {
+            char *grown = (char*)realloc(buf, capacity * 2);
+            if (0 == grown) {
+                printf("Stdin data are too big (%zu bytes read)\n", len);
+                free(buf);
+                return 0;
+            }
+            buf = grown;
+            capacity *= 2;
+        }
+        ret = read(STDIN_FILENO, buf + len, capacity - len);
+        if (ret < 0) {
+            if (EINTR == errno)
+                continue;
+            printf("Cannot read stdin (%s)\n", strerror(errno));
+            free(buf);
+            return 0;
+        }
+        if (0 == ret)
+            break;
+        len += ret;
+    }
+
+    file->data = buf;
+    file->size = len;
+    return 1;
+}
+
+//parses whitespace/comma separated values; bits are stored one per byte
+static int parseTextValues(const char *cur, const char *end, int bits, void *values, int *count) {
+    int n = 0;
+
+    long maxValue = bits ? 1 : UINT16_MAX;
+
+    for (;;) {
+        const char *at;
+        long value;
+        while (cur < end && (' ' == *cur || '\t' == *cur || '\r' == *cur || '\n' == *cur || ',' == *cur || ';' == *cur))
+            cur++;
+        if (cur == end)
+            break;
+        at = cur;
+        if (0 == mbuScanInt(&cur, end, &value) || value < 0 || value > maxValue) {
+            printf("Unexpected write data at \"%.10s\" (values are 0-%ld)\n", at, maxValue);
+            return 0;
+        }
+        if (bits)
+            ((uint8_t*)values)[n++] = (uint8_t)value;
+        else
+            ((uint16_t*)values)[n++] = (uint16_t)value;
+    }
+
+    *count = n;
+    return 1;
+}
+
+int loadWriteData(const char path[], int binary, int bits, void **values, int *count) {
+    MbuMappedFile file;
+    int fromStdin = (0 == strcmp(path, "-"));
+    int ok = 1;
+
+    if (0 == (fromStdin ? readStdin(&file) : mbuMapFile(path, &file))) {
+        return 0;
+    }
+
+    if (binary) {
+        const uint8_t *src = (const uint8_t*)file.data;
+        if (bits) {
+            *count = file.size * 8;
+            *values = malloc(*count + 1);
+            if (0 == *values) {
+                printf("Cannot allocate memory for %d coils\n", *count);
+                ok = 0;
+            }
+            else
+                modbus_set_bits_from_bytes((uint8_t*)*values, 0, *count, src);
+        }
+        else if (0 != file.size % 2) {
+            printf("Write data size %zu is not a multiple of register size\n", file.size);
+            ok = 0;
+        }
+        else {
+            uint16_t *regs;
+            size_t i;
+            *count = file.size / 2;
+            regs = (uint16_t*)malloc(*count * sizeof(uint16_t) + 1);
+            if (0 == regs) {
+                printf("Cannot allocate memory for %d registers\n", *count);
+                ok = 0;
+            }
+            else {
+                for (i = 0; i < file.size / 2; ++i) {
+                    regs[i] = (uint16_t)((src[2 * i] << 8) | src[2 * i + 1]);
+                }
+            }
+            *values = regs;
+        }
+    }
+    else {
+        //there can't be more values than every other character
+        size_t maxCount = file.size / 2 + 1;
+        *values = malloc(maxCount * (bits ? sizeof(uint8_t) : sizeof(uint16_t)));
+        if (0 != *values) {
+            ok = parseTextValues(file.data, file.data + file.size, bits, *values, count);
+            if (0 == ok)
+                free(*values);
+        }
+        else {
+            printf("Cannot allocate memory for write data\n");
+            ok = 0;
+        }
+    }
+
+    if (ok && 0 == *count) {
+        printf("No values to write in %s\n", fromStdin ? "stdin" : path);
+        free(*values);
+        ok = 0;
+    }
+
+    if (fromStdin)
+        free((void*)file.data);
+    else
+        mbuUnmapFile(&file);
+
+    return ok;
+}
+
+int bulkWrite(modbus_t *ctx, MbuConnType type, int slave, int fType, int addr, int nb, const void *values,
+              int window, CaptureLog *log) {
+    int bits = (MbuWriteMultipleCoils == fType);
+    int chunkMax = bits ? MODBUS_MAX_WRITE_BITS : MODBUS_MAX_WRITE_REGISTERS;
+    int functionAt = codecHeaderLength(type) + 1;
+    int chunks[BULK_MAX_WINDOW];//sizes of in-flight requests, oldest at chunks[head]
+    uint16_t tids[BULK_MAX_WINDOW];//their transaction ids (stream transports)
+    uint16_t nextTid = 0;
+    int stream = (MbuTcp == type || MbuUnix == type);
+    int head = 0, inFlight = 0;
+    int sentNo = 0, ackedNo = 0;
+
+    if (0 == stream || window < 1)
+        window = 1;
+    if (window > BULK_MAX_WINDOW)
+        window = BULK_MAX_WINDOW;
+
+    while (ackedNo < nb) {
+        uint8_t rsp[MODBUS_MAX_ADU_LENGTH];
+
+        while (inFlight < window && sentNo < nb) {
+            uint8_t frame[MBU_MAX_FRAME_LENGTH];
+            int chunk = (nb - sentNo < chunkMax) ? nb - sentNo : chunkMax;
+            const void *src = bits ? (const void*)((const uint8_t*)values + sentNo)
+                                   : (const void*)((const uint16_t*)values + sentNo);
+            int len = buildRequestFrame(frame, slave, fType, addr + sentNo, chunk, src);
+
+            if (0 != log)
+                captureRecord(log, CaptureRequest, frame, len);
+            //libmodbus does not tell the transaction id it used, requests carry ours to match the answers
+            if (stream) {
+                tids[(head + inFlight) % BULK_MAX_WINDOW] = nextTid;
+                if (0 == mbuSendMbapFrame(modbus_get_socket(ctx), nextTid++, frame, len))
+                    return ackedNo;
+            }
+            else if (-1 == modbus_send_raw_request(ctx, frame, len)) {
+                return ackedNo;
+            }
+
+            chunks[(head + inFlight) % BULK_MAX_WINDOW] = chunk;
+            inFlight++;
+            sentNo += chunk;
+        }
+
+        //slave answers in order, so the response belongs to the oldest request
+        if (-1 == modbus_receive_confirmation(ctx, rsp))
+            return ackedNo;
+        if (stream && ((rsp[0] << 8) | rsp[1]) != tids[head]) {
+            errno = EMBBADDATA;
+            return ackedNo;
+        }
+        if (rsp[functionAt] == (fType | 0x80)) {
+            errno = MODBUS_ENOBASE + rsp[functionAt + 1];
+            return ackedNo;
+        }
+        if (rsp[functionAt] != fType) {
+            errno = EMBBADDATA;
+            return ackedNo;
+        }
+
+        ackedNo += chunks[head];
+        head = (head + 1) % BULK_MAX_WINDOW;
+        inFlight--;
+    }
+
+    return ackedNo;
+}
@@ -0,0 +1,57 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_BULK_H
+#define MBU_BULK_H
+
+/*
+ * Bulk writes of coils/holding registers: write data is loaded from a file or stdin at once,
+ * split into maximal FC 0x0F/0x10 requests and (over tcp) several requests are kept in flight.
+ */
+
+#include <stdint.h>
+
+#include "mbu-frame.h"
+#include "mbu-capture.h"
+
+#define BULK_DEFAULT_WINDOW 8
+#define BULK_MAX_WINDOW 64
+
+/*
+ * Loads write data from path ("-" for stdin). Binary data are registers as big-endian words
+ * or coils packed LSB first, text data are dec/hex numbers (0-65535, 0 or 1 for coils). Returns 1 on
+ * success, *values is malloc'ed; no values at all is a failure.
+ */
+int loadWriteData(const char path[], int binary, int bits, void **values, int *count);
+
+/*
+ * Writes nb coils (one per byte) or registers starting at addr with as few requests as possible,
+ * keeping up to window requests in flight (stream transports only, otherwise 1), answers are matched
+ * by transaction id. Returns number of elements confirmed by the slave; if it is less than nb,
+ * errno describes the failure.
+ */
+int bulkWrite(modbus_t *ctx, MbuConnType type, int slave, int fType, int addr, int nb, const void *values,
+              int window, CaptureLog *log);
+
+#endif //MBU_BULK_H
@@ -0,0 +1,186 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "mbu-capture.h"
+
+int captureOpen(CaptureLog *log, const char path[]) {
+    if (0 == asyncWriterOpen(&log->writer, path, CAPTURE_BUFFER_SIZE)) {
+        return 0;
+    }
+
+    if (0 == asyncWriterFileSize(&log->writer)) {
+        asyncWriterAppend(&log->writer, CAPTURE_MAGIC, CAPTURE_HEADER_LENGTH);
+    }
+    else {
+        //appending - make sure it is a capture file indeed
+        char magic[CAPTURE_HEADER_LENGTH];
+        int fd = open(path, O_RDONLY);
+        int ok = (CAPTURE_HEADER_LENGTH == read(fd, magic, CAPTURE_HEADER_LENGTH)
+                  && 0 == memcmp(magic, CAPTURE_MAGIC, CAPTURE_HEADER_LENGTH));
+        close(fd);
+        if (0 == ok) {
+            printf("%s exists and is not a capture file\n", path);
+            asyncWriterClose(&log->writer);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void captureRecord(CaptureLog *log, CaptureDirection dir, const uint8_t frame[], int len) {
+    uint8_t record[CAPTURE_RECORD_HEADER_LENGTH + MBU_MAX_FRAME_LENGTH];
+    uint64_t ts = mbuClockNs(CLOCK_REALTIME);
+    int i;
+
+    if (len <= 0 || len > MBU_MAX_FRAME_LENGTH) {
+        return;
+    }
+
+    for (i = 0; i < 8; ++i) {
+        record[i] = (uint8_t)(ts >> (8 * i));
+    }
+    record[8] = (uint8_t)dir;
+    record[9] = (uint8_t)len;
+    memcpy(record + CAPTURE_RECORD_HEADER_LENGTH, frame, len);
+
+    asyncWriterAppend(&log->writer, record, CAPTURE_RECORD_HEADER_LENGTH + len);
+}
+
+void captureClose(CaptureLog *log) {
+    asyncWriterClose(&log->writer);
+}
+
+int captureReaderOpen(CaptureReader *reader, const char path[]) {
+    if (0 == mbuMapFile(path, &reader->file)) {
+        return 0;
+    }
+    if (reader->file.size < CAPTURE_HEADER_LENGTH
+            || 0 != memcmp(reader->file.data, CAPTURE_MAGIC, CAPTURE_HEADER_LENGTH)) {
+        printf("%s is not a capture file\n", path);
+        mbuUnmapFile(&reader->file);
+        return 0;
+    }
+    reader->pos = CAPTURE_HEADER_LENGTH;
+
+    return 1;
+}
+
+int captureReaderNext(CaptureReader *reader, uint64_t *ts, CaptureDirection *dir, const uint8_t **frame, int *len) {
+    const uint8_t *rec = (const uint8_t*)reader->file.data + reader->pos;
+    size_t left = reader->file.size - reader->pos;
+    int i;
+
+    if (0 == left) {
+        return 0;
+    }
+    if (left < CAPTURE_RECORD_HEADER_LENGTH || left < (size_t)CAPTURE_RECORD_HEADER_LENGTH + rec[9]) {
+        return -1;
+    }
+
+    *ts = 0;
+    for (i = 0; i < 8; ++i) {
+        *ts |= (uint64_t)rec[i] << (8 * i);
+    }
+    *dir = (CaptureDirection)rec[8];
+    *len = rec[9];
+    *frame = rec + CAPTURE_RECORD_HEADER_LENGTH;
+    reader->pos += CAPTURE_RECORD_HEADER_LENGTH + *len;
+
+    return 1;
+}
+
+void captureReaderClose(CaptureReader *reader) {
+    mbuUnmapFile(&reader->file);
+}
+
+int replayCapture(modbus_t *ctx, MbuConnType type, const char path[], double speed, CaptureLog *log) {
+    CaptureReader reader;
+    uint64_t ts, prevTs = 0;
+    uint64_t offsetNs = 0;//from the first request, as the log is replayed
+    uint64_t startNs, endNs;
+    CaptureDirection dir;
+    const uint8_t *frame;
+    int len;
+    int ret;
+    int sent = 0, ok = 0;
+
+    if (0 == captureReaderOpen(&reader, path)) {
+        return -1;
+    }
+
+    startNs = mbuClockNs(CLOCK_MONOTONIC);
+    while (1 == (ret = captureReaderNext(&reader, &ts, &dir, &frame, &len))) {
+        uint8_t rsp[MODBUS_MAX_ADU_LENGTH];
+
+        if (CaptureRequest != dir || len < 2) {
+            continue;
+        }
+        //timestamps are wall clock, a gap the clock was stepped back over counts as none
+        if (0 != prevTs && ts > prevTs) {
+            offsetNs += ts - prevTs;
+        }
+        prevTs = ts;
+
+        if (speed > 0) {
+            mbuSleepUntil(startNs + (uint64_t)(offsetNs / speed));
+        }
+
+        if (0 != log) {
+            captureRecord(log, CaptureRequest, frame, len);
+        }
+        sent++;
+        if (-1 == modbus_send_raw_request(ctx, (uint8_t*)frame, len)) {
+            printf("Request %d failed: %s\n", sent, modbus_strerror(errno));
+            continue;
+        }
+        //no response to rtu broadcasts
+        if (MbuRtu == type && MODBUS_BROADCAST_ADDRESS == frame[0]) {
+            ok++;
+            continue;
+        }
+        if (-1 == modbus_receive_confirmation(ctx, rsp)) {
+            printf("Request %d failed: %s\n", sent, modbus_strerror(errno));
+            continue;
+        }
+        ok++;
+    }
+    endNs = mbuClockNs(CLOCK_MONOTONIC);
+
+    if (-1 == ret) {
+        printf("Capture %s is truncated, stopped at offset %zu\n", path, reader.pos);
+    }
+    captureReaderClose(&reader);
+
+    printf("Replayed %d requests (%d ok) in %.3f s (%.1f req/s)\n", sent, ok,
+           (endNs - startNs) / 1e9, (endNs > startNs) ? sent * 1e9 / (endNs - startNs) : 0.0);
+
+    return ok;
+}
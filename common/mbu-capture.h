@@ -0,0 +1,76 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_CAPTURE_H
+#define MBU_CAPTURE_H
+
+/*
+ * Traffic capture log:
+ *  header: "MBUCAP1\0"
+ *  record: uint64 timestamp [ns since epoch, little endian], uint8 direction, uint8 length,
+ *          frame (slave id + PDU, see mbu-frame.h)
+ */
+
+#include <stdint.h>
+
+#include "mbu-writer.h"
+#include "mbu-frame.h"
+
+#define CAPTURE_MAGIC "MBUCAP1"
+#define CAPTURE_HEADER_LENGTH 8
+#define CAPTURE_RECORD_HEADER_LENGTH 10
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+
+typedef enum {
+    CaptureRequest = 0,
+    CaptureResponse = 1
+} CaptureDirection;
+
+typedef struct {
+    AsyncWriter writer;
+} CaptureLog;
+
+int captureOpen(CaptureLog *log, const char path[]);
+void captureRecord(CaptureLog *log, CaptureDirection dir, const uint8_t frame[], int len);
+void captureClose(CaptureLog *log);
+
+typedef struct {
+    MbuMappedFile file;
+    size_t pos;
+} CaptureReader;
+
+int captureReaderOpen(CaptureReader *reader, const char path[]);
+
+//returns 1 if next record was read, 0 at the end of the log, -1 if the log is truncated
+int captureReaderNext(CaptureReader *reader, uint64_t *ts, CaptureDirection *dir, const uint8_t **frame, int *len);
+
+void captureReaderClose(CaptureReader *reader);
+
+/*
+ * Re-issues captured requests through ctx. Requests are spaced as in the log divided by speed,
+ * speed <= 0 sends them back-to-back. Returns number of requests that got a valid response.
+ */
+int replayCapture(modbus_t *ctx, MbuConnType type, const char path[], double speed, CaptureLog *log);
+
+#endif //MBU_CAPTURE_H
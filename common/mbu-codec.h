@@ -0,0 +1,104 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_CODEC_H
+#define MBU_CODEC_H
+
+/*
+ * Modbus ADU codec independent of libmodbus:
+ *  - rtu: slave id + PDU + CRC16 (low byte first);
+ *  - tcp (also unix and udp): MBAP header + unit id + PDU.
+ * Parsing does not copy, the decoded frame (unit id + PDU, as in mbu-frame.h) points into
+ * the caller's buffer. CRC16 takes 4 bytes per step (slicing-by-4) from constant tables.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbu-common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CODEC_RTU_MAX_ADU_LENGTH 256
+#define CODEC_TCP_MAX_ADU_LENGTH 260
+
+typedef enum {
+    CodecOk = 0,
+    CodecIncomplete = -1,//more bytes are needed
+    CodecInvalid = -2,//unknown function, bad MBAP header or length
+    CodecBadCrc = -3
+} CodecStatus;
+
+typedef struct {
+    const uint8_t *frame;//unit id + PDU, points into the parsed buffer
+    int len;
+    int aduLen;//bytes of the buffer taken by the ADU
+    uint16_t transactionId;//tcp only
+} CodecFrame;
+
+uint16_t codecCrc16(const uint8_t data[], size_t len);
+
+//byte at a time, as libmodbus computes it; reference for tests and benchmarks
+uint16_t codecCrc16Bytewise(const uint8_t data[], size_t len);
+
+//length of the rtu ADU (with CRC) starting buf, as far as its first bytes tell, or CodecStatus
+int codecRtuLength(const uint8_t buf[], int len, int isRequest);
+
+//parse ADU at the start of buf, return CodecStatus
+int codecParseRtu(const uint8_t buf[], int len, int isRequest, CodecFrame *frame);
+int codecParseTcp(const uint8_t buf[], int len, CodecFrame *frame);
+
+//build ADU of the frame, return its length (adu may be frame - header length, to add the header in place)
+int codecEncodeRtu(uint8_t adu[], const uint8_t frame[], int len);
+int codecEncodeTcp(uint8_t adu[], uint16_t transactionId, const uint8_t frame[], int len);
+
+//offset of the frame in ADU: 0 for rtu, MBAP header for the others
+int codecHeaderLength(MbuConnType type);
+
+/*
+ * Tcp ADUs of a stream socket put together from reads that do not block, so a peer sending
+ * part of an ADU does not hold up the loop serving other sockets.
+ */
+typedef struct {
+    uint8_t buf[2 * CODEC_TCP_MAX_ADU_LENGTH];
+    int len;
+    int start;//first byte not taken yet
+} CodecStream;
+
+void codecStreamReset(CodecStream *stream);
+
+//reads what the socket has, returns 0 on eof or error
+int codecStreamFill(CodecStream *stream, int fd);
+
+//takes the next whole ADU: returns its length and points adu into the stream (valid until
+//the next fill), 0 if more bytes are needed, CodecInvalid if the peer does not speak modbus tcp
+int codecStreamNext(CodecStream *stream, const uint8_t **adu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MBU_CODEC_H
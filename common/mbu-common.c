@@ -0,0 +1,778 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "mbu-common.h"
+#include "mbu-codec.h"
+
+int mbuGetInt(const char str[], int *ok) {
+    int value;
+    int ret = sscanf(str, "0x%x", &value);
+    if (0 >= ret) {//couldn't convert from hex, try dec
+        ret = sscanf(str, "%d", &value);
+    }
+
+    if (0 != ok) {
+        *ok = (0 < ret);
+    }
+
+    return value;
+}
+
+int mbuScanInt(const char **cur, const char *end, long *value) {
+    const char *p = *cur;
+    long v = 0;
+    int base = 10;
+    int negative = 0;
+    int digits = 0;
+
+    if (p < end && '-' == *p) {
+        negative = 1;
+        p++;
+    }
+    if (p + 1 < end && '0' == p[0] && ('x' == p[1] || 'X' == p[1])) {
+        base = 16;
+        p += 2;
+    }
+
+    for (; p < end; ++p, ++digits) {
+        char ch = *p;
+        int d;
+        if (ch >= '0' && ch <= '9')
+            d = ch - '0';
+        else if (16 == base && ch >= 'a' && ch <= 'f')
+            d = ch - 'a' + 10;
+        else if (16 == base && ch >= 'A' && ch <= 'F')
+            d = ch - 'A' + 10;
+        else
+            break;
+        //too long a number is not a number, callers report the field
+        if (v > (LONG_MAX - d) / base)
+            return 0;
+        v = v * base + d;
+    }
+
+    if (0 == digits) {
+        return 0;
+    }
+
+    *value = negative ? -v : v;
+    *cur = p;
+    return 1;
+}
+
+int mbuParseAddressList(const char str[], int addresses[], int maxNo) {
+    const char *cur = str;
+    const char *end = str + strlen(str);
+    int no = 0;
+
+    while (cur < end) {
+        long from, to;
+        if (0 == mbuScanInt(&cur, end, &from))
+            return 0;
+        to = from;
+        if (cur < end && '-' == *cur) {
+            cur++;
+            if (0 == mbuScanInt(&cur, end, &to))
+                return 0;
+        }
+        if (from < 1 || to > 247 || from > to)
+            return 0;
+        for (; from <= to; ++from) {
+            if (no == maxNo)
+                return 0;
+            addresses[no++] = (int)from;
+        }
+        if (cur < end && ',' != *cur++)
+            return 0;
+    }
+
+    return no;
+}
+
+uint64_t mbuClockNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void mbuSleepUntil(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0))
+        ;
+}
+
+int mbuMapFile(const char path[], MbuMappedFile *file) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (-1 == fd) {
+        printf("Cannot open %s (%s)\n", path, strerror(errno));
+        return 0;
+    }
+    if (-1 == fstat(fd, &st)) {
+        printf("Cannot stat %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    file->size = st.st_size;
+    file->data = 0;
+    if (0 < file->size) {
+        void *addr = mmap(0, file->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (MAP_FAILED == addr) {
+            printf("Cannot map %s (%s)\n", path, strerror(errno));
+            close(fd);
+            return 0;
+        }
+        madvise(addr, file->size, MADV_SEQUENTIAL);
+        file->data = (const char*)addr;
+    }
+    close(fd);
+
+    return 1;
+}
+
+void mbuUnmapFile(MbuMappedFile *file) {
+    if (0 != file->data) {
+        munmap((void*)file->data, file->size);
+        file->data = 0;
+    }
+}
+
+int mbuReadFull(int fd, uint8_t buf[], size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t ret = read(fd, buf + done, len - done);
+        if (ret < 0 && EINTR == errno)
+            continue;
+        if (ret <= 0)
+            return 0;
+        done += ret;
+    }
+    return 1;
+}
+
+int mbuMbapAduLength(const uint8_t adu[]) {
+    return MBU_MBAP_HEADER_LENGTH + ((adu[4] << 8) | adu[5]);
+}
+
+int mbuReadMbapAdu(int fd, uint8_t adu[], int maxLen) {
+    int len;
+    if (0 == mbuReadFull(fd, adu, MBU_MBAP_HEADER_LENGTH))
+        return 0;
+    len = mbuMbapAduLength(adu);
+    if (len > maxLen || len <= MBU_MBAP_HEADER_LENGTH)
+        return 0;
+    if (0 == mbuReadFull(fd, adu + MBU_MBAP_HEADER_LENGTH, len - MBU_MBAP_HEADER_LENGTH))
+        return 0;
+    return len;
+}
+
+int mbuSendMbapFrame(int fd, uint16_t transactionId, const uint8_t frame[], int len) {
+    uint8_t adu[CODEC_TCP_MAX_ADU_LENGTH];
+    int sent = 0;
+
+    if (len > CODEC_TCP_MAX_ADU_LENGTH - MBU_MBAP_HEADER_LENGTH)
+        return 0;
+    len = codecEncodeTcp(adu, transactionId, frame, len);
+
+    //the peer may be gone already, do not get killed by SIGPIPE
+    while (sent < len) {
+        ssize_t rc = send(fd, adu + sent, len - sent, MSG_NOSIGNAL);
+        if (rc <= 0) {
+            if (-1 == rc && EINTR == errno)
+                continue;
+            return 0;
+        }
+        sent += rc;
+    }
+    return 1;
+}
+
+static int connectModbusCtxt(void *backend, modbus_t *ctx) {
+    (void)backend;
+    return modbus_connect(ctx);
+}
+
+static int setRtuParam(void *backend, char c, char *value) {
+    MbuRtuBackend *rtuParams = (MbuRtuBackend*)backend;
+    int ok = 1;
+
+    switch (c) {
+    case 'b': {
+        rtuParams->baud = mbuGetInt(value, &ok);
+        if (0 == ok || rtuParams->baud <= 0) {
+            printf("Baudrate is invalid %s", value);
+            ok = 0;
+        }
+    }
+        break;
+    case 'd': {
+        int db = mbuGetInt(value, &ok);
+        if (0 == ok || (7 != db && 8 != db)) {
+            printf("Data bits incorrect (%s)", value);
+            ok = 0;
+        }
+        else
+            rtuParams->dataBits = db;
+    }
+        break;
+    case 's': {
+        int sb = mbuGetInt(value, &ok);
+        if (0 == ok || (1 != sb && 2 != sb)) {
+            printf("Stop bits incorrect (%s)", value);
+            ok = 0;
+        }
+        else
+            rtuParams->stopBits = sb;
+    }
+        break;
+    case 'p': {
+        if (0 == strcmp(value, "none")) {
+            rtuParams->parity = 'N';
+        }
+        else if (0 == strcmp(value, "even")) {
+            rtuParams->parity = 'E';
+        }
+        else if (0 == strcmp(value, "odd")) {
+            rtuParams->parity = 'O';
+        }
+        else {
+            printf("Unrecognized parity (%s)", value);
+            ok = 0;
+        }
+    }
+        break;
+    default:
+        printf("Unknown rtu param (%c: %s)\n\n", c, value);
+        ok = 0;
+    }
+
+    return ok;
+}
+
+static modbus_t *createRtuCtxt(void *backend) {
+    MbuRtuBackend *rtu = (MbuRtuBackend*)backend;
+    modbus_t *ctx = modbus_new_rtu(rtu->devName, rtu->baud, rtu->parity, rtu->dataBits, rtu->stopBits);
+
+    return ctx;
+}
+
+static void delRtu(void *backend) {
+    MbuRtuBackend *rtu = (MbuRtuBackend*)backend;
+    free(rtu);
+}
+
+static void releaseBackend(void *backend) {(void)backend;}
+
+static int listenForRtuConnection(void *backend, modbus_t *ctx) {
+    (void)backend;
+    (void)ctx;
+
+    printf("Connecting...\r\n");
+    return (0 == modbus_connect(ctx));
+}
+static void closeRtuConnection(void *backend) {(void)backend;}
+
+MbuBackendParams *mbuCreateRtuBackend() {
+    MbuRtuBackend *rtu = (MbuRtuBackend*)malloc(sizeof(MbuRtuBackend));
+    mbuInitRtuBackend(rtu);
+    rtu->base.del = &delRtu;
+    return (MbuBackendParams*)rtu;
+}
+
+MbuBackendParams *mbuInitRtuBackend(MbuRtuBackend *rtu) {
+    rtu->base.type = MbuRtu;
+    rtu->base.setParam = &setRtuParam;
+    rtu->base.createCtxt = &createRtuCtxt;
+    rtu->base.listenForConnection = &listenForRtuConnection;
+    rtu->base.closeConnection = &closeRtuConnection;
+    rtu->base.del = &releaseBackend;
+    rtu->base.connectCtxt = &connectModbusCtxt;
+    rtu->base.listenSocket = 0;
+
+    strcpy(rtu->devName, "");
+    rtu->baud = 9600;
+    rtu->dataBits = 8;
+    rtu->stopBits = 1;
+    rtu->parity = 'E';
+
+    return (MbuBackendParams*)rtu;
+}
+
+static int setTcpParam(void* backend, char c, char *value) {
+    MbuTcpBackend *tcp = (MbuTcpBackend*)backend;
+
+    int ok = 1;
+
+    switch (c) {
+
+    case 'p': {
+        tcp->port = mbuGetInt(value, &ok);
+        if (0 == ok) {
+            printf("Port parameter %s is not integer!\n\n", value);
+        }
+    }
+        break;
+
+    default:
+        printf("Unknown tcp param (%c: %s)\n\n", c, value);
+        ok = 0;
+    }
+
+    return ok;
+}
+
+static modbus_t *createTcpCtxt(void *backend) {
+    MbuTcpBackend *tcp = (MbuTcpBackend*)backend;
+    modbus_t *ctx = modbus_new_tcp(tcp->ip, tcp->port);
+
+    return ctx;
+}
+
+static void delTcp(void *backend) {
+    MbuTcpBackend *tcp = (MbuTcpBackend*)backend;
+    free(tcp);
+}
+
+static int listenForTcpConnection(void *backend, modbus_t *ctx) {
+    MbuTcpBackend *tcp = (MbuTcpBackend*)backend;
+    tcp->clientSocket = modbus_tcp_listen(ctx, 1);
+    if (-1 == tcp->clientSocket) {
+        printf("Listen returned %d (%s)\n", tcp->clientSocket, modbus_strerror(errno));
+        return 0;
+    }
+    modbus_tcp_accept(ctx, &(tcp->clientSocket));
+    return 1;
+}
+
+static void closeTcpConnection(void *backend) {
+    MbuTcpBackend *tcp = (MbuTcpBackend*)backend;
+    if (tcp->clientSocket != -1) {
+        close(tcp->clientSocket);
+        tcp->clientSocket = -1;
+    }
+}
+
+static int listenTcpSocket(void *backend, modbus_t *ctx, int maxConnections) {
+    (void)backend;
+    return modbus_tcp_listen(ctx, maxConnections);
+}
+
+MbuBackendParams *mbuCreateTcpBackend() {
+    MbuTcpBackend *tcp = (MbuTcpBackend*)malloc(sizeof(MbuTcpBackend));
+    mbuInitTcpBackend(tcp);
+    tcp->base.del = &delTcp;
+    return (MbuBackendParams*)tcp;
+}
+
+MbuBackendParams *mbuInitTcpBackend(MbuTcpBackend *tcp) {
+    tcp->clientSocket =  -1;
+    tcp->base.setParam = &setTcpParam;
+    tcp->base.createCtxt = &createTcpCtxt;
+    tcp->base.del = &releaseBackend;
+    tcp->base.listenForConnection = &listenForTcpConnection;
+    tcp->base.closeConnection = &closeTcpConnection;
+    tcp->base.connectCtxt = &connectModbusCtxt;
+    tcp->base.listenSocket = &listenTcpSocket;
+
+    tcp->base.type = MbuTcp;
+    strcpy(tcp->ip, "0.0.0.0");
+    tcp->port = 502;
+
+    return (MbuBackendParams*)tcp;
+}
+
+static int setUnixParam(void *backend, char c, char *value) {
+    (void)backend;
+    printf("Unknown unix socket param (%c: %s)\n\n", c, value);
+    return 0;
+}
+
+static modbus_t *createUnixCtxt(void *backend) {
+    (void)backend;
+    //address is not used, socket is set up by the backend
+    return modbus_new_tcp("127.0.0.1", 502);
+}
+
+static void delUnix(void *backend) {
+    free(backend);
+}
+
+static int unixSocketAddress(MbuUnixBackend *unixB, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (0 == strlen(unixB->path)) {
+        printf("Unix socket path not set\n");
+        return 0;
+    }
+    strcpy(addr->sun_path, unixB->path);
+    return 1;
+}
+
+static int connectUnixCtxt(void *backend, modbus_t *ctx) {
+    struct sockaddr_un addr;
+    int s;
+
+    if (0 == unixSocketAddress((MbuUnixBackend*)backend, &addr))
+        return -1;
+    s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == s)
+        return -1;
+    if (-1 == connect(s, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(s);
+        return -1;
+    }
+    modbus_set_socket(ctx, s);
+
+    return 0;
+}
+
+static int listenUnixSocket(void *backend, modbus_t *ctx, int maxConnections) {
+    struct sockaddr_un addr;
+    int s;
+    (void)ctx;
+
+    if (0 == unixSocketAddress((MbuUnixBackend*)backend, &addr))
+        return -1;
+    s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == s)
+        return -1;
+    //socket file left by previous instance would make bind fail
+    unlink(addr.sun_path);
+    if (-1 == bind(s, (struct sockaddr*)&addr, sizeof(addr)) || -1 == listen(s, maxConnections)) {
+        printf("Cannot listen on %s (%s)\n", addr.sun_path, strerror(errno));
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+static int listenForUnixConnection(void *backend, modbus_t *ctx) {
+    (void)backend;
+    (void)ctx;
+    return 0;
+}
+
+static void closeUnixConnection(void *backend) {(void)backend;}
+
+MbuBackendParams *mbuCreateUnixBackend() {
+    MbuUnixBackend *unixB = (MbuUnixBackend*)malloc(sizeof(MbuUnixBackend));
+    mbuInitUnixBackend(unixB);
+    unixB->base.del = &delUnix;
+    return (MbuBackendParams*)unixB;
+}
+
+MbuBackendParams *mbuInitUnixBackend(MbuUnixBackend *unixB) {
+    unixB->base.type = MbuUnix;
+    unixB->base.setParam = &setUnixParam;
+    unixB->base.createCtxt = &createUnixCtxt;
+    unixB->base.del = &releaseBackend;
+    unixB->base.connectCtxt = &connectUnixCtxt;
+    unixB->base.listenForConnection = &listenForUnixConnection;
+    unixB->base.closeConnection = &closeUnixConnection;
+    unixB->base.listenSocket = &listenUnixSocket;
+
+    strcpy(unixB->path, "");
+
+    return (MbuBackendParams*)unixB;
+}
+
+static int setUdpParam(void *backend, char c, char *value) {
+    MbuUdpBackend *udp = (MbuUdpBackend*)backend;
+    int ok = 1;
+
+    switch (c) {
+    case 'p': {
+        udp->port = mbuGetInt(value, &ok);
+        if (0 == ok) {
+            printf("Port parameter %s is not integer!\n\n", value);
+        }
+    }
+        break;
+
+    default:
+        printf("Unknown udp param (%c: %s)\n\n", c, value);
+        ok = 0;
+    }
+
+    return ok;
+}
+
+static modbus_t *createUdpCtxt(void *backend) {
+    MbuUdpBackend *udp = (MbuUdpBackend*)backend;
+    return modbus_new_tcp(udp->ip, udp->port);
+}
+
+static int udpSocketAddress(MbuUdpBackend *udp, struct sockaddr_in *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(udp->port);
+    if (0 == inet_aton(udp->ip, &addr->sin_addr)) {
+        printf("Invalid udp address %s\n", udp->ip);
+        return 0;
+    }
+    return 1;
+}
+
+//true if the datagram is one complete ADU, as libmodbus would otherwise wait for the missing bytes
+static int isValidUdpAdu(const uint8_t adu[], ssize_t len) {
+    CodecFrame frame;
+    return (len > 0 && CodecOk == codecParseTcp(adu, len, &frame) && len == frame.aduLen);
+}
+
+/*
+ * Length of the response ADU as libmodbus sizes it when reading (by the function code, not by
+ * the MBAP length). Only responses it reads whole may go into the stream, bytes left behind
+ * would be taken for the start of the next response.
+ */
+static int udpResponseLength(const uint8_t adu[], int len) {
+    const uint8_t *pdu = adu + MBU_MBAP_HEADER_LENGTH + 1;
+
+    if (len < MBU_MBAP_HEADER_LENGTH + 3)
+        return 0;
+    switch (pdu[0]) {
+    case MbuWriteSingleCoil:
+    case MbuWriteSingleRegister:
+    case MbuWriteMultipleCoils:
+    case MbuWriteMultipleRegisters:
+        return MBU_MBAP_HEADER_LENGTH + 1 + 5;
+    case MbuMaskWriteRegister:
+        return MBU_MBAP_HEADER_LENGTH + 1 + 7;
+    case MbuReadCoils:
+    case MbuReadDiscreteInput:
+    case MbuReadHoldingRegisters:
+    case MbuReadInputRegisters:
+    case MbuWriteAndReadRegisters:
+    case 0x11://report slave id
+        return MBU_MBAP_HEADER_LENGTH + 1 + 2 + pdu[1];
+    default://exception code
+        return MBU_MBAP_HEADER_LENGTH + 1 + 2;
+    }
+}
+
+//discards whatever is left in the socket
+static void drainSocket(int fd) {
+    uint8_t buf[MODBUS_TCP_MAX_ADU_LENGTH];
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+}
+
+//forwards ADUs written by libmodbus as datagrams and received datagrams back to libmodbus
+static void *udpBridgeThread(void *arg) {
+    MbuUdpBackend *udp = (MbuUdpBackend*)arg;
+    uint8_t adu[MODBUS_TCP_MAX_ADU_LENGTH];
+    struct pollfd fds[2];
+
+    fds[0].fd = udp->pair[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = udp->udpSocket;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (EINTR == errno)
+                continue;
+            break;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            int len = mbuReadMbapAdu(udp->pair[0], adu, sizeof(adu));
+            if (0 == len)//libmodbus context closed
+                break;
+            send(udp->udpSocket, adu, len, 0);
+        }
+        if (fds[1].revents & POLLIN) {
+            ssize_t len = recv(udp->udpSocket, adu, sizeof(adu), 0);
+            if (isValidUdpAdu(adu, len) && len == udpResponseLength(adu, len)
+                    && len != write(udp->pair[0], adu, len))
+                break;
+        }
+    }
+
+    return 0;
+}
+
+static int connectUdpCtxt(void *backend, modbus_t *ctx) {
+    MbuUdpBackend *udp = (MbuUdpBackend*)backend;
+    struct sockaddr_in addr;
+
+    if (0 == udpSocketAddress(udp, &addr))
+        return -1;
+    udp->udpSocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (-1 == udp->udpSocket)
+        return -1;
+    if (-1 == connect(udp->udpSocket, (struct sockaddr*)&addr, sizeof(addr))
+            || -1 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, udp->pair)) {
+        close(udp->udpSocket);
+        udp->udpSocket = -1;
+        return -1;
+    }
+    if (0 != pthread_create(&udp->bridge, 0, udpBridgeThread, udp)) {
+        close(udp->pair[0]);
+        close(udp->pair[1]);
+        close(udp->udpSocket);
+        udp->udpSocket = -1;
+        return -1;
+    }
+    udp->bridgeRunning = 1;
+    modbus_set_socket(ctx, udp->pair[1]);
+
+    return 0;
+}
+
+static int listenUdpSocket(void *backend, modbus_t *ctx, int maxConnections) {
+    MbuUdpBackend *udp = (MbuUdpBackend*)backend;
+    struct sockaddr_in addr;
+    (void)maxConnections;
+
+    if (0 == udpSocketAddress(udp, &addr))
+        return -1;
+    udp->udpSocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (-1 == udp->udpSocket)
+        return -1;
+    if (-1 == bind(udp->udpSocket, (struct sockaddr*)&addr, sizeof(addr))
+            || -1 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, udp->pair)) {
+        printf("Cannot bind udp %s:%d (%s)\n", udp->ip, udp->port, strerror(errno));
+        close(udp->udpSocket);
+        udp->udpSocket = -1;
+        return -1;
+    }
+    modbus_set_socket(ctx, udp->pair[1]);
+
+    return udp->udpSocket;
+}
+
+int mbuServeUdpDatagram(void *backend, modbus_t *ctx, uint8_t query[], modbus_mapping_t *mapping,
+                         void (*onQuery)(const uint8_t query[], int len)) {
+    MbuUdpBackend *udp = (MbuUdpBackend*)backend;
+    uint8_t adu[MODBUS_TCP_MAX_ADU_LENGTH];
+    struct sockaddr_storage peer;
+    socklen_t peerLen = sizeof(peer);
+    ssize_t len;
+    int rc;
+
+    len = recvfrom(udp->udpSocket, query, MODBUS_TCP_MAX_ADU_LENGTH, 0, (struct sockaddr*)&peer, &peerLen);
+    if (0 == isValidUdpAdu(query, len))
+        return 0;
+
+    //the datagram is the query, libmodbus would size it by the function code and could leave
+    //bytes in the stream for the next one; only the reply goes through the pair
+    rc = len;
+    if (0 != onQuery)
+        onQuery(query, rc);
+    if (modbus_reply(ctx, query, rc, mapping) > 0) {
+        len = mbuReadMbapAdu(udp->pair[0], adu, sizeof(adu));
+        if (len > 0)
+            sendto(udp->udpSocket, adu, len, 0, (struct sockaddr*)&peer, peerLen);
+    }
+    drainSocket(udp->pair[0]);
+
+    return rc;
+}
+
+static int listenForUdpConnection(void *backend, modbus_t *ctx) {
+    (void)backend;
+    (void)ctx;
+    return 0;
+}
+
+static void closeUdpConnection(void *backend) {
+    MbuUdpBackend *udp = (MbuUdpBackend*)backend;
+    if (0 != udp->bridgeRunning) {
+        //libmodbus end may be already closed by modbus_close(), bridge sees eof either way
+        shutdown(udp->pair[0], SHUT_RDWR);
+        pthread_join(udp->bridge, 0);
+        udp->bridgeRunning = 0;
+    }
+    if (-1 != udp->udpSocket) {
+        close(udp->pair[0]);
+        close(udp->udpSocket);
+        udp->udpSocket = -1;
+    }
+}
+
+static void delUdp(void *backend) {
+    closeUdpConnection(backend);
+    free(backend);
+}
+
+MbuBackendParams *mbuCreateUdpBackend() {
+    MbuUdpBackend *udp = (MbuUdpBackend*)malloc(sizeof(MbuUdpBackend));
+    mbuInitUdpBackend(udp);
+    udp->base.del = &delUdp;
+    return (MbuBackendParams*)udp;
+}
+
+MbuBackendParams *mbuInitUdpBackend(MbuUdpBackend *udp) {
+    udp->base.type = MbuUdp;
+    udp->base.setParam = &setUdpParam;
+    udp->base.createCtxt = &createUdpCtxt;
+    udp->base.del = &closeUdpConnection;
+    udp->base.connectCtxt = &connectUdpCtxt;
+    udp->base.listenForConnection = &listenForUdpConnection;
+    udp->base.closeConnection = &closeUdpConnection;
+    udp->base.listenSocket = &listenUdpSocket;
+
+    strcpy(udp->ip, "0.0.0.0");
+    udp->port = 502;
+    udp->udpSocket = -1;
+    udp->bridgeRunning = 0;
+
+    return (MbuBackendParams*)udp;
+}
+
+void mbuSetBackendAddress(MbuBackendParams *backend, const char address[]) {
+    if (MbuRtu == backend->type) {
+        MbuRtuBackend *rtuP = (MbuRtuBackend*)backend;
+        snprintf(rtuP->devName, sizeof(rtuP->devName), "%s", address);
+    }
+    else if (MbuTcp == backend->type) {
+        MbuTcpBackend *tcpP = (MbuTcpBackend*)backend;
+        snprintf(tcpP->ip, sizeof(tcpP->ip), "%s", address);
+    }
+    else if (MbuUnix == backend->type) {
+        MbuUnixBackend *unixP = (MbuUnixBackend*)backend;
+        snprintf(unixP->path, sizeof(unixP->path), "%s", address);
+    }
+    else if (MbuUdp == backend->type) {
+        MbuUdpBackend *udpP = (MbuUdpBackend*)backend;
+        snprintf(udpP->ip, sizeof(udpP->ip), "%s", address);
+    }
+}
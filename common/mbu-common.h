@@ -25,32 +25,80 @@
 #ifndef MBU_COMMON_H
 #define MBU_COMMON_H
 
-#include <string.h>
-#include <stdio.h>
-#include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include <modbus.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef enum {
-    None,
-    Tcp,
-    Rtu
-} ConnType;
-
-int getInt(const char str[], int *ok) {
-    int value;
-    int ret = sscanf(str, "0x%x", &value);
-    if (0 >= ret) {//couldn't convert from hex, try dec
-        ret = sscanf(str, "%d", &value);
-    }
-
-    if (0 != ok) {
-        *ok = (0 < ret);
-    }
-
-    return value;
-}
+    MbuNone,
+    MbuTcp,
+    MbuRtu,
+    MbuUnix,
+    MbuUdp
+} MbuConnType;
+
+typedef enum {
+    MbuFuncNone                 = -1,
+
+    MbuReadCoils                = 0x01,
+    MbuReadDiscreteInput        = 0x02,
+    MbuReadHoldingRegisters     = 0x03,
+    MbuReadInputRegisters       = 0x04,
+    MbuWriteSingleCoil          = 0x05,
+    MbuWriteSingleRegister      = 0x06,
+    MbuWriteMultipleCoils       = 0x0f,
+    MbuWriteMultipleRegisters   = 0x10,
+    MbuMaskWriteRegister        = 0x16,
+    MbuWriteAndReadRegisters    = 0x17
+} MbuFuncType;
+
+int mbuGetInt(const char str[], int *ok);
+
+//parses dec or 0x-prefixed hex integer starting at *cur (no further than end) and moves *cur past it,
+//returns 0 if there is no number at *cur
+int mbuScanInt(const char **cur, const char *end, long *value);
+
+//parses "1,3,5-9" list of slave addresses (1-247), returns their number or 0 if the list is invalid
+int mbuParseAddressList(const char str[], int addresses[], int maxNo);
+
+uint64_t mbuClockNs(clockid_t clock);
+
+//sleeps until given CLOCK_MONOTONIC time
+void mbuSleepUntil(uint64_t ns);
+
+typedef struct {
+    const char *data;
+    size_t size;
+} MbuMappedFile;
+
+int mbuMapFile(const char path[], MbuMappedFile *file);
+void mbuUnmapFile(MbuMappedFile *file);
+
+//reads exactly len bytes, returns 0 on eof/error
+int mbuReadFull(int fd, uint8_t buf[], size_t len);
+
+#define MBU_MBAP_HEADER_LENGTH 6 //transaction id, protocol id, length (unit id is counted in length)
+
+//length of the whole tcp ADU as announced by its MBAP header
+int mbuMbapAduLength(const uint8_t adu[]);
+
+//reads one tcp ADU from stream socket, returns its length or 0 on eof/error
+int mbuReadMbapAdu(int fd, uint8_t adu[], int maxLen);
+
+//sends frame (unit id + PDU) as tcp ADU, returns 0 if the peer is gone
+int mbuSendMbapFrame(int fd, uint16_t transactionId, const uint8_t frame[], int len);
 
 typedef struct {
-    ConnType type;
+    MbuConnType type;
 
     void (*del)(void *backend);
 
@@ -58,192 +106,87 @@ typedef struct {
     int (*setParam)(void *backend, char c, char *value);
     modbus_t *(*createCtxt)(void *backend);
 
+    //client functions
+    int (*connectCtxt)(void *backend, modbus_t *ctx);//0 on success, -1 otherwise (as modbus_connect())
+
     //server functions
     int (*listenForConnection)(void *backend, modbus_t *ctx);
     void (*closeConnection)(void *backend);
-} BackendParams;
+    int (*listenSocket)(void *backend, modbus_t *ctx, int maxConnections);//server socket or -1
+} MbuBackendParams;
+
+/*
+ * mbuCreate*Backend() allocate the backend, del frees it; mbuInit*Backend() set up one in storage
+ * of the caller (e.g. static), del only releases what the backend holds then.
+ */
 
 typedef struct {
-    BackendParams base;
+    MbuBackendParams base;
     char devName[32];
     int baud;
     int dataBits;
     int stopBits;
     char parity;
-} RtuBackend;
-
-int setRtuParam(void *backend, char c, char *value) {
-    RtuBackend *rtuParams = (RtuBackend*)backend;
-    int ok = 1;
-
-    switch (c) {
-    case 'b': {
-        rtuParams->baud = getInt(value, &ok);
-        if (0 != ok) {
-            printf("Baudrate is invalid %s", value);
-            ok = 0;
-        }
-    }
-        break;
-    case 'd': {
-        int db = getInt(value, &ok);
-        if (0 == ok || (7 != db && 8 != db)) {
-            printf("Data bits incorrect (%s)", value);
-            ok = 0;
-        }
-        else
-            rtuParams->dataBits = db;
-    }
-        break;
-    case 's': {
-        int sb = getInt(value, &ok);
-        if (0 == ok || (1 != sb && 2 != sb)) {
-            printf("Stop bits incorrect (%s)", value);
-            ok = 0;
-        }
-        else
-            rtuParams->stopBits = sb;
-    }
-        break;
-    case 'p': {
-        if (0 == strcmp(value, "none")) {
-            rtuParams->parity = 'N';
-        }
-        else if (0 == strcmp(value, "even")) {
-            rtuParams->parity = 'E';
-        }
-        else if (0 == strcmp(value, "odd")) {
-            rtuParams->parity = 'O';
-        }
-        else {
-            printf("Unrecognized parity (%s)", value);
-            ok = 0;
-        }
-    }
-        break;
-    default:
-        printf("Unknown rtu param (%c: %s)\n\n", c, value);
-        ok = 0;
-    }
-
-    return ok;
-}
-
-modbus_t *createRtuCtxt(void *backend) {
-    RtuBackend *rtu = (RtuBackend*)backend;
-    modbus_t *ctx = modbus_new_rtu(rtu->devName, rtu->baud, rtu->parity, rtu->dataBits, rtu->stopBits);
+} MbuRtuBackend;
 
-    return ctx;
-}
-
-void delRtu(void *backend) {
-    RtuBackend *rtu = (RtuBackend*)backend;
-    free(rtu);
-}
-
-int listenForRtuConnection(void *backend, modbus_t *ctx) {
-    (void)backend;
-    (void)ctx;
-
-    printf("Connecting...\r\n");
-    return (0 == modbus_connect(ctx));
-}
-void closeRtuConnection(void *backend) {(void)backend;}
-
-BackendParams *createRtuBackend() {
-    RtuBackend *rtu = (RtuBackend*)malloc(sizeof(RtuBackend));
-    rtu->base.type = Rtu;
-    rtu->base.setParam = &setRtuParam;
-    rtu->base.createCtxt = &createRtuCtxt;
-    rtu->base.listenForConnection = &listenForRtuConnection;
-    rtu->base.closeConnection = &closeRtuConnection;
-    rtu->base.del = &delRtu;
-
-    strcpy(rtu->devName, "");
-    rtu->baud = 9600;
-    rtu->dataBits = 8;
-    rtu->stopBits = 1;
-    rtu->parity = 'E';
-
-    return (BackendParams*)rtu;
-}
+MbuBackendParams *mbuCreateRtuBackend();
+MbuBackendParams *mbuInitRtuBackend(MbuRtuBackend *rtu);
 
 typedef struct {
-    BackendParams base;
+    MbuBackendParams base;
     char ip[32];
     int port;
 
     int clientSocket;
-} TcpBackend;
-
-int setTcpParam(void* backend, char c, char *value) {
-    TcpBackend *tcp = (TcpBackend*)backend;
-
-    int ok = 1;
-
-    switch (c) {
-
-    case 'p': {
-        tcp->port = getInt(optarg, &ok);
-        if (0 == ok) {
-            printf("Port parameter %s is not integer!\n\n", optarg);
-        }
-    }
-        break;
-
-    default:
-        printf("Unknown tcp param (%c: %s)\n\n", c, value);
-        ok = 0;
-    }
+} MbuTcpBackend;
 
-    return ok;
-}
+MbuBackendParams *mbuCreateTcpBackend();
+MbuBackendParams *mbuInitTcpBackend(MbuTcpBackend *tcp);
 
-modbus_t *createTcpCtxt(void *backend) {
-    TcpBackend *tcp = (TcpBackend*)backend;
-    modbus_t *ctx = modbus_new_tcp(tcp->ip, tcp->port);
+/*
+ * Unix domain stream socket: same framing as modbus tcp (MBAP), libmodbus tcp context
+ * is used with the socket substituted, so no tcp/ip stack is involved.
+ */
+typedef struct {
+    MbuBackendParams base;
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+} MbuUnixBackend;
 
-    return ctx;
-}
+MbuBackendParams *mbuCreateUnixBackend();
+MbuBackendParams *mbuInitUnixBackend(MbuUnixBackend *unixB);
 
-void delTcp(void *backend) {
-    TcpBackend *tcp = (TcpBackend*)backend;
-    free(tcp);
-}
+/*
+ * Modbus over UDP: one MBAP framed ADU per datagram. libmodbus reads tcp ADUs piecewise,
+ * which would truncate datagrams, so its context talks to one end of a socketpair and
+ * the datagrams are passed through the other end.
+ */
+typedef struct {
+    MbuBackendParams base;
+    char ip[32];
+    int port;
 
-int listenForTcpConnection(void *backend, modbus_t *ctx) {
-    TcpBackend *tcp = (TcpBackend*)backend;
-    tcp->clientSocket = modbus_tcp_listen(ctx, 1);
-    if (-1 == tcp->clientSocket) {
-        printf("Listen returned %d (%s)\n", tcp->clientSocket, modbus_strerror(errno));
-        return 0;
-    }
-    modbus_tcp_accept(ctx, &(tcp->clientSocket));
-    return 1;
-}
+    int udpSocket;
+    int pair[2];//[0] - bridge end, [1] - libmodbus end
+    pthread_t bridge;
+    int bridgeRunning;
+} MbuUdpBackend;
 
-void closeTcpConnection(void *backend) {
-    TcpBackend *tcp = (TcpBackend*)backend;
-    if (tcp->clientSocket != -1) {
-        close(tcp->clientSocket);
-        tcp->clientSocket = -1;
-    }
-}
+MbuBackendParams *mbuCreateUdpBackend();
+MbuBackendParams *mbuInitUdpBackend(MbuUdpBackend *udp);
 
-BackendParams *createTcpBackend() {
-    TcpBackend *tcp = (TcpBackend*)malloc(sizeof(TcpBackend));
-    tcp->clientSocket =  -1;
-    tcp->base.setParam = &setTcpParam;
-    tcp->base.createCtxt = &createTcpCtxt;
-    tcp->base.del = &delTcp;
-    tcp->base.listenForConnection = &listenForTcpConnection;
-    tcp->base.closeConnection = &closeTcpConnection;
+/*
+ * Server side of udp: answers one request datagram with modbus_reply() and sends the reply
+ * back to the peer. query has to hold MODBUS_TCP_MAX_ADU_LENGTH bytes. Returns the request length
+ * (as modbus_receive()), 0 if the datagram was dropped.
+ */
+int mbuServeUdpDatagram(void *backend, modbus_t *ctx, uint8_t query[], modbus_mapping_t *mapping,
+                         void (*onQuery)(const uint8_t query[], int len));
 
-    tcp->base.type = Tcp;
-    strcpy(tcp->ip, "0.0.0.0");
-    tcp->port = 502;
+//sets serial port (rtu), ip (tcp, udp) or socket path (unix), given to the apps as a free parameter
+void mbuSetBackendAddress(MbuBackendParams *backend, const char address[]);
 
-    return (BackendParams*)tcp;
+#ifdef __cplusplus
 }
+#endif
 
 #endif //MBU_COMMON_H
@@ -0,0 +1,382 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "mbu-decode.h"
+
+static const char *TypeNames[] = {
+    "raw", "uint16", "int16", "uint32", "int32", "uint64", "int64", "float32", "float64"
+};
+
+static const char *OrderNames[] = {
+    "abcd", "cdab", "badc", "dcba"
+};
+
+int parseValueType(const char str[], ValueType *type, WordOrder *order) {
+    const char *colon = strchr(str, ':');
+    size_t len = (0 != colon) ? (size_t)(colon - str) : strlen(str);
+    unsigned i;
+
+    *order = OrderABCD;
+    for (i = 0; i < sizeof(TypeNames) / sizeof(TypeNames[0]); ++i) {
+        if (len == strlen(TypeNames[i]) && 0 == strncasecmp(str, TypeNames[i], len))
+            break;
+    }
+    if (sizeof(TypeNames) / sizeof(TypeNames[0]) == i)
+        return 0;
+    *type = (ValueType)i;
+
+    if (0 == colon)
+        return 1;
+    for (i = 0; i < sizeof(OrderNames) / sizeof(OrderNames[0]); ++i) {
+        if (0 == strcasecmp(colon + 1, OrderNames[i])) {
+            *order = (WordOrder)i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int parseOutputFormat(const char str[], OutputFormat *format) {
+    if (0 == strcmp(str, "text"))
+        *format = OutputText;
+    else if (0 == strcmp(str, "csv"))
+        *format = OutputCsv;
+    else if (0 == strcmp(str, "jsonl"))
+        *format = OutputJsonl;
+    else if (0 == strcmp(str, "bin"))
+        *format = OutputBinary;
+    else
+        return 0;
+    return 1;
+}
+
+const char *valueTypeName(ValueType type) {
+    return TypeNames[type];
+}
+
+int valueWords(ValueType type) {
+    switch (type) {
+    case TypeUint32:
+    case TypeInt32:
+    case TypeFloat32:
+        return 2;
+    case TypeUint64:
+    case TypeInt64:
+    case TypeFloat64:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+static int valueBytes(ValueType type) {
+    return 2 * valueWords(type);
+}
+
+int decodeRegisters(const uint16_t regs[], int nb, ValueType type, WordOrder order, uint64_t raw[]) {
+    int words = valueWords(type);
+    int count = nb / words;
+    int swapWords = (OrderCDAB == order || OrderDCBA == order);
+    int swapBytes = (OrderBADC == order || OrderDCBA == order);
+    int i, k;
+
+    //the common cases without per-word branching
+    if (1 == words && 0 == swapBytes) {
+        for (i = 0; i < count; ++i)
+            raw[i] = regs[i];
+        return count;
+    }
+    if (2 == words && 0 == swapBytes) {
+        if (swapWords) {
+            for (i = 0; i < count; ++i)
+                raw[i] = ((uint32_t)regs[2 * i + 1] << 16) | regs[2 * i];
+        }
+        else {
+            for (i = 0; i < count; ++i)
+                raw[i] = ((uint32_t)regs[2 * i] << 16) | regs[2 * i + 1];
+        }
+        return count;
+    }
+
+    for (i = 0; i < count; ++i) {
+        const uint16_t *w = regs + i * words;
+        uint64_t v = 0;
+        for (k = 0; k < words; ++k) {
+            uint16_t word = w[swapWords ? words - 1 - k : k];
+            if (swapBytes)
+                word = (uint16_t)((word << 8) | (word >> 8));
+            v = (v << 16) | word;
+        }
+        raw[i] = v;
+    }
+
+    return count;
+}
+
+void outputInit(OutputBuffer *out, int fd) {
+    out->fd = fd;
+    out->len = 0;
+}
+
+void outputFlush(OutputBuffer *out) {
+    size_t written = 0;
+
+    while (written < out->len) {
+        ssize_t ret = write(out->fd, out->buf + written, out->len - written);
+        if (ret < 0) {
+            if (EINTR == errno)
+                continue;
+            break;
+        }
+        written += ret;
+    }
+    out->len = 0;
+}
+
+//makes room for n more bytes
+static char *outputReserve(OutputBuffer *out, size_t n) {
+    if (out->len + n > OUTPUT_BUFFER_SIZE)
+        outputFlush(out);
+    return out->buf + out->len;
+}
+
+static void outputChar(OutputBuffer *out, char c) {
+    *outputReserve(out, 1) = c;
+    out->len++;
+}
+
+void outputText(OutputBuffer *out, const char str[]) {
+    size_t len = strlen(str);
+    memcpy(outputReserve(out, len), str, len);
+    out->len += len;
+}
+
+static void outputUnsigned(OutputBuffer *out, uint64_t v) {
+    char digits[20];
+    char *p;
+    int n = 0;
+
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (0 != v);
+    p = outputReserve(out, n);
+    while (n > 0)
+        *p++ = digits[--n];
+    out->len = p - out->buf;
+}
+
+static void outputSigned(OutputBuffer *out, int64_t v) {
+    if (v < 0) {
+        outputChar(out, '-');
+        outputUnsigned(out, (uint64_t)0 - (uint64_t)v);
+    }
+    else {
+        outputUnsigned(out, (uint64_t)v);
+    }
+}
+
+static void outputDouble(OutputBuffer *out, double v, int digits, int json) {
+    //json has no nan/inf
+    if (json && (isnan(v) || isinf(v))) {
+        outputText(out, "null");
+        return;
+    }
+    out->len += snprintf(outputReserve(out, 32), 32, "%.*g", digits, v);
+}
+
+static void outputValue(OutputBuffer *out, ValueType type, uint64_t raw, int json) {
+    static const char Hex[] = "0123456789abcdef";
+    union {
+        uint32_t u;
+        float f;
+    } f32;
+    union {
+        uint64_t u;
+        double f;
+    } f64;
+
+    switch (type) {
+    case TypeRaw:
+        if (json) {
+            outputUnsigned(out, raw);
+        }
+        else {
+            char *p = outputReserve(out, 6);
+            p[0] = '0';
+            p[1] = 'x';
+            p[2] = Hex[(raw >> 12) & 0xf];
+            p[3] = Hex[(raw >> 8) & 0xf];
+            p[4] = Hex[(raw >> 4) & 0xf];
+            p[5] = Hex[raw & 0xf];
+            out->len += 6;
+        }
+        break;
+    case TypeUint16:
+    case TypeUint32:
+    case TypeUint64:
+        outputUnsigned(out, raw);
+        break;
+    case TypeInt16:
+        outputSigned(out, (int16_t)raw);
+        break;
+    case TypeInt32:
+        outputSigned(out, (int32_t)raw);
+        break;
+    case TypeInt64:
+        outputSigned(out, (int64_t)raw);
+        break;
+    case TypeFloat32:
+        f32.u = (uint32_t)raw;
+        outputDouble(out, f32.f, 9, json);
+        break;
+    case TypeFloat64:
+        f64.u = raw;
+        outputDouble(out, f64.f, 17, json);
+        break;
+    }
+}
+
+void outputValues(OutputBuffer *out, ValueType type, const uint64_t raw[], int count, char sep) {
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        if (0 != i)
+            outputChar(out, sep);
+        outputValue(out, type, raw[i], 0);
+    }
+}
+
+static void outputTimestamp(OutputBuffer *out, uint64_t tsNs) {
+    char *p;
+    uint32_t us = (uint32_t)(tsNs % 1000000000ULL / 1000);
+    int i;
+
+    outputUnsigned(out, tsNs / 1000000000ULL);
+    p = outputReserve(out, 7);
+    p[0] = '.';
+    for (i = 6; i > 0; --i) {
+        p[i] = (char)('0' + us % 10);
+        us /= 10;
+    }
+    out->len += 7;
+}
+
+static void outputBinaryRow(OutputBuffer *out, uint64_t tsNs, int slave, int function, int addr,
+                            ValueType type, const uint64_t raw[], int count) {
+    int isBits = (MbuReadCoils == function || MbuReadDiscreteInput == function);
+    int size = isBits ? 1 : valueBytes(type);
+    uint8_t header[OUTPUT_ROW_HEADER_LENGTH];
+    uint16_t u16;
+    char *p;
+    int i;
+
+    memcpy(header, &tsNs, 8);
+    header[8] = (uint8_t)slave;
+    header[9] = (uint8_t)function;
+    u16 = (uint16_t)addr;
+    memcpy(header + 10, &u16, 2);
+    u16 = (uint16_t)count;
+    memcpy(header + 12, &u16, 2);
+    header[14] = (uint8_t)type;
+    header[15] = 0;
+    memcpy(outputReserve(out, sizeof(header)), header, sizeof(header));
+    out->len += sizeof(header);
+
+    p = outputReserve(out, (size_t)count * size);
+    for (i = 0; i < count; ++i) {
+        uint8_t u8 = (uint8_t)raw[i];
+        uint16_t v16 = (uint16_t)raw[i];
+        uint32_t v32 = (uint32_t)raw[i];
+        switch (size) {
+        case 1:
+            memcpy(p, &u8, 1);
+            break;
+        case 2:
+            memcpy(p, &v16, 2);
+            break;
+        case 4:
+            memcpy(p, &v32, 4);
+            break;
+        default:
+            memcpy(p, &raw[i], 8);
+            break;
+        }
+        p += size;
+    }
+    out->len = p - out->buf;
+}
+
+void outputRow(OutputBuffer *out, OutputFormat format, uint64_t tsNs, int slave, int function, int addr,
+               ValueType type, const uint64_t raw[], int count) {
+    int i;
+
+    switch (format) {
+    case OutputBinary:
+        outputBinaryRow(out, tsNs, slave, function, addr, type, raw, count);
+        return;
+    case OutputJsonl:
+        outputText(out, "{\"ts\":");
+        outputTimestamp(out, tsNs);
+        outputText(out, ",\"slave\":");
+        outputUnsigned(out, slave);
+        outputText(out, ",\"function\":");
+        outputUnsigned(out, function);
+        outputText(out, ",\"addr\":");
+        outputUnsigned(out, addr);
+        outputText(out, ",\"type\":\"");
+        outputText(out, TypeNames[type]);
+        outputText(out, "\",\"values\":[");
+        for (i = 0; i < count; ++i) {
+            if (0 != i)
+                outputChar(out, ',');
+            outputValue(out, type, raw[i], 1);
+        }
+        outputText(out, "]}\n");
+        return;
+    default:
+        outputTimestamp(out, tsNs);
+        outputChar(out, ',');
+        outputUnsigned(out, slave);
+        outputChar(out, ',');
+        outputUnsigned(out, function);
+        outputChar(out, ',');
+        outputUnsigned(out, addr);
+        for (i = 0; i < count; ++i) {
+            outputChar(out, ',');
+            //csv is for scripts, raw registers go as numbers too
+            outputValue(out, (TypeRaw == type) ? TypeUint16 : type, raw[i], 0);
+        }
+        outputChar(out, '\n');
+        return;
+    }
+}
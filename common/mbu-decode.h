@@ -0,0 +1,109 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_DECODE_H
+#define MBU_DECODE_H
+
+/*
+ * Typed view of register data and machine-readable output of it.
+ * Registers are assembled into values in bulk (one pass over the buffer, into raw 64-bit
+ * patterns), formatting goes to one large buffer written out with single write() calls.
+ *
+ * Word orders name bytes of a 32-bit value as sent in registers, A being the most significant:
+ * ABCD - big endian (Modbus), CDAB - swapped words, BADC - swapped bytes, DCBA - little endian.
+ * 64-bit values follow the same rule for their four words.
+ *
+ * Binary rows: uint64 timestamp [ns since epoch], uint8 slave, uint8 function, uint16 address,
+ * uint16 values number, uint8 type, uint8 reserved, then values of the type's size (bits as
+ * uint8); all in host byte order.
+ */
+
+#include <stdint.h>
+
+#include "mbu-common.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+#define OUTPUT_ROW_HEADER_LENGTH 16
+
+typedef enum {
+    TypeRaw,//uint16 printed as hex in text, bits as 0/1
+    TypeUint16,
+    TypeInt16,
+    TypeUint32,
+    TypeInt32,
+    TypeUint64,
+    TypeInt64,
+    TypeFloat32,
+    TypeFloat64
+} ValueType;
+
+typedef enum {
+    OrderABCD,
+    OrderCDAB,
+    OrderBADC,
+    OrderDCBA
+} WordOrder;
+
+typedef enum {
+    OutputText,
+    OutputCsv,
+    OutputJsonl,
+    OutputBinary
+} OutputFormat;
+
+//parses "<type>[:<order>]", e.g. "float32:cdab", returns 0 if invalid
+int parseValueType(const char str[], ValueType *type, WordOrder *order);
+
+int parseOutputFormat(const char str[], OutputFormat *format);
+
+const char *valueTypeName(ValueType type);
+
+//registers per value
+int valueWords(ValueType type);
+
+//assembles nb registers into values (their bit patterns), returns number of values
+int decodeRegisters(const uint16_t regs[], int nb, ValueType type, WordOrder order, uint64_t raw[]);
+
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[OUTPUT_BUFFER_SIZE];
+} OutputBuffer;
+
+void outputInit(OutputBuffer *out, int fd);
+void outputFlush(OutputBuffer *out);
+
+void outputText(OutputBuffer *out, const char str[]);
+
+//appends values separated by sep, as text
+void outputValues(OutputBuffer *out, ValueType type, const uint64_t raw[], int count, char sep);
+
+/*
+ * Appends one row of decoded values (bits: one value per bit, raw 0/1) in csv, json line or binary
+ * format: timestamp, slave, function, address of the first register, values.
+ */
+void outputRow(OutputBuffer *out, OutputFormat format, uint64_t tsNs, int slave, int function, int addr,
+               ValueType type, const uint64_t raw[], int count);
+
+#endif //MBU_DECODE_H
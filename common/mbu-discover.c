@@ -0,0 +1,156 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mbu-discover.h"
+#include "mbu-poll.h"
+
+//sweeps all candidate addresses not found yet at the current setting
+static void sweepSetting(DiscoverPort *port, modbus_t *ctx, DiscoverSetting *setting, uint8_t found[]) {
+    uint16_t data[MODBUS_MAX_READ_BITS / 2];//enough for bits as well
+    RtuTiming timing;
+    MbuRequest request;
+    uint32_t timeoutUs, byteUs;
+    uint64_t lineFreeNs = 0;
+    int i;
+
+    rtuTiming(&port->line, &timing);
+    memset(&request, 0, sizeof(request));
+    request.fType = port->fType;
+    request.addr = port->addr;
+    request.nb = port->nb;
+    request.data = data;
+
+    //write() returns once the request is queued, so its transmission counts to the timeout
+    timeoutUs = rtuFrameUs(&timing, rtuRequestLength(&request)) + port->turnaroundMs * 1000 + timing.t35Us;
+    byteUs = timing.t35Us + port->turnaroundMs * 1000;
+    modbus_set_response_timeout(ctx, timeoutUs / 1000000, timeoutUs % 1000000);
+    modbus_set_byte_timeout(ctx, byteUs / 1000000, byteUs % 1000000);
+
+    for (i = 0; i < port->addressesNo; ++i) {
+        int address = port->addresses[i];
+        uint64_t sentNs;
+        int ret;
+
+        if (found[address])
+            continue;
+
+        mbuSleepUntil(lineFreeNs);
+        modbus_set_slave(ctx, address);
+        sentNs = mbuClockNs(CLOCK_MONOTONIC);
+        request.slave = address;
+        ret = mbuExecuteRequest(ctx, &request);
+        lineFreeNs = mbuClockNs(CLOCK_MONOTONIC) + timing.t35Us * 1000ULL;
+        port->probesNo++;
+
+        if (-1 != ret || (errno > MODBUS_ENOBASE && errno <= EMBXGTAR)) {
+            DiscoveredSlave *slave = &port->slaves[port->slavesNo++];
+            slave->address = address;
+            slave->baud = port->line.baud;
+            slave->parity = port->line.parity;
+            slave->exception = (-1 == ret) ? errno - MODBUS_ENOBASE : 0;
+            slave->responseUs = (uint32_t)((lineFreeNs - sentNs) / 1000) - timing.t35Us;
+            setting->foundNo++;
+            found[address] = 1;
+        }
+        else if (ETIMEDOUT != errno) {
+            //something answered, but not in a way that could be understood
+            setting->garbledNo++;
+            modbus_flush(ctx);
+        }
+    }
+}
+
+static void *discoverThread(void *arg) {
+    DiscoverPort *port = (DiscoverPort*)arg;
+    uint8_t found[DISCOVER_MAX_SLAVES + 1];
+    uint64_t startNs = mbuClockNs(CLOCK_MONOTONIC);
+    int b, p;
+
+    memset(found, 0, sizeof(found));
+    for (b = 0; b < port->baudsNo; ++b) {
+        for (p = 0; '\0' != port->parities[p]; ++p) {
+            DiscoverSetting *setting;
+            modbus_t *ctx;
+
+            if (DISCOVER_MAX_SETTINGS == port->settingsNo || port->slavesNo == port->addressesNo)
+                break;
+
+            port->line.baud = port->bauds[b];
+            port->line.parity = port->parities[p];
+            setting = &port->settings[port->settingsNo];
+            setting->baud = port->line.baud;
+            setting->parity = port->line.parity;
+            setting->foundNo = 0;
+            setting->garbledNo = 0;
+
+            ctx = port->line.base.createCtxt(&port->line);
+            if (0 == ctx || -1 == port->line.base.connectCtxt(&port->line, ctx)) {
+                printf("Cannot open %s at %d %c: %s\n", port->line.devName, port->line.baud, port->line.parity,
+                       modbus_strerror(errno));
+                if (0 != ctx)
+                    modbus_free(ctx);
+                port->failed = 1;
+                port->elapsedNs = mbuClockNs(CLOCK_MONOTONIC) - startNs;
+                return 0;
+            }
+            port->settingsNo++;
+
+            sweepSetting(port, ctx, setting, found);
+
+            modbus_close(ctx);
+            modbus_free(ctx);
+        }
+    }
+    port->elapsedNs = mbuClockNs(CLOCK_MONOTONIC) - startNs;
+
+    return 0;
+}
+
+int discoverStart(DiscoverPort *port) {
+    port->slavesNo = 0;
+    port->settingsNo = 0;
+    port->probesNo = 0;
+    port->failed = 0;
+    port->elapsedNs = 0;
+
+    if (MbuReadCoils != port->fType && MbuReadDiscreteInput != port->fType
+            && MbuReadHoldingRegisters != port->fType && MbuReadInputRegisters != port->fType) {
+        printf("Only read functions (0x01-0x04) can be used for discovery\n");
+        return 0;
+    }
+    if (0 != pthread_create(&port->thread, 0, discoverThread, port)) {
+        printf("Cannot start discovery thread for %s\n", port->line.devName);
+        return 0;
+    }
+
+    return 1;
+}
+
+void discoverJoin(DiscoverPort *port) {
+    pthread_join(port->thread, 0);
+}
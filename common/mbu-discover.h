@@ -0,0 +1,92 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_DISCOVER_H
+#define MBU_DISCOVER_H
+
+/*
+ * Discovery of slaves on RTU lines: every candidate line setting (baud, parity) is tried with
+ * a read request to every candidate address. Timeouts follow from the line timing (request
+ * transmission, slave turnaround, t3.5), not the usual second, so a missing slave costs
+ * tens of milliseconds. Each serial port is swept by its own thread.
+ * Any answer, exception included, means a slave is there. Addresses found at one setting are not
+ * probed at further ones.
+ */
+
+#include "mbu-common.h"
+#include "mbu-session.h"
+
+#define DISCOVER_MAX_SETTINGS 64
+#define DISCOVER_MAX_SLAVES 247
+
+typedef struct {
+    int address;
+    int baud;
+    char parity;
+    int exception;//0 - normal response, exception code otherwise
+    uint32_t responseUs;
+} DiscoveredSlave;
+
+typedef struct {
+    int baud;
+    char parity;
+    int foundNo;
+    int garbledNo;//crc or framing errors: a slave may be there, with another setting
+} DiscoverSetting;
+
+typedef struct {
+    MbuRtuBackend line;//port, data and stop bits; baud and parity are swept
+
+    //candidates, not owned
+    const int *bauds;
+    int baudsNo;
+    const char *parities;//e.g. "ENO"
+    const int *addresses;
+    int addressesNo;
+
+    //probe: a read function
+    MbuFuncType fType;
+    int addr;
+    int nb;
+    int turnaroundMs;
+
+    //results
+    DiscoveredSlave slaves[DISCOVER_MAX_SLAVES];
+    int slavesNo;
+    DiscoverSetting settings[DISCOVER_MAX_SETTINGS];
+    int settingsNo;
+    int probesNo;
+    int failed;//port could not be opened
+    uint64_t elapsedNs;
+
+    pthread_t thread;
+} DiscoverPort;
+
+//starts sweeping in a new thread, returns 0 on failure
+int discoverStart(DiscoverPort *port);
+
+//waits for the sweep to finish
+void discoverJoin(DiscoverPort *port);
+
+#endif //MBU_DISCOVER_H
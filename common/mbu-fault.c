@@ -0,0 +1,325 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "mbu-fault.h"
+
+void faultPlanInit(FaultPlan *plan, uint64_t seed) {
+    memset(plan, 0, sizeof(*plan));
+    plan->rng = (0 != seed) ? seed : (mbuClockNs(CLOCK_REALTIME) | 1);
+}
+
+//xorshift64*, uniform in [0, 1)
+static double faultRandom(FaultPlan *plan) {
+    plan->rng ^= plan->rng >> 12;
+    plan->rng ^= plan->rng << 25;
+    plan->rng ^= plan->rng >> 27;
+    return ((plan->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int parseSelector(const char **cur, int *value) {
+    char *end;
+    long v;
+
+    if ('*' == **cur) {
+        (*cur)++;
+        *value = -1;
+        return 1;
+    }
+    v = strtol(*cur, &end, 0);
+    if (end == *cur || v < 0 || v > 255)
+        return 0;
+    *cur = end;
+    *value = (int)v;
+    return 1;
+}
+
+static int parseProbability(const char **cur, double *p) {
+    char *end;
+    *p = strtod(*cur, &end);
+    if (end == *cur || *p < 0 || *p > 1)
+        return 0;
+    *cur = end;
+    return 1;
+}
+
+static int parseMs(const char **cur, uint32_t *us) {
+    char *end;
+    double ms = strtod(*cur, &end);
+    if (end == *cur || ms < 0 || ms > 3600000)
+        return 0;
+    *cur = end;
+    *us = (uint32_t)(ms * 1000);
+    return 1;
+}
+
+//moves past word if it is at *cur
+static int isWord(const char **cur, const char word[]) {
+    size_t len = strlen(word);
+    if (0 != strncmp(*cur, word, len))
+        return 0;
+    *cur += len;
+    return 1;
+}
+
+//moves past "name=" if it is at *cur
+static int isParam(const char **cur, const char name[]) {
+    const char *p = *cur;
+    if (0 == isWord(&p, name) || '=' != *p)
+        return 0;
+    *cur = p + 1;
+    return 1;
+}
+
+int faultAddRule(FaultPlan *plan, const char spec[]) {
+    FaultRule rule;
+    const char *cur = spec;
+    int ok = 1;
+
+    if (FAULT_MAX_RULES == plan->rulesNo) {
+        printf("At most %d fault rules are supported\n", FAULT_MAX_RULES);
+        return 0;
+    }
+
+    memset(&rule, 0, sizeof(rule));
+    rule.distribution = DelayUniform;
+    rule.exceptionCode = FAULT_DEFAULT_EXCEPTION;
+    rule.function = -1;
+
+    ok = parseSelector(&cur, &rule.unit);
+    if (ok && '/' == *cur) {
+        ++cur;
+        ok = parseSelector(&cur, &rule.function);
+    }
+    if (0 == ok || ':' != *cur) {
+        printf("Fault rule (%s) should start with <unit|*>[/<function|*>]:\n", spec);
+        return 0;
+    }
+
+    //cur is at ':' or ',' before each param
+    while (ok && '\0' != *cur) {
+        ++cur;
+        if (isParam(&cur, "delay"))
+            ok = parseMs(&cur, &rule.delayUs);
+        else if (isParam(&cur, "jitter"))
+            ok = parseMs(&cur, &rule.jitterUs);
+        else if (isParam(&cur, "dist")) {
+            if (isWord(&cur, "uniform"))
+                rule.distribution = DelayUniform;
+            else if (isWord(&cur, "normal"))
+                rule.distribution = DelayNormal;
+            else if (isWord(&cur, "exp"))
+                rule.distribution = DelayExponential;
+            else
+                ok = 0;
+        }
+        else if (isParam(&cur, "drop"))
+            ok = parseProbability(&cur, &rule.dropP);
+        else if (isParam(&cur, "exception")) {
+            ok = parseProbability(&cur, &rule.exceptionP);
+            if (ok && '/' == *cur) {
+                ++cur;
+                ok = parseSelector(&cur, &rule.exceptionCode) && rule.exceptionCode > 0;
+            }
+        }
+        else if (isParam(&cur, "corrupt"))
+            ok = parseProbability(&cur, &rule.corruptP);
+        else
+            ok = 0;
+
+        if (ok && ',' != *cur && '\0' != *cur)
+            ok = 0;
+    }
+    if (0 == ok) {
+        printf("Fault rule (%s) is invalid near \"%s\"\n", spec, cur);
+        return 0;
+    }
+
+    plan->rules[plan->rulesNo++] = rule;
+    return 1;
+}
+
+static uint32_t sampleDelay(FaultPlan *plan, const FaultRule *rule) {
+    double us = rule->delayUs;
+
+    switch (rule->distribution) {
+    case DelayUniform:
+        us += (2 * faultRandom(plan) - 1) * rule->jitterUs;
+        break;
+    case DelayNormal: {
+        //Box-Muller
+        double u1 = 1.0 - faultRandom(plan);
+        double u2 = faultRandom(plan);
+        us += sqrt(-2 * log(u1)) * cos(2 * M_PI * u2) * rule->jitterUs;
+    }
+        break;
+    case DelayExponential:
+        us = -log(1.0 - faultRandom(plan)) * rule->delayUs;
+        break;
+    }
+
+    return (us > 0) ? (uint32_t)us : 0;
+}
+
+int faultDecide(FaultPlan *plan, int unit, int function, FaultAction *action) {
+    const FaultRule *rule = 0;
+    int i;
+
+    for (i = 0; i < plan->rulesNo; ++i) {
+        if ((-1 == plan->rules[i].unit || unit == plan->rules[i].unit)
+                && (-1 == plan->rules[i].function || function == plan->rules[i].function)) {
+            rule = &plan->rules[i];
+            break;
+        }
+    }
+    if (0 == rule)
+        return 0;
+
+    memset(action, 0, sizeof(*action));
+    if (rule->dropP > 0 && faultRandom(plan) < rule->dropP) {
+        action->drop = 1;
+        plan->droppedNo++;
+        return 1;
+    }
+    if (rule->exceptionP > 0 && faultRandom(plan) < rule->exceptionP) {
+        action->exceptionCode = rule->exceptionCode;
+        plan->exceptionsNo++;
+    }
+    if (rule->corruptP > 0 && faultRandom(plan) < rule->corruptP) {
+        action->corrupt = 1;
+        plan->corruptedNo++;
+    }
+    action->delayUs = sampleDelay(plan, rule);
+    if (0 != action->delayUs)
+        plan->delayedNo++;
+
+    return 1;
+}
+
+void faultCorrupt(uint8_t adu[], int len, MbuConnType type) {
+    if (MbuRtu == type) {
+        if (len >= 2)
+            adu[len - 1] ^= 0xa5;
+    }
+    else if (len >= 2) {
+        adu[0] ^= 0xa5;
+    }
+}
+
+int replyQueueInit(ReplyQueue *queue, int capacity) {
+    queue->heap = (PendingReply*)malloc(capacity * sizeof(PendingReply));
+    queue->size = 0;
+    queue->capacity = (0 != queue->heap) ? capacity : 0;
+    return (0 != queue->heap);
+}
+
+void replyQueueFree(ReplyQueue *queue) {
+    free(queue->heap);
+    queue->heap = 0;
+    queue->size = queue->capacity = 0;
+}
+
+static void swapReplies(PendingReply *a, PendingReply *b) {
+    PendingReply tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void siftDown(ReplyQueue *queue, int i) {
+    for (;;) {
+        int smallest = i;
+        int l = 2 * i + 1, r = l + 1;
+        if (l < queue->size && queue->heap[l].dueNs < queue->heap[smallest].dueNs)
+            smallest = l;
+        if (r < queue->size && queue->heap[r].dueNs < queue->heap[smallest].dueNs)
+            smallest = r;
+        if (smallest == i)
+            return;
+        swapReplies(&queue->heap[i], &queue->heap[smallest]);
+        i = smallest;
+    }
+}
+
+int replyQueueAdd(ReplyQueue *queue, uint64_t dueNs, int fd, const uint8_t adu[], int len) {
+    int i;
+
+    if (queue->size == queue->capacity || len > REPLY_MAX_LENGTH)
+        return 0;
+
+    i = queue->size++;
+    queue->heap[i].dueNs = dueNs;
+    queue->heap[i].fd = fd;
+    queue->heap[i].len = len;
+    memcpy(queue->heap[i].adu, adu, len);
+    while (i > 0 && queue->heap[(i - 1) / 2].dueNs > queue->heap[i].dueNs) {
+        swapReplies(&queue->heap[(i - 1) / 2], &queue->heap[i]);
+        i = (i - 1) / 2;
+    }
+
+    return 1;
+}
+
+uint64_t replyQueueNextNs(const ReplyQueue *queue) {
+    return (0 == queue->size) ? UINT64_MAX : queue->heap[0].dueNs;
+}
+
+void sendReply(int fd, const uint8_t adu[], int len) {
+    //no SIGPIPE if the master has gone meanwhile
+    if (-1 == send(fd, adu, len, MSG_NOSIGNAL) && ENOTSOCK == errno) {
+        if (len != write(fd, adu, len))
+            printf("Cannot send reply to %d: %s\n", fd, strerror(errno));
+    }
+}
+
+int replyQueueSendDue(ReplyQueue *queue, uint64_t nowNs) {
+    int sent = 0;
+
+    while (queue->size > 0 && queue->heap[0].dueNs <= nowNs) {
+        sendReply(queue->heap[0].fd, queue->heap[0].adu, queue->heap[0].len);
+        queue->heap[0] = queue->heap[--queue->size];
+        siftDown(queue, 0);
+        sent++;
+    }
+
+    return sent;
+}
+
+void replyQueueDrop(ReplyQueue *queue, int fd) {
+    int i, kept = 0;
+
+    for (i = 0; i < queue->size; ++i) {
+        if (fd != queue->heap[i].fd)
+            queue->heap[kept++] = queue->heap[i];
+    }
+    queue->size = kept;
+    for (i = kept / 2 - 1; i >= 0; --i)
+        siftDown(queue, i);
+}
@@ -0,0 +1,128 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_FAULT_H
+#define MBU_FAULT_H
+
+/*
+ * Fault injection for the server, to test how masters cope with slow and flaky devices.
+ * A rule applies to requests of one unit and/or function:
+ *   <unit|*>[/<function|*>]:<param>=<value>[,<param>=<value>...]
+ * params: delay=<ms> (mean), jitter=<ms>, dist={uniform|normal|exp} (uniform +-jitter by default,
+ *         normal with jitter as standard deviation, exponential with delay as mean),
+ *         drop=<p>, exception=<p>[/<code>=4], corrupt=<p> (probabilities 0-1).
+ * The first matching rule is used. Delayed replies wait in a timer queue, so serving
+ * of other requests goes on meanwhile.
+ */
+
+#include <stdint.h>
+
+#include "mbu-common.h"
+
+#define FAULT_MAX_RULES 32
+#define FAULT_DEFAULT_EXCEPTION MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE
+#define REPLY_QUEUE_CAPACITY 1024
+#define REPLY_MAX_LENGTH 260
+
+typedef enum {
+    DelayUniform,
+    DelayNormal,
+    DelayExponential
+} DelayDistribution;
+
+typedef struct {
+    int unit;//-1 - any
+    int function;//-1 - any
+    DelayDistribution distribution;
+    uint32_t delayUs;
+    uint32_t jitterUs;
+    double dropP;
+    double exceptionP;
+    int exceptionCode;
+    double corruptP;
+} FaultRule;
+
+typedef struct {
+    FaultRule rules[FAULT_MAX_RULES];
+    int rulesNo;
+    uint64_t rng;
+
+    uint64_t droppedNo;
+    uint64_t exceptionsNo;
+    uint64_t corruptedNo;
+    uint64_t delayedNo;
+} FaultPlan;
+
+typedef struct {
+    int drop;
+    int exceptionCode;//0 - normal reply
+    int corrupt;
+    uint32_t delayUs;
+} FaultAction;
+
+//seed 0 takes one from the clock
+void faultPlanInit(FaultPlan *plan, uint64_t seed);
+
+//parses and adds the rule, returns 1 on success
+int faultAddRule(FaultPlan *plan, const char spec[]);
+
+//returns 0 if no rule applies and the request is to be served normally
+int faultDecide(FaultPlan *plan, int unit, int function, FaultAction *action);
+
+//damages the reply so the master rejects it: rtu - crc, tcp (no crc) - transaction id
+void faultCorrupt(uint8_t adu[], int len, MbuConnType type);
+
+typedef struct {
+    uint64_t dueNs;//CLOCK_MONOTONIC
+    int fd;
+    int len;
+    uint8_t adu[REPLY_MAX_LENGTH];
+} PendingReply;
+
+//min-heap of replies ordered by the time they are due
+typedef struct {
+    PendingReply *heap;
+    int size;
+    int capacity;
+} ReplyQueue;
+
+int replyQueueInit(ReplyQueue *queue, int capacity);
+void replyQueueFree(ReplyQueue *queue);
+
+//returns 0 if the queue is full
+int replyQueueAdd(ReplyQueue *queue, uint64_t dueNs, int fd, const uint8_t adu[], int len);
+
+//due time of the earliest reply, UINT64_MAX if there is none
+uint64_t replyQueueNextNs(const ReplyQueue *queue);
+
+//sends replies due at nowNs, returns their number
+int replyQueueSendDue(ReplyQueue *queue, uint64_t nowNs);
+
+//forgets replies to the closed connection
+void replyQueueDrop(ReplyQueue *queue, int fd);
+
+//sends reply to socket or serial port
+void sendReply(int fd, const uint8_t adu[], int len);
+
+#endif //MBU_FAULT_H
@@ -0,0 +1,136 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "mbu-frame.h"
+#include "mbu-codec.h"
+
+int buildRequestFrame(uint8_t frame[], int slave, int fType, int addr, int nb, const void *data) {
+    int len = 0;
+    int i;
+
+    frame[len++] = (uint8_t)slave;
+    frame[len++] = (uint8_t)fType;
+    frame[len++] = (uint8_t)(addr >> 8);
+    frame[len++] = (uint8_t)addr;
+
+    switch (fType) {
+    case MbuReadCoils:
+    case MbuReadDiscreteInput:
+    case MbuReadHoldingRegisters:
+    case MbuReadInputRegisters:
+        frame[len++] = (uint8_t)(nb >> 8);
+        frame[len++] = (uint8_t)nb;
+        break;
+    case MbuWriteSingleCoil: {
+        int value = *(const int*)data;
+        frame[len++] = value ? 0xff : 0x00;
+        frame[len++] = 0x00;
+    }
+        break;
+    case MbuWriteSingleRegister: {
+        int value = *(const int*)data;
+        frame[len++] = (uint8_t)(value >> 8);
+        frame[len++] = (uint8_t)value;
+    }
+        break;
+    case MbuWriteMultipleCoils: {
+        const uint8_t *bits = (const uint8_t*)data;
+        int bytesNo = (nb + 7) / 8;
+        if (nb > MODBUS_MAX_WRITE_BITS)
+            return 0;
+        frame[len++] = (uint8_t)(nb >> 8);
+        frame[len++] = (uint8_t)nb;
+        frame[len++] = (uint8_t)bytesNo;
+        memset(frame + len, 0, bytesNo);
+        for (i = 0; i < nb; ++i) {
+            if (bits[i])
+                frame[len + i / 8] |= (1 << (i % 8));
+        }
+        len += bytesNo;
+    }
+        break;
+    case MbuWriteMultipleRegisters: {
+        const uint16_t *regs = (const uint16_t*)data;
+        if (nb > MODBUS_MAX_WRITE_REGISTERS)
+            return 0;
+        frame[len++] = (uint8_t)(nb >> 8);
+        frame[len++] = (uint8_t)nb;
+        frame[len++] = (uint8_t)(nb * 2);
+        for (i = 0; i < nb; ++i) {
+            frame[len++] = (uint8_t)(regs[i] >> 8);
+            frame[len++] = (uint8_t)regs[i];
+        }
+    }
+        break;
+    case MbuMaskWriteRegister: {
+        const uint16_t *masks = (const uint16_t*)data;
+        frame[len++] = (uint8_t)(masks[0] >> 8);
+        frame[len++] = (uint8_t)masks[0];
+        frame[len++] = (uint8_t)(masks[1] >> 8);
+        frame[len++] = (uint8_t)masks[1];
+    }
+        break;
+    default:
+        return 0;
+    }
+
+    return len;
+}
+
+int buildWriteReadFrame(uint8_t frame[], int slave, int writeAddr, int writeNb, const uint16_t data[],
+                        int readAddr, int readNb) {
+    int len = 0;
+    int i;
+
+    if (writeNb > MODBUS_MAX_WR_WRITE_REGISTERS || readNb > MODBUS_MAX_WR_READ_REGISTERS)
+        return 0;
+
+    frame[len++] = (uint8_t)slave;
+    frame[len++] = (uint8_t)MbuWriteAndReadRegisters;
+    frame[len++] = (uint8_t)(readAddr >> 8);
+    frame[len++] = (uint8_t)readAddr;
+    frame[len++] = (uint8_t)(readNb >> 8);
+    frame[len++] = (uint8_t)readNb;
+    frame[len++] = (uint8_t)(writeAddr >> 8);
+    frame[len++] = (uint8_t)writeAddr;
+    frame[len++] = (uint8_t)(writeNb >> 8);
+    frame[len++] = (uint8_t)writeNb;
+    frame[len++] = (uint8_t)(writeNb * 2);
+    for (i = 0; i < writeNb; ++i) {
+        frame[len++] = (uint8_t)(data[i] >> 8);
+        frame[len++] = (uint8_t)data[i];
+    }
+
+    return len;
+}
+
+int frameFromAdu(MbuConnType type, const uint8_t adu[], int aduLen, const uint8_t **frame) {
+    int headerLen = codecHeaderLength(type);
+    int crcLen = (MbuRtu == type) ? 2 : 0;
+
+    *frame = adu + headerLen;
+    return aduLen - headerLen - crcLen;
+}
@@ -0,0 +1,51 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_FRAME_H
+#define MBU_FRAME_H
+
+/*
+ * Request frames in the transport independent form used by modbus_send_raw_request():
+ * slave id followed by the PDU (no MBAP header, no CRC).
+ */
+
+#include <stdint.h>
+
+#include "mbu-common.h"
+
+#define MBU_MAX_FRAME_LENGTH (MODBUS_MAX_PDU_LENGTH + 1)
+
+//builds the request frame, data is int* for single writes, uint8_t* (one byte per bit) for coils,
+//uint16_t* for registers and uint16_t[2] (and, or) for mask write; returns frame length or 0 for
+//unsupported function (0x17 has its own builder) or too many elements
+int buildRequestFrame(uint8_t frame[], int slave, int fType, int addr, int nb, const void *data);
+
+//builds 0x17 request frame: writes writeNb registers at writeAddr, then reads readNb from readAddr
+int buildWriteReadFrame(uint8_t frame[], int slave, int writeAddr, int writeNb, const uint16_t data[],
+                        int readAddr, int readNb);
+
+//points frame at slave id + PDU part of the ADU received with modbus_receive()
+int frameFromAdu(MbuConnType type, const uint8_t adu[], int aduLen, const uint8_t **frame);
+
+#endif //MBU_FRAME_H
@@ -0,0 +1,458 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "mbu-gateway.h"
+
+#define GATEWAY_MAX_RTO_MS 1000
+#define GATEWAY_INITIAL_RTO_MS 500
+#define READ_REQUEST_LENGTH 6//unit, function, address, count
+
+int gatewayInit(Gateway *gw, uint32_t ttlMs) {
+    memset(gw, 0, sizeof(*gw));
+    gw->ttlMs = ttlMs;
+    if (-1 == pipe(gw->wakePipe)) {
+        printf("Cannot create gateway pipe: %s\n", strerror(errno));
+        return 0;
+    }
+    fcntl(gw->wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(gw->wakePipe[1], F_SETFL, O_NONBLOCK);
+    return 1;
+}
+
+static int parseLineFormat(const char format[], MbuRtuBackend *rtu) {
+    if (3 != strlen(format) || ('7' != format[0] && '8' != format[0]) || ('1' != format[2] && '2' != format[2]))
+        return 0;
+    switch (format[1]) {
+    case 'N':
+    case 'E':
+    case 'O':
+        break;
+    default:
+        return 0;
+    }
+    rtu->dataBits = format[0] - '0';
+    rtu->parity = format[1];
+    rtu->stopBits = format[2] - '0';
+    return 1;
+}
+
+int gatewayAddPort(Gateway *gw, const char spec[]) {
+    char buf[128];
+    char *units, *baud, *format;
+    GatewayPort *port;
+    MbuRtuBackend *rtu;
+    int ok = 1;
+    int i;
+
+    if (GATEWAY_MAX_PORTS == gw->portsNo) {
+        printf("At most %d gateway ports are supported\n", GATEWAY_MAX_PORTS);
+        return 0;
+    }
+    snprintf(buf, sizeof(buf), "%s", spec);
+    units = strchr(buf, '@');
+    if (0 != units)
+        *units++ = '\0';
+    baud = strchr(buf, ':');
+    if (0 != baud)
+        *baud++ = '\0';
+    format = (0 != baud) ? strchr(baud, ':') : 0;
+    if (0 != format)
+        *format++ = '\0';
+
+    port = &gw->ports[gw->portsNo];
+    port->backend = mbuCreateRtuBackend();
+    rtu = (MbuRtuBackend*)port->backend;
+    mbuSetBackendAddress(port->backend, buf);
+    if (0 != baud) {
+        rtu->baud = mbuGetInt(baud, &ok);
+        ok = ok && rtu->baud > 0;
+    }
+    if (ok && 0 != format)
+        ok = parseLineFormat(format, rtu);
+    if (ok && 0 != units) {
+        int addresses[247];
+        int no = mbuParseAddressList(units, addresses, 247);
+        ok = (0 != no);
+        for (i = 0; i < no; ++i)
+            port->units[addresses[i] >> 3] |= 1 << (addresses[i] & 7);
+    }
+    else if (ok) {
+        for (i = 1; i <= 247; ++i)
+            port->units[i >> 3] |= 1 << (i & 7);
+    }
+    if (0 == ok) {
+        printf("Gateway port (%s) is invalid, expecting device[:baud[:8E1]][@units]\n", spec);
+        port->backend->del(port->backend);
+        port->backend = 0;
+        return 0;
+    }
+
+    gw->portsNo++;
+    return 1;
+}
+
+//builds exception answer to the request frame
+static int exceptionFrame(uint8_t rsp[], const uint8_t frame[], int code) {
+    rsp[0] = frame[0];
+    rsp[1] = frame[1] | 0x80;
+    rsp[2] = code;
+    return 3;
+}
+
+static int transact(GatewayPort *port, const uint8_t frame[], int len, uint8_t rsp[]) {
+    uint8_t adu[MODBUS_RTU_MAX_ADU_LENGTH];
+    int unit = frame[0];
+    RttEstimator *rtt = &port->rtt[unit];
+    uint64_t sentNs, doneNs;
+    int rc;
+
+    if (rttSkip(rtt, mbuClockNs(CLOCK_MONOTONIC)))
+        return exceptionFrame(rsp, frame, MODBUS_EXCEPTION_GATEWAY_TARGET);
+
+    uint32_t floorUs = rtuFrameUs(&port->timing, len + 2) + port->timing.t35Us;
+    uint32_t timeoutUs = rttTimeoutUs(rtt, &port->policy, 0);
+    if (timeoutUs < floorUs)
+        timeoutUs = floorUs;
+    modbus_set_response_timeout(port->ctx, timeoutUs / 1000000, timeoutUs % 1000000);
+    modbus_set_slave(port->ctx, unit);
+
+    if (mbuClockNs(CLOCK_MONOTONIC) < port->lineFreeNs)
+        mbuSleepUntil(port->lineFreeNs);
+    sentNs = mbuClockNs(CLOCK_MONOTONIC);
+    rc = modbus_send_raw_request(port->ctx, (uint8_t*)frame, len);
+    if (-1 != rc)
+        rc = modbus_receive_confirmation(port->ctx, adu);
+    doneNs = mbuClockNs(CLOCK_MONOTONIC);
+    port->lineFreeNs = doneNs + port->timing.t35Us * 1000ULL;
+
+    if (rc > 0) {
+        const uint8_t *rspFrame;
+        int rspLen = frameFromAdu(MbuRtu, adu, rc, &rspFrame);
+        memcpy(rsp, rspFrame, rspLen);
+        rttAnswered(rtt, &port->policy, 1, (uint32_t)((doneNs - sentNs) / 1000));
+        return rspLen;
+    }
+
+    if (rttRetryable(errno))
+        rttFailed(rtt, &port->policy, doneNs);
+    modbus_flush(port->ctx);
+    return exceptionFrame(rsp, frame, MODBUS_EXCEPTION_GATEWAY_TARGET);
+}
+
+static GatewayTransaction *nextQueued(GatewayPort *port) {
+    GatewayTransaction *next = 0;
+    int i;
+
+    for (i = 0; i < GATEWAY_QUEUE_LENGTH; ++i) {
+        GatewayTransaction *t = &port->transactions[i];
+        if (TransactionQueued == t->state && (0 == next || (int32_t)(t->seq - next->seq) < 0))
+            next = t;
+    }
+    return next;
+}
+
+static void cacheStore(GatewayPort *port, const GatewayTransaction *t, uint32_t ttlMs) {
+    GatewayCacheEntry *entry = &port->cache[0];
+    int i;
+
+    for (i = 1; i < GATEWAY_CACHE_SIZE && 0 != entry->expiresNs; ++i) {
+        if (port->cache[i].expiresNs < entry->expiresNs)
+            entry = &port->cache[i];
+    }
+    memcpy(entry->request, t->frame, READ_REQUEST_LENGTH);
+    memcpy(entry->rsp, t->rsp, t->rspLen);
+    entry->rspLen = t->rspLen;
+    entry->expiresNs = mbuClockNs(CLOCK_MONOTONIC) + ttlMs * 1000000ULL;
+}
+
+typedef struct {
+    Gateway *gw;
+    GatewayPort *port;
+} WorkerArg;
+
+static void *portWorker(void *arg) {
+    Gateway *gw = ((WorkerArg*)arg)->gw;
+    GatewayPort *port = ((WorkerArg*)arg)->port;
+    uint8_t rsp[MBU_MAX_FRAME_LENGTH];
+    free(arg);
+
+    pthread_mutex_lock(&port->lock);
+    for (;;) {
+        GatewayTransaction *t;
+        while (0 == port->stop && 0 == (t = nextQueued(port)))
+            pthread_cond_wait(&port->cond, &port->lock);
+        if (port->stop)
+            break;
+
+        //frame is not changed once queued, waiters may be added meanwhile
+        t->state = TransactionInFlight;
+        pthread_mutex_unlock(&port->lock);
+        int rspLen = transact(port, t->frame, t->len, rsp);
+        pthread_mutex_lock(&port->lock);
+
+        memcpy(t->rsp, rsp, rspLen);
+        t->rspLen = rspLen;
+        t->state = TransactionDone;
+        port->sentNo++;
+        if (t->mergeable && 0 != gw->ttlMs && 0 == (rsp[1] & 0x80))
+            cacheStore(port, t, gw->ttlMs);
+        if (-1 == write(gw->wakePipe[1], "", 1) && EAGAIN != errno)
+            printf("Gateway wake up failed: %s\n", strerror(errno));
+    }
+    pthread_mutex_unlock(&port->lock);
+
+    return 0;
+}
+
+int gatewayStart(Gateway *gw) {
+    int i, j;
+
+    for (i = 0; i < gw->portsNo; ++i) {
+        GatewayPort *port = &gw->ports[i];
+        WorkerArg *arg;
+
+        port->ctx = port->backend->createCtxt(port->backend);
+        if (0 == port->ctx || -1 == port->backend->connectCtxt(port->backend, port->ctx)) {
+            printf("Cannot open gateway port %s: %s\n", ((MbuRtuBackend*)port->backend)->devName, modbus_strerror(errno));
+            return 0;
+        }
+        rtuTiming((MbuRtuBackend*)port->backend, &port->timing);
+        rttPolicyInit(&port->policy, 0, GATEWAY_MAX_RTO_MS * 1000);
+        port->policy.retries = 0;//tcp clients retry themselves
+        for (j = 0; j < 248; ++j)
+            rttInit(&port->rtt[j], &port->policy, GATEWAY_INITIAL_RTO_MS * 1000);
+
+        pthread_mutex_init(&port->lock, 0);
+        pthread_cond_init(&port->cond, 0);
+        arg = malloc(sizeof(WorkerArg));
+        arg->gw = gw;
+        arg->port = port;
+        if (0 != pthread_create(&port->worker, 0, &portWorker, arg)) {
+            printf("Cannot start gateway worker\n");
+            free(arg);
+            return 0;
+        }
+        port->running = 1;
+    }
+
+    return 1;
+}
+
+static GatewayPort *routeUnit(Gateway *gw, int unit) {
+    int i;
+    for (i = 0; i < gw->portsNo; ++i) {
+        if (gw->ports[i].units[unit >> 3] & (1 << (unit & 7)))
+            return &gw->ports[i];
+    }
+    return 0;
+}
+
+static int isRead(const uint8_t frame[], int len) {
+    return (READ_REQUEST_LENGTH == len && frame[1] >= MbuReadCoils && frame[1] <= MbuReadInputRegisters);
+}
+
+int gatewaySubmit(Gateway *gw, int fd, const uint8_t adu[], int len) {
+    const uint8_t *frame = adu + MBU_MBAP_HEADER_LENGTH;
+    int frameLen = len - MBU_MBAP_HEADER_LENGTH;
+    uint16_t transactionId = (adu[0] << 8) | adu[1];
+    uint8_t rsp[MBU_MAX_FRAME_LENGTH];
+    int rspLen = 0;
+    GatewayPort *port;
+    GatewayTransaction *t = 0;
+    int read;
+    int i;
+
+    if (frameLen < 2 || frameLen > MBU_MAX_FRAME_LENGTH)
+        return 0;//malformed, left to libmodbus
+    port = routeUnit(gw, frame[0]);
+    if (0 == port)
+        return 0;
+
+    read = isRead(frame, frameLen);
+    pthread_mutex_lock(&port->lock);
+    if (read) {
+        uint64_t nowNs = mbuClockNs(CLOCK_MONOTONIC);
+        for (i = 0; i < GATEWAY_CACHE_SIZE; ++i) {
+            GatewayCacheEntry *entry = &port->cache[i];
+            if (entry->expiresNs > nowNs && 0 == memcmp(entry->request, frame, READ_REQUEST_LENGTH)) {
+                rspLen = entry->rspLen;
+                memcpy(rsp, entry->rsp, rspLen);
+                gw->cachedNo++;
+                break;
+            }
+        }
+        for (i = 0; 0 == rspLen && i < GATEWAY_QUEUE_LENGTH; ++i) {
+            GatewayTransaction *pending = &port->transactions[i];
+            if ((TransactionQueued == pending->state || TransactionInFlight == pending->state) && pending->mergeable
+                    && GATEWAY_MAX_WAITERS != pending->waitersNo && 0 == memcmp(pending->frame, frame, frameLen)) {
+                pending->waiters[pending->waitersNo].fd = fd;
+                pending->waiters[pending->waitersNo].transactionId = transactionId;
+                pending->waitersNo++;
+                gw->mergedNo++;
+                pthread_mutex_unlock(&port->lock);
+                return 1;
+            }
+        }
+    }
+    else {
+        //answers got before the write are stale now
+        for (i = 0; i < GATEWAY_CACHE_SIZE; ++i) {
+            if (port->cache[i].request[0] == frame[0])
+                port->cache[i].expiresNs = 0;
+        }
+        for (i = 0; i < GATEWAY_QUEUE_LENGTH; ++i) {
+            if (port->transactions[i].frame[0] == frame[0])
+                port->transactions[i].mergeable = 0;
+        }
+    }
+
+    if (0 == rspLen) {
+        for (i = 0; 0 == t && i < GATEWAY_QUEUE_LENGTH; ++i) {
+            if (TransactionFree == port->transactions[i].state)
+                t = &port->transactions[i];
+        }
+        if (0 != t) {
+            t->state = TransactionQueued;
+            t->seq = port->seq++;
+            t->mergeable = read;
+            memcpy(t->frame, frame, frameLen);
+            t->len = frameLen;
+            t->waiters[0].fd = fd;
+            t->waiters[0].transactionId = transactionId;
+            t->waitersNo = 1;
+            pthread_cond_signal(&port->cond);
+        }
+        else {
+            rspLen = exceptionFrame(rsp, frame, MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY);
+        }
+    }
+    pthread_mutex_unlock(&port->lock);
+
+    if (0 != rspLen)
+        mbuSendMbapFrame(fd, transactionId, rsp, rspLen);
+    return 1;
+}
+
+void gatewayDeliver(Gateway *gw) {
+    char buf[64];
+    int i, j;
+
+    while (read(gw->wakePipe[0], buf, sizeof(buf)) > 0)
+        ;
+
+    for (i = 0; i < gw->portsNo; ++i) {
+        GatewayPort *port = &gw->ports[i];
+        for (j = 0; j < GATEWAY_QUEUE_LENGTH; ++j) {
+            GatewayTransaction *t = &port->transactions[j];
+            GatewayWaiter waiters[GATEWAY_MAX_WAITERS];
+            uint8_t rsp[MBU_MAX_FRAME_LENGTH];
+            int waitersNo, rspLen, k;
+
+            pthread_mutex_lock(&port->lock);
+            if (TransactionDone != t->state) {
+                pthread_mutex_unlock(&port->lock);
+                continue;
+            }
+            waitersNo = t->waitersNo;
+            memcpy(waiters, t->waiters, waitersNo * sizeof(GatewayWaiter));
+            rspLen = t->rspLen;
+            memcpy(rsp, t->rsp, rspLen);
+            t->state = TransactionFree;
+            pthread_mutex_unlock(&port->lock);
+
+            for (k = 0; k < waitersNo; ++k)
+                mbuSendMbapFrame(waiters[k].fd, waiters[k].transactionId, rsp, rspLen);
+        }
+    }
+}
+
+void gatewayDrop(Gateway *gw, int fd) {
+    int i, j, k;
+
+    for (i = 0; i < gw->portsNo; ++i) {
+        GatewayPort *port = &gw->ports[i];
+        pthread_mutex_lock(&port->lock);
+        for (j = 0; j < GATEWAY_QUEUE_LENGTH; ++j) {
+            GatewayTransaction *t = &port->transactions[j];
+            int kept = 0;
+            if (TransactionFree == t->state)
+                continue;
+            for (k = 0; k < t->waitersNo; ++k) {
+                if (fd != t->waiters[k].fd)
+                    t->waiters[kept++] = t->waiters[k];
+            }
+            t->waitersNo = kept;
+            //nobody waits for it, do not occupy the line (in flight one is finished by the worker)
+            if (0 == kept && TransactionInFlight != t->state)
+                t->state = TransactionFree;
+        }
+        pthread_mutex_unlock(&port->lock);
+    }
+}
+
+int gatewayPending(Gateway *gw) {
+    int i, j;
+    int pendingNo = 0;
+
+    for (i = 0; i < gw->portsNo; ++i) {
+        GatewayPort *port = &gw->ports[i];
+        pthread_mutex_lock(&port->lock);
+        for (j = 0; j < GATEWAY_QUEUE_LENGTH; ++j) {
+            if (TransactionFree != port->transactions[j].state)
+                ++pendingNo;
+        }
+        pthread_mutex_unlock(&port->lock);
+    }
+    return pendingNo;
+}
+
+void gatewayStop(Gateway *gw) {
+    int i;
+
+    for (i = 0; i < gw->portsNo; ++i) {
+        GatewayPort *port = &gw->ports[i];
+        if (port->running) {
+            pthread_mutex_lock(&port->lock);
+            port->stop = 1;
+            pthread_cond_signal(&port->cond);
+            pthread_mutex_unlock(&port->lock);
+            pthread_join(port->worker, 0);
+        }
+        if (0 != port->ctx) {
+            modbus_close(port->ctx);
+            modbus_free(port->ctx);
+        }
+        port->backend->del(port->backend);
+    }
+    close(gw->wakePipe[0]);
+    close(gw->wakePipe[1]);
+}
@@ -0,0 +1,137 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_GATEWAY_H
+#define MBU_GATEWAY_H
+
+/*
+ * Modbus tcp to rtu gateway. Requests of tcp clients are queued per serial port and sent
+ * by the port's worker thread. A read equal to one already queued or being sent is not sent
+ * again, its client gets the same answer; answers to reads are kept for a short time and
+ * served from that cache. Writes invalidate cached and pending reads of their unit.
+ * Finished transactions are handed back to the select() loop through a pipe, so all the
+ * tcp sockets are written by the thread that reads them.
+ */
+
+#include "mbu-common.h"
+#include "mbu-frame.h"
+#include "mbu-poll.h"
+#include "mbu-rtt.h"
+
+#define GATEWAY_MAX_PORTS 4
+#define GATEWAY_QUEUE_LENGTH 32
+#define GATEWAY_MAX_WAITERS 8//clients sharing one transaction
+#define GATEWAY_CACHE_SIZE 64
+#define GATEWAY_DEFAULT_TTL_MS 100
+
+typedef enum {
+    TransactionFree,
+    TransactionQueued,
+    TransactionInFlight,
+    TransactionDone
+} TransactionState;
+
+typedef struct {
+    int fd;
+    uint16_t transactionId;
+} GatewayWaiter;
+
+typedef struct {
+    TransactionState state;
+    uint32_t seq;//fifo order
+    int mergeable;//cleared when a write to the unit is queued after it
+    uint8_t frame[MBU_MAX_FRAME_LENGTH];
+    int len;
+    GatewayWaiter waiters[GATEWAY_MAX_WAITERS];
+    int waitersNo;
+    uint8_t rsp[MBU_MAX_FRAME_LENGTH];
+    int rspLen;
+} GatewayTransaction;
+
+typedef struct {
+    uint8_t request[6];//unit, function, address, count
+    uint8_t rsp[MBU_MAX_FRAME_LENGTH];
+    int rspLen;
+    uint64_t expiresNs;
+} GatewayCacheEntry;
+
+typedef struct {
+    MbuBackendParams *backend;
+    modbus_t *ctx;
+    uint8_t units[32];//bitmask of units routed to the port
+    RtuTiming timing;
+    uint64_t lineFreeNs;
+    RttPolicy policy;
+    RttEstimator rtt[248];
+
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int stop;
+    uint32_t seq;
+    uint64_t sentNo;//transactions sent on the line, guarded by lock
+    GatewayTransaction transactions[GATEWAY_QUEUE_LENGTH];
+    GatewayCacheEntry cache[GATEWAY_CACHE_SIZE];
+} GatewayPort;
+
+typedef struct {
+    GatewayPort ports[GATEWAY_MAX_PORTS];
+    int portsNo;
+    uint32_t ttlMs;
+    int wakePipe[2];//[0] is watched by the select() loop
+
+    uint64_t mergedNo;
+    uint64_t cachedNo;
+} Gateway;
+
+int gatewayInit(Gateway *gw, uint32_t ttlMs);
+
+/*
+ * Adds serial port given as "device[:baud[:8E1]][@units]", units as "1,3,5-9", all of them
+ * if not given. Returns 1 on success.
+ */
+int gatewayAddPort(Gateway *gw, const char spec[]);
+
+//opens the serial ports and starts their workers, returns 1 on success
+int gatewayStart(Gateway *gw);
+
+/*
+ * Takes tcp ADU read from fd. Returns 0 if its unit is not routed to any port (the request
+ * should be served locally), 1 otherwise.
+ */
+int gatewaySubmit(Gateway *gw, int fd, const uint8_t adu[], int len);
+
+//to be called when wakePipe[0] is readable, sends answers of finished transactions
+void gatewayDeliver(Gateway *gw);
+
+//forgets the closed client, so no answer is sent to its descriptor
+void gatewayDrop(Gateway *gw, int fd);
+
+//number of transactions queued, being sent or not delivered yet
+int gatewayPending(Gateway *gw);
+
+void gatewayStop(Gateway *gw);
+
+#endif //MBU_GATEWAY_H
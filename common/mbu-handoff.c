@@ -0,0 +1,386 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mbu-handoff.h"
+
+#define MAPPING_MAGIC "MBUMAP1"
+#define HANDOFF_MAGIC "MBUHOFF1"
+#define HANDOFF_FDS_PER_MESSAGE 250//kernel limit (SCM_MAX_FD) is 253
+#define HANDOFF_RECEIVE_TIMEOUT_S 5
+#define HANDOFF_ACK 'A'
+#define HANDOFF_CONFIRM 'C'
+
+typedef struct {
+    char magic[8];
+    int32_t bitsNo;
+    int32_t inputBitsNo;
+    int32_t registersNo;
+    int32_t inputRegistersNo;
+} MappingHeader;
+
+typedef struct {
+    char magic[8];
+    int32_t type;
+    int32_t clientsNo;
+} HandoffHeader;
+
+//registers first, so they are aligned
+static size_t mappingSize(const MappingHeader *header) {
+    return sizeof(MappingHeader) + 2 * ((size_t)header->registersNo + header->inputRegistersNo)
+            + header->bitsNo + header->inputBitsNo;
+}
+
+static SharedMapping *mapTables(int fd, size_t size) {
+    SharedMapping *shared;
+    const MappingHeader *header;
+    uint8_t *cur;
+
+    shared = (SharedMapping*)calloc(1, sizeof(SharedMapping));
+    if (NULL == shared)
+        return NULL;
+    shared->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == shared->base) {
+        printf("Cannot map register tables: %s\n", strerror(errno));
+        free(shared);
+        return NULL;
+    }
+    shared->fd = fd;
+    shared->size = size;
+
+    header = (const MappingHeader*)shared->base;
+    cur = (uint8_t*)shared->base + sizeof(MappingHeader);
+    shared->mapping.nb_registers = header->registersNo;
+    shared->mapping.tab_registers = (uint16_t*)cur;
+    cur += 2 * (size_t)header->registersNo;
+    shared->mapping.nb_input_registers = header->inputRegistersNo;
+    shared->mapping.tab_input_registers = (uint16_t*)cur;
+    cur += 2 * (size_t)header->inputRegistersNo;
+    shared->mapping.nb_bits = header->bitsNo;
+    shared->mapping.tab_bits = cur;
+    cur += header->bitsNo;
+    shared->mapping.nb_input_bits = header->inputBitsNo;
+    shared->mapping.tab_input_bits = cur;
+    return shared;
+}
+
+SharedMapping *sharedMappingNew(int bitsNo, int inputBitsNo, int registersNo, int inputRegistersNo) {
+    MappingHeader header;
+    SharedMapping *shared;
+    int fd;
+
+    memcpy(header.magic, MAPPING_MAGIC, sizeof(header.magic));
+    header.bitsNo = bitsNo;
+    header.inputBitsNo = inputBitsNo;
+    header.registersNo = registersNo;
+    header.inputRegistersNo = inputRegistersNo;
+
+    fd = memfd_create("modbus-registers", MFD_CLOEXEC);
+    if (-1 == fd || -1 == ftruncate(fd, mappingSize(&header))
+            || sizeof(header) != pwrite(fd, &header, sizeof(header), 0)) {
+        printf("Cannot create shared register tables: %s\n", strerror(errno));
+        if (-1 != fd)
+            close(fd);
+        return NULL;
+    }
+    shared = mapTables(fd, mappingSize(&header));
+    if (NULL == shared)
+        close(fd);
+    return shared;
+}
+
+SharedMapping *sharedMappingAttach(int fd) {
+    MappingHeader header;
+    off_t size = lseek(fd, 0, SEEK_END);
+
+    if (sizeof(header) != pread(fd, &header, sizeof(header), 0)
+            || 0 != memcmp(header.magic, MAPPING_MAGIC, sizeof(header.magic))
+            || header.bitsNo < 0 || header.inputBitsNo < 0 || header.registersNo < 0 || header.inputRegistersNo < 0
+            || size != (off_t)mappingSize(&header)) {
+        printf("Received register tables are invalid\n");
+        return NULL;
+    }
+    return mapTables(fd, size);
+}
+
+void sharedMappingFree(SharedMapping *shared) {
+    munmap(shared->base, shared->size);
+    close(shared->fd);
+    free(shared);
+}
+
+static int minInt(int a, int b) {
+    return (a < b) ? a : b;
+}
+
+void copyMapping(modbus_mapping_t *to, const modbus_mapping_t *from) {
+    if (0 != minInt(to->nb_bits, from->nb_bits))
+        memcpy(to->tab_bits, from->tab_bits, minInt(to->nb_bits, from->nb_bits));
+    if (0 != minInt(to->nb_input_bits, from->nb_input_bits))
+        memcpy(to->tab_input_bits, from->tab_input_bits, minInt(to->nb_input_bits, from->nb_input_bits));
+    if (0 != minInt(to->nb_registers, from->nb_registers))
+        memcpy(to->tab_registers, from->tab_registers, 2 * minInt(to->nb_registers, from->nb_registers));
+    if (0 != minInt(to->nb_input_registers, from->nb_input_registers))
+        memcpy(to->tab_input_registers, from->tab_input_registers,
+               2 * minInt(to->nb_input_registers, from->nb_input_registers));
+}
+
+static int controlAddress(const char path[], struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        printf("Handoff socket path %s is too long\n", path);
+        return 0;
+    }
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+int handoffListen(const char path[]) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (0 == controlAddress(path, &addr))
+        return -1;
+    fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (-1 == fd) {
+        printf("Cannot create handoff socket: %s\n", strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    if (-1 == bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || -1 == listen(fd, 1)) {
+        printf("Cannot listen on handoff socket %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int sendWithFds(int conn, const void *data, size_t len, const int fds[], int fdsNo) {
+    union {
+        char buf[CMSG_SPACE(HANDOFF_FDS_PER_MESSAGE * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = (void*)data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (0 != fdsNo) {
+        struct cmsghdr *cmsg;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(fdsNo * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fdsNo * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, fdsNo * sizeof(int));
+    }
+    return (ssize_t)len == sendmsg(conn, &msg, MSG_NOSIGNAL);
+}
+
+//returns the number of received descriptors, -1 if the message is not as expected
+static int receiveWithFds(int conn, void *data, size_t len, int fds[], int maxFds) {
+    union {
+        char buf[CMSG_SPACE(HANDOFF_FDS_PER_MESSAGE * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t rc;
+    int fdsNo = 0;
+    int overflow = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    rc = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); rc >= 0 && NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+            int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int i;
+            for (i = 0; i < n; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (fdsNo < maxFds)
+                    fds[fdsNo++] = fd;
+                else {
+                    close(fd);
+                    overflow = 1;
+                }
+            }
+        }
+    }
+    if ((ssize_t)len != rc || 0 != (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || overflow) {
+        int i;
+        for (i = 0; i < fdsNo; ++i)
+            close(fds[i]);
+        return -1;
+    }
+    return fdsNo;
+}
+
+int handoffSend(int conn, const HandoffState *state) {
+    HandoffHeader header;
+    int fds[3];
+    int sent;
+
+    memcpy(header.magic, HANDOFF_MAGIC, sizeof(header.magic));
+    header.type = state->type;
+    header.clientsNo = state->clientsNo;
+    fds[0] = state->mappingFd;
+    fds[1] = state->serverSocket;
+    fds[2] = state->controlSocket;
+    if (0 == sendWithFds(conn, &header, sizeof(header), fds, 3)) {
+        printf("Cannot hand over: %s\n", strerror(errno));
+        return 0;
+    }
+    for (sent = 0; sent < state->clientsNo; ) {
+        int32_t chunk = minInt(state->clientsNo - sent, HANDOFF_FDS_PER_MESSAGE);
+        if (0 == sendWithFds(conn, &chunk, sizeof(chunk), state->clients + sent, chunk)) {
+            printf("Cannot hand over connections: %s\n", strerror(errno));
+            return 0;
+        }
+        sent += chunk;
+    }
+    return 1;
+}
+
+static int waitByte(int conn, int timeoutMs, char expected) {
+    struct pollfd pfd;
+    char byte;
+
+    pfd.fd = conn;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeoutMs) <= 0)
+        return 0;
+    return 1 == read(conn, &byte, 1) && expected == byte;
+}
+
+int handoffWaitAck(int conn, int timeoutMs) {
+    char confirm = HANDOFF_CONFIRM;
+
+    if (0 == waitByte(conn, timeoutMs, HANDOFF_ACK))
+        return 0;
+    //the new server does not serve until it gets this, so only one of them serves at a time
+    return 1 == send(conn, &confirm, 1, MSG_NOSIGNAL);
+}
+
+int handoffReceive(const char path[], HandoffState *state) {
+    struct sockaddr_un addr;
+    struct timeval timeout = {HANDOFF_RECEIVE_TIMEOUT_S, 0};
+    HandoffHeader header;
+    int fds[3];
+    int conn, i;
+
+    memset(state, 0, sizeof(*state));
+    if (0 == controlAddress(path, &addr))
+        return -1;
+    conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (-1 == conn || -1 == connect(conn, (struct sockaddr*)&addr, sizeof(addr))) {
+        printf("Cannot connect to running server at %s: %s\n", path, strerror(errno));
+        if (-1 != conn)
+            close(conn);
+        return -1;
+    }
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (3 != receiveWithFds(conn, &header, sizeof(header), fds, 3)
+            || 0 != memcmp(header.magic, HANDOFF_MAGIC, sizeof(header.magic))
+            || header.clientsNo < 0 || header.clientsNo > HANDOFF_MAX_CLIENTS) {
+        printf("Running server has not handed over its state\n");
+        close(conn);
+        return -1;
+    }
+    state->type = (MbuConnType)header.type;
+    state->mappingFd = fds[0];
+    state->serverSocket = fds[1];
+    state->controlSocket = fds[2];
+
+    while (state->clientsNo < header.clientsNo) {
+        int32_t chunk;
+        int n = receiveWithFds(conn, &chunk, sizeof(chunk), state->clients + state->clientsNo,
+                               header.clientsNo - state->clientsNo);
+        if (n > 0)
+            state->clientsNo += n;
+        if (n <= 0 || n != chunk) {
+            printf("Running server has not handed over its connections\n");
+            for (i = 0; i < state->clientsNo; ++i)
+                close(state->clients[i]);
+            for (i = 0; i < 3; ++i)
+                close(fds[i]);
+            close(conn);
+            return -1;
+        }
+    }
+    return conn;
+}
+
+int handoffAck(int conn, int timeoutMs) {
+    char ack = HANDOFF_ACK;
+    return 1 == send(conn, &ack, 1, MSG_NOSIGNAL) && 0 != waitByte(conn, timeoutMs, HANDOFF_CONFIRM);
+}
+
+int handoffSpawn(char *const argv[]) {
+    long maxFd = sysconf(_SC_OPEN_MAX);
+    pid_t pid = fork();
+
+    if (-1 == pid) {
+        printf("Cannot start %s: %s\n", argv[0], strerror(errno));
+        return -1;
+    }
+    if (0 == pid) {
+        int fd;
+        sigset_t none;
+        //the new process gets its descriptors from the handoff, inherited copies would keep connections open
+        for (fd = 3; fd < maxFd; ++fd)
+            close(fd);
+        //signals blocked by the serving loop would stay blocked after exec
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
@@ -0,0 +1,92 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_HANDOFF_H
+#define MBU_HANDOFF_H
+
+/*
+ * Handing a running tcp/unix server over to a new process, so it can be upgraded or
+ * reconfigured without its clients noticing:
+ *  - the register map lives in a memfd, the new process maps the same memory;
+ *  - the listening socket, the control socket and the client connections are passed
+ *    with SCM_RIGHTS over the control socket (unix seqpacket);
+ *  - the old process stops serving while handing over; the new one acknowledges it is ready,
+ *    the old one confirms and exits, and only then the new one starts serving. If the
+ *    acknowledgement is late the old one goes on serving and the new one gives up.
+ * Connections opened meanwhile wait in the (shared) listen queue.
+ */
+
+#include "mbu-common.h"
+
+#define HANDOFF_MAX_CLIENTS FD_SETSIZE
+#define HANDOFF_ACK_TIMEOUT_MS 10000
+
+typedef struct {
+    modbus_mapping_t mapping;//tables point into the shared memory
+    int fd;//memfd
+    void *base;
+    size_t size;
+} SharedMapping;
+
+//allocates zeroed tables in a new memfd, returns NULL on failure
+SharedMapping *sharedMappingNew(int bitsNo, int inputBitsNo, int registersNo, int inputRegistersNo);
+
+//maps tables of memfd received from the previous server, returns NULL if it is not a register map
+SharedMapping *sharedMappingAttach(int fd);
+
+void sharedMappingFree(SharedMapping *shared);
+
+//copies values of addresses present in both mappings
+void copyMapping(modbus_mapping_t *to, const modbus_mapping_t *from);
+
+typedef struct {
+    MbuConnType type;
+    int serverSocket;
+    int controlSocket;
+    int mappingFd;
+    int clients[HANDOFF_MAX_CLIENTS];
+    int clientsNo;
+} HandoffState;
+
+//listens for takeovers on unix seqpacket socket, returns the socket or -1
+int handoffListen(const char path[]);
+
+//sends the state to the new server connected to the control socket, returns 1 on success
+int handoffSend(int conn, const HandoffState *state);
+
+//returns 1 if the new server has taken over within timeoutMs and was told to start serving;
+//the old server has to exit then
+int handoffWaitAck(int conn, int timeoutMs);
+
+//connects to the running server and receives its state, returns the connection or -1
+int handoffReceive(const char path[], HandoffState *state);
+
+//tells the old server it is ready and waits until the old one stops serving (two-phase, so they
+//never serve at once), returns 1 if the new server may serve; otherwise it has to give up
+int handoffAck(int conn, int timeoutMs);
+
+//starts argv as a new process with only standard descriptors open, returns its pid or -1
+int handoffSpawn(char *const argv[]);
+
+#endif //MBU_HANDOFF_H
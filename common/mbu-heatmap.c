@@ -0,0 +1,323 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mbu-heatmap.h"
+
+static const char *TableNames[HEATMAP_TABLES] = {"co", "di", "hr", "ir"};
+
+typedef struct {
+    int table;
+    int first;
+    int last;
+    uint64_t reads;
+    uint64_t writes;
+} HotRange;
+
+Heatmap *heatmapCreate(int perAddress) {
+    Heatmap *map = (Heatmap*)calloc(1, sizeof(Heatmap));
+    int t;
+
+    if (0 == map)
+        return 0;
+    if (perAddress) {
+        for (t = 0; t < HEATMAP_TABLES; ++t) {
+            map->addrReads[t] = (uint32_t*)calloc(65536, sizeof(uint32_t));
+            map->addrWrites[t] = (uint32_t*)calloc(65536, sizeof(uint32_t));
+            if (0 == map->addrReads[t] || 0 == map->addrWrites[t]) {
+                heatmapDelete(map);
+                return 0;
+            }
+        }
+    }
+    map->intervalStartNs = mbuClockNs(CLOCK_MONOTONIC);
+
+    return map;
+}
+
+void heatmapDelete(Heatmap *map) {
+    int t;
+
+    for (t = 0; t < HEATMAP_TABLES; ++t) {
+        free(map->addrReads[t]);
+        free(map->addrWrites[t]);
+    }
+    free(map);
+}
+
+static int sizeBucket(int count) {
+    int bucket = 0;
+    while (count > 1 && bucket < HEATMAP_SIZE_BUCKETS - 1) {
+        count >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void countAccess(Heatmap *map, HeatmapClient *client, int table, int isWrite, int addr, int count) {
+    int page;
+
+    if (count <= 0 || addr + count > 65536)
+        return;
+
+    //one per request and page, so the page counters tell how often the range is accessed
+    for (page = addr >> HEATMAP_PAGE_BITS; page <= (addr + count - 1) >> HEATMAP_PAGE_BITS; ++page) {
+        if (isWrite)
+            map->pageWrites[table][page]++;
+        else
+            map->pageReads[table][page]++;
+    }
+    if (0 != map->addrReads[table]) {
+        uint32_t *counters = isWrite ? map->addrWrites[table] : map->addrReads[table];
+        int i;
+        for (i = addr; i < addr + count; ++i)
+            counters[i]++;
+    }
+
+    map->pointsNo += count;
+    if (0 == client)
+        return;
+    client->pointsNo += count;
+    if (isWrite) {
+        client->writesNo++;
+        return;
+    }
+    client->readsNo++;
+    if (1 == count)
+        client->singleReadsNo++;
+    if (table == client->lastTable && addr == client->lastEnd)
+        client->continuedReadsNo++;
+    client->lastTable = table;
+    client->lastEnd = addr + count;
+}
+
+void heatmapRecord(Heatmap *map, int fd, const uint8_t frame[], int len) {
+    HeatmapClient *client = 0;
+    int function, addr, count;
+
+    if (len < 6)
+        return;
+    function = frame[1];
+    addr = (frame[2] << 8) | frame[3];
+    count = (frame[4] << 8) | frame[5];
+
+    map->requestsNo++;
+    if (fd >= 0 && fd < HEATMAP_MAX_CLIENTS) {
+        client = &map->clients[fd];
+        if (0 == client->active) {
+            client->active = 1;
+            client->lastTable = -1;
+            snprintf(client->name, sizeof(client->name), "fd %d", fd);
+        }
+        client->requestsNo++;
+    }
+
+    switch (function) {
+    case MbuReadCoils:
+        countAccess(map, client, TableCoils, 0, addr, count);
+        break;
+    case MbuReadDiscreteInput:
+        countAccess(map, client, TableDiscreteInputs, 0, addr, count);
+        break;
+    case MbuReadHoldingRegisters:
+        countAccess(map, client, TableHoldingRegisters, 0, addr, count);
+        break;
+    case MbuReadInputRegisters:
+        countAccess(map, client, TableInputRegisters, 0, addr, count);
+        break;
+    case MbuWriteSingleCoil:
+        count = 1;
+        countAccess(map, client, TableCoils, 1, addr, count);
+        break;
+    case MbuWriteSingleRegister:
+    case MbuMaskWriteRegister:
+        count = 1;
+        countAccess(map, client, TableHoldingRegisters, 1, addr, count);
+        break;
+    case MbuWriteMultipleCoils:
+        countAccess(map, client, TableCoils, 1, addr, count);
+        break;
+    case MbuWriteMultipleRegisters:
+        countAccess(map, client, TableHoldingRegisters, 1, addr, count);
+        break;
+    case MbuWriteAndReadRegisters:
+        if (len >= 10)
+            countAccess(map, client, TableHoldingRegisters, 1, (frame[6] << 8) | frame[7], (frame[8] << 8) | frame[9]);
+        countAccess(map, client, TableHoldingRegisters, 0, addr, count);
+        break;
+    default:
+        return;
+    }
+    map->sizes[function][sizeBucket(count)]++;
+}
+
+void heatmapClientOpened(Heatmap *map, int fd, const char name[]) {
+    HeatmapClient *client;
+
+    if (fd < 0 || fd >= HEATMAP_MAX_CLIENTS)
+        return;
+    client = &map->clients[fd];
+    //the fd may be reused before the dump, stats of the closed client go with it
+    if (client->active && client->closed)
+        memset(client, 0, sizeof(*client));
+    client->active = 1;
+    client->closed = 0;
+    client->lastTable = -1;
+    snprintf(client->name, sizeof(client->name), "%s", name);
+}
+
+void heatmapClientClosed(Heatmap *map, int fd) {
+    if (fd >= 0 && fd < HEATMAP_MAX_CLIENTS && map->clients[fd].active)
+        map->clients[fd].closed = 1;
+}
+
+//keeps the top HEATMAP_TOP_RANGES ranges, hottest first
+static void addRange(HotRange top[], int *topNo, const HotRange *range) {
+    uint64_t hits = range->reads + range->writes;
+    int i;
+
+    if (HEATMAP_TOP_RANGES == *topNo && hits <= top[*topNo - 1].reads + top[*topNo - 1].writes)
+        return;
+    i = (HEATMAP_TOP_RANGES == *topNo) ? *topNo - 1 : (*topNo)++;
+    while (i > 0 && top[i - 1].reads + top[i - 1].writes < hits) {
+        top[i] = top[i - 1];
+        i--;
+    }
+    top[i] = *range;
+}
+
+//accessed units (pages or addresses) next to each other make one range
+static void findHotRanges(const uint32_t reads[], const uint32_t writes[], int units, int unitSize, int table,
+                          HotRange top[], int *topNo) {
+    HotRange range;
+    int inRange = 0;
+    int u;
+
+    for (u = 0; u <= units; ++u) {
+        uint32_t r = (u < units) ? reads[u] : 0;
+        uint32_t w = (u < units) ? writes[u] : 0;
+
+        if (0 != r + w) {
+            if (0 == inRange) {
+                range.table = table;
+                range.first = u * unitSize;
+                range.reads = 0;
+                range.writes = 0;
+                inRange = 1;
+            }
+            range.last = u * unitSize + unitSize - 1;
+            //per range the peak counts, a range read whole is counted once per request
+            if (r > range.reads)
+                range.reads = r;
+            if (w > range.writes)
+                range.writes = w;
+        }
+        else if (inRange) {
+            addRange(top, topNo, &range);
+            inRange = 0;
+        }
+    }
+}
+
+void heatmapDump(Heatmap *map, FILE *out) {
+    uint64_t nowNs = mbuClockNs(CLOCK_MONOTONIC);
+    double secs = (nowNs - map->intervalStartNs) / 1e9;
+    HotRange top[HEATMAP_TOP_RANGES];
+    int topNo = 0;
+    int t, f, b, i;
+
+    if (secs <= 0)
+        secs = 1e-9;
+    fprintf(out, "Heatmap of %.1fs: %llu requests (%.1f/s), %llu points\n", secs,
+            (unsigned long long)map->requestsNo, map->requestsNo / secs, (unsigned long long)map->pointsNo);
+
+    for (t = 0; t < HEATMAP_TABLES; ++t) {
+        if (0 != map->addrReads[t])
+            findHotRanges(map->addrReads[t], map->addrWrites[t], 65536, 1, t, top, &topNo);
+        else
+            findHotRanges(map->pageReads[t], map->pageWrites[t], HEATMAP_PAGES, HEATMAP_PAGE_SIZE, t, top, &topNo);
+    }
+    if (0 != topNo && 0 != map->addrReads[0])
+        fprintf(out, "hot ranges:\n");
+    else if (0 != topNo)
+        fprintf(out, "hot ranges (by pages of %d addresses):\n", HEATMAP_PAGE_SIZE);
+    for (i = 0; i < topNo; ++i) {
+        fprintf(out, "\t%s %d-%d: %.1f reads/s, %.1f writes/s\n", TableNames[top[i].table], top[i].first, top[i].last,
+                top[i].reads / secs, top[i].writes / secs);
+    }
+
+    for (f = 0; f < 256; ++f) {
+        uint64_t total = 0;
+        for (b = 0; b < HEATMAP_SIZE_BUCKETS; ++b)
+            total += map->sizes[f][b];
+        if (0 == total)
+            continue;
+        fprintf(out, "function 0x%02x sizes:", f);
+        for (b = 0; b < HEATMAP_SIZE_BUCKETS; ++b) {
+            if (0 != map->sizes[f][b])
+                fprintf(out, " %d-%d: %llu", 1 << b, (2 << b) - 1, (unsigned long long)map->sizes[f][b]);
+        }
+        fprintf(out, "\n");
+    }
+
+    for (i = 0; i < HEATMAP_MAX_CLIENTS; ++i) {
+        HeatmapClient *client = &map->clients[i];
+        if (0 == client->active || 0 == client->requestsNo)
+            continue;
+        fprintf(out, "client %s%s: %llu requests (%.1f/s), %.1f points per request, %llu single point reads",
+                client->name, client->closed ? " (closed)" : "", (unsigned long long)client->requestsNo,
+                client->requestsNo / secs, (double)client->pointsNo / client->requestsNo,
+                (unsigned long long)client->singleReadsNo);
+        if (0 != client->readsNo && client->continuedReadsNo * 2 > client->readsNo)
+            fprintf(out, ", %.0f%% of reads continue the previous one - merge them into block reads",
+                    100.0 * client->continuedReadsNo / client->readsNo);
+        fprintf(out, "\n");
+    }
+    fflush(out);
+
+    //next interval
+    for (t = 0; t < HEATMAP_TABLES; ++t) {
+        if (0 != map->addrReads[t]) {
+            memset(map->addrReads[t], 0, 65536 * sizeof(uint32_t));
+            memset(map->addrWrites[t], 0, 65536 * sizeof(uint32_t));
+        }
+    }
+    memset(map->pageReads, 0, sizeof(map->pageReads));
+    memset(map->pageWrites, 0, sizeof(map->pageWrites));
+    memset(map->sizes, 0, sizeof(map->sizes));
+    for (i = 0; i < HEATMAP_MAX_CLIENTS; ++i) {
+        HeatmapClient *client = &map->clients[i];
+        if (client->closed) {
+            memset(client, 0, sizeof(*client));
+            continue;
+        }
+        client->requestsNo = client->readsNo = client->writesNo = 0;
+        client->pointsNo = client->singleReadsNo = client->continuedReadsNo = 0;
+    }
+    map->requestsNo = 0;
+    map->pointsNo = 0;
+    map->intervalStartNs = nowNs;
+}
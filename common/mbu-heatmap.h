@@ -0,0 +1,94 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_HEATMAP_H
+#define MBU_HEATMAP_H
+
+/*
+ * Access profile of the server map: read/write counters per page of HEATMAP_PAGE_SIZE addresses
+ * (optionally per address), per client totals and request size distribution per function.
+ * Counting is a few increments per request. Dumps list the hottest address ranges and point out
+ * clients reading a block piecewise (a read starting where the previous one of the client ended).
+ * Counters are cleared by every dump, so a dump shows the last interval.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/select.h>
+
+#include "mbu-common.h"
+#include "mbu-preload.h"
+
+#define HEATMAP_TABLES 4 //as TableType
+#define HEATMAP_PAGE_BITS 4
+#define HEATMAP_PAGE_SIZE (1 << HEATMAP_PAGE_BITS)
+#define HEATMAP_PAGES (65536 >> HEATMAP_PAGE_BITS)
+#define HEATMAP_SIZE_BUCKETS 12 //1, 2-3, 4-7, ... 1024-2047
+#define HEATMAP_MAX_CLIENTS FD_SETSIZE
+#define HEATMAP_TOP_RANGES 10
+
+typedef struct {
+    int active;
+    char name[48];
+    uint64_t requestsNo;
+    uint64_t readsNo;
+    uint64_t writesNo;
+    uint64_t pointsNo;
+    uint64_t singleReadsNo;//reads of one point
+    uint64_t continuedReadsNo;//reads starting where the previous read of the same table ended
+    int closed;
+
+    int lastTable;
+    int lastEnd;
+} HeatmapClient;
+
+typedef struct {
+    uint32_t pageReads[HEATMAP_TABLES][HEATMAP_PAGES];
+    uint32_t pageWrites[HEATMAP_TABLES][HEATMAP_PAGES];
+    uint32_t *addrReads[HEATMAP_TABLES];//per address, 0 if not enabled
+    uint32_t *addrWrites[HEATMAP_TABLES];
+    uint64_t sizes[256][HEATMAP_SIZE_BUCKETS];//per function
+    HeatmapClient clients[HEATMAP_MAX_CLIENTS];
+
+    uint64_t requestsNo;
+    uint64_t pointsNo;
+    uint64_t intervalStartNs;//CLOCK_MONOTONIC
+} Heatmap;
+
+//returns 0 if the memory could not be allocated; perAddress adds counters of every address
+Heatmap *heatmapCreate(int perAddress);
+void heatmapDelete(Heatmap *map);
+
+//counts the request (frame: slave id + PDU) of the client (fd, -1 if unknown)
+void heatmapRecord(Heatmap *map, int fd, const uint8_t frame[], int len);
+
+void heatmapClientOpened(Heatmap *map, int fd, const char name[]);
+
+//stats of closed clients are kept until the next dump
+void heatmapClientClosed(Heatmap *map, int fd);
+
+//prints the profile of the interval since the previous dump and clears the counters
+void heatmapDump(Heatmap *map, FILE *out);
+
+#endif //MBU_HEATMAP_H
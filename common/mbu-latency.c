@@ -0,0 +1,94 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <string.h>
+#include <math.h>
+
+#include "mbu-latency.h"
+
+void latencyInit(LatencyStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->minNs = UINT64_MAX;
+}
+
+static int bucketOf(uint64_t ns) {
+    int msb;
+
+    if (ns < (1 << LATENCY_SUB_BITS))
+        return (int)ns;
+    msb = 63 - __builtin_clzll(ns);
+    return ((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+            + (int)((ns >> (msb - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+static uint64_t bucketUpperBound(int bucket) {
+    int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    uint64_t sub = bucket & ((1 << LATENCY_SUB_BITS) - 1);
+
+    if (bucket < (1 << LATENCY_SUB_BITS))
+        return bucket;
+    return (((1 << LATENCY_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+void latencyRecord(LatencyStats *stats, uint64_t ns) {
+    double delta = (double)ns - stats->meanNs;
+
+    stats->count++;
+    stats->meanNs += delta / stats->count;
+    stats->m2 += delta * ((double)ns - stats->meanNs);
+    if (ns < stats->minNs)
+        stats->minNs = ns;
+    if (ns > stats->maxNs)
+        stats->maxNs = ns;
+    stats->buckets[bucketOf(ns)]++;
+}
+
+uint64_t latencyPercentile(const LatencyStats *stats, double fraction) {
+    uint64_t target = (uint64_t)ceil(fraction * stats->count);
+    uint64_t seen = 0;
+    int i;
+
+    if (0 == target)
+        target = 1;
+    for (i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += stats->buckets[i];
+        if (seen >= target) {
+            uint64_t bound = bucketUpperBound(i);
+            return (bound > stats->maxNs) ? stats->maxNs : bound;
+        }
+    }
+    return stats->maxNs;
+}
+
+void latencyPrint(const LatencyStats *stats, const char title[], FILE *out) {
+    if (0 == stats->count) {
+        fprintf(out, "%s: no samples\n", title);
+        return;
+    }
+    fprintf(out, "%s: %llu samples, min %.1fus, mean %.1fus, stddev %.1fus, p50 %.1fus, p99 %.1fus, "
+            "p99.9 %.1fus, max %.1fus\n", title, (unsigned long long)stats->count,
+            stats->minNs / 1e3, stats->meanNs / 1e3, sqrt(stats->m2 / stats->count) / 1e3,
+            latencyPercentile(stats, 0.5) / 1e3, latencyPercentile(stats, 0.99) / 1e3,
+            latencyPercentile(stats, 0.999) / 1e3, stats->maxNs / 1e3);
+}
@@ -0,0 +1,59 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_LATENCY_H
+#define MBU_LATENCY_H
+
+/*
+ * Latency statistics kept without storing samples: a log-linear histogram (16 buckets per
+ * power of two, ~6% resolution) for percentiles, plus exact min/max/mean/standard deviation.
+ * Recording is a few arithmetic operations, so it can run on every request.
+ */
+
+#include <stdio.h>
+
+#include "mbu-common.h"
+
+#define LATENCY_SUB_BITS 4
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t minNs;
+    uint64_t maxNs;
+    double meanNs;
+    double m2;//sum of squared differences from the mean (Welford)
+    uint64_t buckets[LATENCY_BUCKETS];
+} LatencyStats;
+
+void latencyInit(LatencyStats *stats);
+void latencyRecord(LatencyStats *stats, uint64_t ns);
+
+//upper bound of the bucket holding given fraction (0-1) of samples
+uint64_t latencyPercentile(const LatencyStats *stats, double fraction);
+
+//one line: count, min, mean, stddev (jitter), p50, p99, p99.9, max in microseconds
+void latencyPrint(const LatencyStats *stats, const char title[], FILE *out);
+
+#endif //MBU_LATENCY_H
@@ -0,0 +1,206 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+
+#include "mbu-poll.h"
+
+void rtuTiming(const MbuRtuBackend *rtu, RtuTiming *timing) {
+    int bits = 1 + rtu->dataBits + ('N' == rtu->parity ? 0 : 1) + rtu->stopBits;
+
+    timing->charUs = (uint32_t)((bits * 1000000LL + rtu->baud - 1) / rtu->baud);
+    if (rtu->baud > 19200) {
+        timing->t15Us = 750;
+        timing->t35Us = 1750;
+    }
+    else {
+        timing->t15Us = (timing->charUs * 3 + 1) / 2;
+        timing->t35Us = (timing->charUs * 7 + 1) / 2;
+    }
+}
+
+uint32_t rtuFrameUs(const RtuTiming *timing, int len) {
+    return timing->charUs * len;
+}
+
+//address + crc
+#define RTU_ADU_OVERHEAD 3
+
+int rtuRequestLength(const MbuRequest *request) {
+    switch (request->fType) {
+    case MbuReadCoils:
+    case MbuReadDiscreteInput:
+    case MbuReadHoldingRegisters:
+    case MbuReadInputRegisters:
+    case MbuWriteSingleCoil:
+    case MbuWriteSingleRegister:
+        return RTU_ADU_OVERHEAD + 5;
+    case MbuWriteMultipleCoils:
+        return RTU_ADU_OVERHEAD + 6 + (request->nb + 7) / 8;
+    case MbuWriteMultipleRegisters:
+        return RTU_ADU_OVERHEAD + 6 + 2 * request->nb;
+    case MbuMaskWriteRegister:
+        return RTU_ADU_OVERHEAD + 7;
+    case MbuWriteAndReadRegisters:
+        return RTU_ADU_OVERHEAD + 10 + 2 * request->nb;
+    default:
+        return 0;
+    }
+}
+
+int rtuResponseLength(const MbuRequest *request) {
+    switch (request->fType) {
+    case MbuReadCoils:
+    case MbuReadDiscreteInput:
+        return RTU_ADU_OVERHEAD + 2 + (request->nb + 7) / 8;
+    case MbuReadHoldingRegisters:
+    case MbuReadInputRegisters:
+        return RTU_ADU_OVERHEAD + 2 + 2 * request->nb;
+    case MbuWriteSingleCoil:
+    case MbuWriteSingleRegister:
+    case MbuWriteMultipleCoils:
+    case MbuWriteMultipleRegisters:
+        return RTU_ADU_OVERHEAD + 5;
+    case MbuMaskWriteRegister:
+        return RTU_ADU_OVERHEAD + 7;
+    case MbuWriteAndReadRegisters:
+        return RTU_ADU_OVERHEAD + 2 + 2 * request->readNb;
+    default:
+        return 0;
+    }
+}
+
+int rtuPollerInit(RtuPoller *poller, modbus_t *ctx, const MbuRtuBackend *rtu,
+                  MbuRequest requests[], int count, int turnaroundMs, const RttPolicy *policy) {
+    int i;
+
+    if (count > RTU_POLL_MAX_REQUESTS) {
+        printf("Too many poll requests (%d), at most %d are allowed\n", count, RTU_POLL_MAX_REQUESTS);
+        return 0;
+    }
+
+    poller->ctx = ctx;
+    rtuTiming(rtu, &poller->timing);
+    poller->turnaroundUs = turnaroundMs * 1000;
+    poller->requests = requests;
+    poller->count = count;
+    for (i = 0; i < count; ++i)
+        poller->order[i] = i;
+    poller->lineFreeNs = 0;
+    poller->policy = *policy;
+    poller->tracer = 0;
+    for (i = 0; i < count; ++i) {
+        uint32_t initialUs = rtuFrameUs(&poller->timing, rtuRequestLength(&requests[i]))
+                + poller->turnaroundUs + poller->timing.t35Us;
+        rttInit(&poller->rtt[i], policy, initialUs);
+    }
+    poller->requestsNo = 0;
+    poller->failuresNo = 0;
+    poller->retriesNo = 0;
+    poller->skippedNo = 0;
+    poller->pointsNo = 0;
+
+    //bytes of a frame may arrive apart by usb-serial latency, which is covered by the turnaround too
+    uint32_t byteUs = poller->timing.t35Us + poller->turnaroundUs;
+    modbus_set_byte_timeout(ctx, byteUs / 1000000, byteUs % 1000000);
+
+    return 1;
+}
+
+int rtuPollCycle(RtuPoller *poller) {
+    int failed[RTU_POLL_MAX_REQUESTS];
+    int okNo = 0;
+    int failedNo = 0;
+    int i;
+
+    for (i = 0; i < poller->count; ++i) {
+        int idx = poller->order[i];
+        MbuRequest *r = &poller->requests[idx];
+        RttEstimator *rtt = &poller->rtt[idx];
+        //write() returns once the request is queued, so its transmission counts to the response time
+        uint32_t floorUs = rtuFrameUs(&poller->timing, rtuRequestLength(r)) + poller->timing.t35Us;
+        int attempts = rttAttempts(rtt, &poller->policy);
+        int attempt;
+        uint64_t sentNs = 0;
+
+        poller->requestsNo++;
+        if (rttSkip(rtt, mbuClockNs(CLOCK_MONOTONIC))) {
+            r->result = -1;
+            r->error = EHOSTDOWN;
+            poller->skippedNo++;
+            poller->failuresNo++;
+            failed[failedNo++] = idx;
+            continue;
+        }
+
+        modbus_set_slave(poller->ctx, r->slave);
+        for (attempt = 0; attempt < attempts; ++attempt) {
+            uint32_t responseUs = rttTimeoutUs(rtt, &poller->policy, attempt);
+            if (responseUs < floorUs)
+                responseUs = floorUs;
+            modbus_set_response_timeout(poller->ctx, responseUs / 1000000, responseUs % 1000000);
+
+            if (mbuClockNs(CLOCK_MONOTONIC) < poller->lineFreeNs)
+                mbuSleepUntil(poller->lineFreeNs);
+
+            sentNs = mbuClockNs(CLOCK_MONOTONIC);
+            r->result = mbuExecuteRequest(poller->ctx, r);
+            r->error = (-1 == r->result) ? errno : 0;
+            poller->lineFreeNs = mbuClockNs(CLOCK_MONOTONIC) + poller->timing.t35Us * 1000ULL;
+            if (0 != poller->tracer)
+                traceRecord(poller->tracer, TraceIssued, modbus_get_socket(poller->ctx), r->slave, r->fType,
+                            (MbuWriteAndReadRegisters == r->fType) ? r->readAddr : r->addr,
+                            (MbuWriteAndReadRegisters == r->fType) ? r->readNb : r->nb,
+                            sentNs, poller->lineFreeNs - poller->timing.t35Us * 1000ULL,
+                            traceStatus(r->result, r->error));
+
+            if (-1 != r->result || 0 == rttRetryable(r->error))
+                break;
+            if (attempt + 1 < attempts)
+                poller->retriesNo++;
+        }
+
+        if (-1 != r->result || (r->error > MODBUS_ENOBASE && r->error <= EMBXGTAR))
+            rttAnswered(rtt, &poller->policy, attempt + 1, (uint32_t)((poller->lineFreeNs - sentNs) / 1000)
+                        - poller->timing.t35Us);
+        else if (rttRetryable(r->error))
+            rttFailed(rtt, &poller->policy, mbuClockNs(CLOCK_MONOTONIC));
+
+        if (-1 == r->result) {
+            poller->failuresNo++;
+            failed[failedNo++] = idx;
+        }
+        else {
+            poller->pointsNo += r->result;
+            poller->order[okNo++] = idx;
+        }
+    }
+
+    //responding slaves keep their order, failing ones are moved behind them
+    for (i = 0; i < failedNo; ++i)
+        poller->order[okNo + i] = failed[i];
+
+    return okNo;
+}
@@ -0,0 +1,89 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_POLL_H
+#define MBU_POLL_H
+
+/*
+ * Polling of many slaves on one RTU line. Timeouts and inter-frame gaps are derived from
+ * the line settings instead of a fixed timeout: a request may start t3.5 after the previous
+ * frame ended. The first response timeout is the request transmission time, slave turnaround
+ * and t3.5, later ones adapt to measured response times of each request (see mbu-rtt.h), never
+ * going below the transmission time and t3.5. Requests that failed in the previous cycle go
+ * last and slaves marked down are only probed, so a dead slave does not delay the others.
+ */
+
+#include "mbu-common.h"
+#include "mbu-session.h"
+#include "mbu-rtt.h"
+#include "mbu-trace.h"
+
+#define RTU_POLL_MAX_REQUESTS 256
+
+typedef struct {
+    uint32_t charUs;//one character on the line: start, data, parity and stop bits
+    uint32_t t15Us;//max silence within a frame
+    uint32_t t35Us;//min silence between frames
+} RtuTiming;
+
+//above 19200 baud t1.5 and t3.5 are fixed to 750us and 1750us as the spec recommends
+void rtuTiming(const MbuRtuBackend *rtu, RtuTiming *timing);
+
+//time the frame of len bytes occupies the line
+uint32_t rtuFrameUs(const RtuTiming *timing, int len);
+
+//ADU lengths (address, PDU and crc) of the request and its normal response, 0 for unsupported functions
+int rtuRequestLength(const MbuRequest *request);
+int rtuResponseLength(const MbuRequest *request);
+
+typedef struct {
+    modbus_t *ctx;//not owned, connected rtu context
+    RtuTiming timing;
+    uint32_t turnaroundUs;
+    MbuRequest *requests;//not owned
+    int count;
+    int order[RTU_POLL_MAX_REQUESTS];
+    uint64_t lineFreeNs;//CLOCK_MONOTONIC time the next request may start at
+    RttPolicy policy;
+    RttEstimator rtt[RTU_POLL_MAX_REQUESTS];//per request, as slaves differ in response time
+    Tracer *tracer;//optional, every attempt is traced
+
+    uint64_t requestsNo;
+    uint64_t failuresNo;
+    uint64_t retriesNo;
+    uint64_t skippedNo;//requests not sent, because their slave is down
+    uint64_t pointsNo;
+} RtuPoller;
+
+/*
+ * Turnaround is the time the slowest slave needs to start answering, it sets the first timeout.
+ * Returns 0 if there are too many requests.
+ */
+int rtuPollerInit(RtuPoller *poller, modbus_t *ctx, const MbuRtuBackend *rtu,
+                  MbuRequest requests[], int count, int turnaroundMs, const RttPolicy *policy);
+
+//executes all requests once (filling their result/error), returns number of successful ones
+int rtuPollCycle(RtuPoller *poller);
+
+#endif //MBU_POLL_H
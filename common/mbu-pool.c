@@ -0,0 +1,158 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mbu-pool.h"
+
+int poolInit(MbuPool *pool, size_t blockSize, int capacity) {
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+    //blocks hold structures, keep them aligned
+    pool->blockSize = (blockSize + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+    pool->capacity = capacity;
+    pool->blocks = (uint8_t*)calloc(capacity, pool->blockSize);
+    pool->freeBlocks = (int*)malloc(capacity * sizeof(int));
+    pool->inUse = (uint8_t*)calloc(capacity, sizeof(uint8_t));
+    if (0 == pool->blocks || 0 == pool->freeBlocks || 0 == pool->inUse) {
+        printf("Cannot allocate pool of %d blocks of %u bytes\n", capacity, (unsigned)blockSize);
+        poolFree(pool);
+        return 0;
+    }
+    //lowest blocks are handed out first
+    for (i = 0; i < capacity; ++i)
+        pool->freeBlocks[i] = capacity - 1 - i;
+    pool->freeNo = capacity;
+    pthread_mutex_init(&pool->lock, 0);
+    return 1;
+}
+
+void poolFree(MbuPool *pool) {
+    free(pool->blocks);
+    free(pool->freeBlocks);
+    free(pool->inUse);
+    pool->blocks = 0;
+    pool->freeBlocks = 0;
+    pool->inUse = 0;
+    pool->capacity = 0;
+    pool->freeNo = 0;
+}
+
+void *poolBlock(MbuPool *pool, int index) {
+    return pool->blocks + index * pool->blockSize;
+}
+
+void *poolAcquire(MbuPool *pool) {
+    void *block = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    if (0 != pool->freeNo) {
+        int index = pool->freeBlocks[--pool->freeNo];
+        block = poolBlock(pool, index);
+        pool->inUse[index] = 1;
+        pool->acquiredNo++;
+        if (pool->capacity - pool->freeNo > pool->highWater)
+            pool->highWater = pool->capacity - pool->freeNo;
+    }
+    else {
+        pool->exhaustedNo++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return block;
+}
+
+int poolRelease(MbuPool *pool, void *block) {
+    size_t offset = (uint8_t*)block - pool->blocks;
+    int index = -1;
+
+    //block of another pool or not at a block start
+    if ((uint8_t*)block >= pool->blocks && offset < pool->capacity * pool->blockSize
+            && 0 == offset % pool->blockSize)
+        index = offset / pool->blockSize;
+
+    pthread_mutex_lock(&pool->lock);
+    if (-1 == index || 0 == pool->inUse[index]) {
+        pthread_mutex_unlock(&pool->lock);
+        printf("Pool: released block %p is not in use\n", block);
+        return 0;
+    }
+    pool->inUse[index] = 0;
+    pool->freeBlocks[pool->freeNo++] = index;
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+int poolInUse(MbuPool *pool) {
+    int inUse;
+
+    pthread_mutex_lock(&pool->lock);
+    inUse = pool->capacity - pool->freeNo;
+    pthread_mutex_unlock(&pool->lock);
+    return inUse;
+}
+
+void poolPrint(MbuPool *pool, const char title[], FILE *out) {
+    pthread_mutex_lock(&pool->lock);
+    fprintf(out, "%s: %d of %d in use, at most %d, %llu acquired, %llu refused\n", title,
+            pool->capacity - pool->freeNo, pool->capacity, pool->highWater,
+            (unsigned long long)pool->acquiredNo, (unsigned long long)pool->exhaustedNo);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#ifdef MBU_COUNT_ALLOCATIONS
+
+static uint64_t allocationsNo = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_add_fetch(&allocationsNo, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    __atomic_add_fetch(&allocationsNo, 1, __ATOMIC_RELAXED);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocationsNo, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+long long heapAllocationsNo(void) {
+    return (long long)__atomic_load_n(&allocationsNo, __ATOMIC_RELAXED);
+}
+
+#else
+
+long long heapAllocationsNo(void) {
+    return -1;
+}
+
+#endif //MBU_COUNT_ALLOCATIONS
@@ -0,0 +1,77 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_POOL_H
+#define MBU_POOL_H
+
+/*
+ * Pool of equally sized blocks for per-connection state and buffers, allocated at startup
+ * in one piece; acquiring and releasing a block does not touch the heap, so memory use stays
+ * flat under connection churn. Acquiring and releasing are thread safe.
+ *
+ * Built with MBU_COUNT_ALLOCATIONS (cmake option), malloc/calloc/realloc calls of the program
+ * and libmbu are counted (linker --wrap), so it can be checked that a warmed up server makes
+ * none; allocations inside shared libraries (libmodbus, libc) are not seen.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct {
+    uint8_t *blocks;
+    size_t blockSize;
+    int capacity;
+    int *freeBlocks;//stack of free block indexes
+    uint8_t *inUse;//per block, a block is released only if it is acquired
+    int freeNo;
+    pthread_mutex_t lock;
+
+    uint64_t acquiredNo;
+    uint64_t exhaustedNo;//acquires failed because all blocks were in use
+    int highWater;
+} MbuPool;
+
+//allocates capacity zeroed blocks, returns 1 on success
+int poolInit(MbuPool *pool, size_t blockSize, int capacity);
+void poolFree(MbuPool *pool);
+
+//block of given index, to set blocks up before they are used
+void *poolBlock(MbuPool *pool, int index);
+
+//returns NULL if all blocks are in use
+void *poolAcquire(MbuPool *pool);
+//returns 0 (the pool is left as is) if the block is not acquired from this pool, e.g. released twice
+int poolRelease(MbuPool *pool, void *block);
+
+int poolInUse(MbuPool *pool);
+
+//one line: blocks in use, high water mark, acquires and failed acquires
+void poolPrint(MbuPool *pool, const char title[], FILE *out);
+
+//heap allocations made so far, -1 if they are not counted
+long long heapAllocationsNo(void);
+
+#endif //MBU_POOL_H
@@ -0,0 +1,173 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "mbu-preload.h"
+
+static int isBitTable(TableType table) {
+    return (TableCoils == table || TableDiscreteInputs == table);
+}
+
+static void tableOf(modbus_mapping_t *mapping, TableType table, void **tab, int *size) {
+    switch (table) {
+    case TableCoils:
+        *tab = mapping->tab_bits;
+        *size = mapping->nb_bits;
+        break;
+    case TableDiscreteInputs:
+        *tab = mapping->tab_input_bits;
+        *size = mapping->nb_input_bits;
+        break;
+    case TableHoldingRegisters:
+        *tab = mapping->tab_registers;
+        *size = mapping->nb_registers;
+        break;
+    case TableInputRegisters:
+        *tab = mapping->tab_input_registers;
+        *size = mapping->nb_input_registers;
+        break;
+    }
+}
+
+static int preloadBinary(const MbuMappedFile *file, TableType table, void *tab, int tabSize) {
+    const uint8_t *src = (const uint8_t*)file->data;
+
+    if (isBitTable(table)) {
+        size_t bitsNo = file->size * 8;
+        if (bitsNo > (size_t)tabSize + 7) {
+            printf("Image has %zu bits, table holds only %d\n", bitsNo, tabSize);
+            return 0;
+        }
+        if (bitsNo > (size_t)tabSize)
+            bitsNo = tabSize;
+        modbus_set_bits_from_bytes((uint8_t*)tab, 0, (unsigned int)bitsNo, src);
+    }
+    else {
+        uint16_t *dst = (uint16_t*)tab;
+        size_t wordsNo = file->size / 2;
+        size_t i;
+        if (0 != file->size % 2) {
+            printf("Image size %zu is not a multiple of register size\n", file->size);
+            return 0;
+        }
+        if (wordsNo > (size_t)tabSize) {
+            printf("Image has %zu registers, table holds only %d\n", wordsNo, tabSize);
+            return 0;
+        }
+        for (i = 0; i < wordsNo; ++i) {
+            dst[i] = (uint16_t)((src[2 * i] << 8) | src[2 * i + 1]);
+        }
+    }
+
+    return 1;
+}
+
+static int preloadCsv(const MbuMappedFile *file, TableType table, void *tab, int tabSize) {
+    const char *cur = file->data;
+    const char *end = file->data + file->size;
+    int line = 1;
+
+    while (cur < end) {
+        long addr;
+        long value;
+        long maxValue = isBitTable(table) ? 1 : UINT16_MAX;
+
+        while (cur < end && (' ' == *cur || '\t' == *cur || '\r' == *cur))
+            cur++;
+
+        if (cur < end && '\n' != *cur && '#' != *cur) {
+            if (0 == mbuScanInt(&cur, end, &addr)) {
+                printf("Line %d: address expected\n", line);
+                return 0;
+            }
+            while (cur < end && (' ' == *cur || '\t' == *cur || ',' == *cur || ';' == *cur))
+                cur++;
+            if (0 == mbuScanInt(&cur, end, &value)) {
+                printf("Line %d: value expected\n", line);
+                return 0;
+            }
+            while (cur < end && (' ' == *cur || '\t' == *cur || '\r' == *cur))
+                cur++;
+            if (cur < end && '\n' != *cur && '#' != *cur) {
+                printf("Line %d: unexpected text after the value\n", line);
+                return 0;
+            }
+            if (addr < 0 || addr >= tabSize) {
+                printf("Line %d: address %ld out of table range (0-%d)\n", line, addr, tabSize - 1);
+                return 0;
+            }
+            if (value < 0 || value > maxValue) {
+                printf("Line %d: value %ld out of range (0-%ld)\n", line, value, maxValue);
+                return 0;
+            }
+
+            if (isBitTable(table))
+                ((uint8_t*)tab)[addr] = (uint8_t)value;
+            else
+                ((uint16_t*)tab)[addr] = (uint16_t)value;
+        }
+
+        //skip the rest of the line (trailing blanks or comment)
+        cur = memchr(cur, '\n', end - cur);
+        if (0 == cur)
+            break;
+        cur++;
+        line++;
+    }
+
+    return 1;
+}
+
+static int hasCsvExtension(const char path[]) {
+    size_t len = strlen(path);
+    return (len > 4 && 0 == strcasecmp(path + len - 4, ".csv"));
+}
+
+int preloadTable(modbus_mapping_t *mapping, TableType table, const char path[]) {
+    MbuMappedFile file;
+    void *tab = 0;
+    int tabSize = 0;
+    int ok;
+
+    tableOf(mapping, table, &tab, &tabSize);
+    if (0 == mbuMapFile(path, &file)) {
+        return 0;
+    }
+
+    if (hasCsvExtension(path))
+        ok = preloadCsv(&file, table, tab, tabSize);
+    else
+        ok = preloadBinary(&file, table, tab, tabSize);
+
+    mbuUnmapFile(&file);
+    if (0 == ok) {
+        printf("Loading %s failed\n", path);
+    }
+
+    return ok;
+}
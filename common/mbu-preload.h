@@ -0,0 +1,48 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_PRELOAD_H
+#define MBU_PRELOAD_H
+
+/*
+ * Seeding of the server register map from files:
+ *  - binary image: registers as big-endian 16-bit words, bits packed LSB first (as in FC 0x0F),
+ *    element 0 of the file goes to address 0 of the table;
+ *  - csv (*.csv): one "address,value" pair per line, dec or 0x-hex, '#' starts a comment;
+ *    values are 0-65535 for registers, 0 or 1 for bits.
+ */
+
+#include "mbu-common.h"
+
+typedef enum {
+    TableCoils,
+    TableDiscreteInputs,
+    TableHoldingRegisters,
+    TableInputRegisters
+} TableType;
+
+//loads given table of the mapping from file, returns 1 on success
+int preloadTable(modbus_mapping_t *mapping, TableType table, const char path[]);
+
+#endif //MBU_PRELOAD_H
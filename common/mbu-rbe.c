@@ -0,0 +1,188 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mbu-rbe.h"
+
+//points compared at once before looking at single ones
+#define RBE_CHUNK 32
+
+int rbeInit(RbeBlock *block, int isBits, int nb) {
+    block->isBits = isBits;
+    block->nb = nb;
+    block->primed = 0;
+    block->deadband.absolute = 0;
+    block->deadband.percentX100 = 0;
+    block->deadbands = 0;
+    block->reported = calloc(nb, isBits ? sizeof(uint8_t) : sizeof(uint16_t));
+    return (0 != block->reported);
+}
+
+void rbeFree(RbeBlock *block) {
+    free(block->reported);
+    free(block->deadbands);
+    block->reported = 0;
+    block->deadbands = 0;
+}
+
+int rbeLoadDeadbands(RbeBlock *block, const char path[], int firstAddr) {
+    char line[128];
+    int lineNo = 0;
+    int i;
+
+    FILE *f = fopen(path, "r");
+    if (0 == f) {
+        printf("Cannot open deadband file %s\n", path);
+        return 0;
+    }
+
+    if (0 == block->deadbands) {
+        block->deadbands = malloc(block->nb * sizeof(RbeDeadband));
+        if (0 == block->deadbands) {
+            printf("Cannot allocate deadbands of %d points\n", block->nb);
+            fclose(f);
+            return 0;
+        }
+        for (i = 0; i < block->nb; ++i)
+            block->deadbands[i] = block->deadband;
+    }
+
+    while (0 != fgets(line, sizeof(line), f)) {
+        int addr, absolute;
+        double percent = 0;
+        char *comment = strchr(line, '#');
+
+        lineNo++;
+        if (0 != comment)
+            *comment = '\0';
+        int fields = sscanf(line, "%i , %i , %lf", &addr, &absolute, &percent);
+        if (fields <= 0)
+            continue;
+        if (fields < 2 || absolute < 0 || absolute > 0xffff || percent < 0 || percent > 655) {
+            printf("%s:%d: expecting address,absolute[,percent]\n", path, lineNo);
+            fclose(f);
+            return 0;
+        }
+        addr -= firstAddr;
+        if (addr < 0 || addr >= block->nb)
+            continue;//for other blocks
+        block->deadbands[addr].absolute = (uint16_t)absolute;
+        block->deadbands[addr].percentX100 = (uint16_t)(percent * 100 + 0.5);
+    }
+
+    fclose(f);
+    return 1;
+}
+
+static int exceedsDeadband(const RbeDeadband *deadband, uint16_t value, uint16_t reported) {
+    uint32_t delta = (value > reported) ? value - reported : reported - value;
+
+    if (delta <= deadband->absolute)
+        return 0;
+    if (0 != deadband->percentX100 && delta * 10000ULL <= (uint64_t)deadband->percentX100 * reported)
+        return 0;
+    return 1;
+}
+
+static int updateRegisters(RbeBlock *block, const uint16_t values[], uint64_t timestampNs, RbeChange changes[]) {
+    uint16_t *reported = (uint16_t*)block->reported;
+    int changesNo = 0;
+    int base, i;
+
+    for (base = 0; base < block->nb; base += RBE_CHUNK) {
+        int end = (base + RBE_CHUNK < block->nb) ? base + RBE_CHUNK : block->nb;
+        uint16_t diff = 0;
+
+        for (i = base; i < end; ++i)
+            diff |= values[i] ^ reported[i];
+        if (0 == diff)
+            continue;
+
+        for (i = base; i < end; ++i) {
+            const RbeDeadband *deadband = (0 != block->deadbands) ? &block->deadbands[i] : &block->deadband;
+            if (values[i] == reported[i] || 0 == exceedsDeadband(deadband, values[i], reported[i]))
+                continue;
+            changes[changesNo].index = i;
+            changes[changesNo].value = values[i];
+            changes[changesNo].previous = reported[i];
+            changes[changesNo].timestampNs = timestampNs;
+            changesNo++;
+            reported[i] = values[i];
+        }
+    }
+
+    return changesNo;
+}
+
+static int updateBits(RbeBlock *block, const uint8_t values[], uint64_t timestampNs, RbeChange changes[]) {
+    uint8_t *reported = (uint8_t*)block->reported;
+    int changesNo = 0;
+    int base, i;
+
+    for (base = 0; base < block->nb; base += RBE_CHUNK) {
+        int end = (base + RBE_CHUNK < block->nb) ? base + RBE_CHUNK : block->nb;
+        uint8_t diff = 0;
+
+        for (i = base; i < end; ++i)
+            diff |= values[i] ^ reported[i];
+        if (0 == diff)
+            continue;
+
+        for (i = base; i < end; ++i) {
+            if (values[i] == reported[i])
+                continue;
+            changes[changesNo].index = i;
+            changes[changesNo].value = values[i];
+            changes[changesNo].previous = reported[i];
+            changes[changesNo].timestampNs = timestampNs;
+            changesNo++;
+            reported[i] = values[i];
+        }
+    }
+
+    return changesNo;
+}
+
+int rbeUpdate(RbeBlock *block, const void *values, uint64_t timestampNs, RbeChange changes[]) {
+    int i;
+
+    if (0 == block->primed) {
+        block->primed = 1;
+        memcpy(block->reported, values, block->nb * (block->isBits ? sizeof(uint8_t) : sizeof(uint16_t)));
+        for (i = 0; i < block->nb; ++i) {
+            changes[i].index = i;
+            changes[i].value = block->isBits ? ((const uint8_t*)values)[i] : ((const uint16_t*)values)[i];
+            changes[i].previous = changes[i].value;
+            changes[i].timestampNs = timestampNs;
+        }
+        return block->nb;
+    }
+
+    if (block->isBits)
+        return updateBits(block, (const uint8_t*)values, timestampNs, changes);
+    return updateRegisters(block, (const uint16_t*)values, timestampNs, changes);
+}
@@ -0,0 +1,71 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_RBE_H
+#define MBU_RBE_H
+
+/*
+ * Report by exception: a block keeps the last reported values of one polled range and
+ * tells which points of a new poll differ from them by more than their deadbands. The first
+ * update reports all points. Unchanged parts of the block are skipped chunk by chunk with
+ * a branchless xor loop, which compilers vectorize.
+ */
+
+#include "mbu-common.h"
+
+typedef struct {
+    uint16_t absolute;//0 - not used
+    uint16_t percentX100;//of the last reported value, 0 - not used
+} RbeDeadband;
+
+typedef struct {
+    int isBits;//uint8_t per point (coils, discrete inputs) or uint16_t (registers)
+    int nb;
+    void *reported;
+    int primed;
+    RbeDeadband deadband;//for all points without their own one
+    RbeDeadband *deadbands;//optional per point ones, registers only
+} RbeBlock;
+
+typedef struct {
+    int index;//in the block
+    uint16_t value;
+    uint16_t previous;
+    uint64_t timestampNs;//CLOCK_REALTIME of the poll
+} RbeChange;
+
+//returns 0 on allocation failure
+int rbeInit(RbeBlock *block, int isBits, int nb);
+void rbeFree(RbeBlock *block);
+
+/*
+ * Loads per point deadbands from csv lines "address,absolute[,percent]" ('#' starts a comment),
+ * the address is made relative to the first one of the block. Returns 1 on success.
+ */
+int rbeLoadDeadbands(RbeBlock *block, const char path[], int firstAddr);
+
+//compares values (as the block type) with the reported ones, returns number of changes written
+int rbeUpdate(RbeBlock *block, const void *values, uint64_t timestampNs, RbeChange changes[]);
+
+#endif //MBU_RBE_H
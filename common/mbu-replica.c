@@ -0,0 +1,402 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "mbu-replica.h"
+#include "mbu-handoff.h"
+
+#define REPLICA_MAGIC "MBUREP1"
+#define REPLICA_SNDBUF (1024 * 1024)
+#define REPLICA_SNAPSHOT_TIMEOUT_S 5
+
+//both ends run on the same host, so the records are in host byte order
+typedef struct {
+    char magic[8];
+    uint64_t sequence;//of the last change contained
+    int32_t sizes[4];//indexed with TableType
+} ReplicaSnapshot;
+
+typedef struct {
+    uint64_t sequence;
+    uint8_t table;//TableType
+    uint8_t reserved;
+    uint16_t address;
+    uint16_t count;
+    uint16_t valuesLen;//bytes following: one per bit or two per register
+} ReplicaRecord;
+
+//table of the mapping, bits are bytes there as well
+static uint8_t *tableOf(modbus_mapping_t *mapping, int table, int *size, int *elementSize) {
+    switch (table) {
+    case TableCoils:
+        *size = mapping->nb_bits;
+        *elementSize = 1;
+        return mapping->tab_bits;
+    case TableDiscreteInputs:
+        *size = mapping->nb_input_bits;
+        *elementSize = 1;
+        return mapping->tab_input_bits;
+    case TableHoldingRegisters:
+        *size = mapping->nb_registers;
+        *elementSize = 2;
+        return (uint8_t*)mapping->tab_registers;
+    default:
+        *size = mapping->nb_input_registers;
+        *elementSize = 2;
+        return (uint8_t*)mapping->tab_input_registers;
+    }
+}
+
+static int replicaAddress(const char path[], struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        printf("Replication socket path %s is too long\n", path);
+        return 0;
+    }
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+int replicationIsWrite(const uint8_t frame[], int len) {
+    if (len < 2)
+        return 0;
+    switch (frame[1]) {
+    case MbuWriteSingleCoil:
+    case MbuWriteSingleRegister:
+    case MbuWriteMultipleCoils:
+    case MbuWriteMultipleRegisters:
+    case MbuMaskWriteRegister:
+    case MbuWriteAndReadRegisters:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int replicationListen(ReplicationPrimary *primary, const char path[], modbus_mapping_t *mapping) {
+    struct sockaddr_un addr;
+
+    memset(primary, 0, sizeof(*primary));
+    primary->mapping = mapping;
+    if (0 == replicaAddress(path, &addr))
+        return 0;
+    primary->listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == primary->listenSocket) {
+        printf("Cannot create replication socket: %s\n", strerror(errno));
+        return 0;
+    }
+    unlink(path);
+    if (-1 == bind(primary->listenSocket, (struct sockaddr*)&addr, sizeof(addr))
+            || -1 == listen(primary->listenSocket, REPLICA_MAX_REPLICAS)) {
+        printf("Cannot listen for replicas on %s: %s\n", path, strerror(errno));
+        close(primary->listenSocket);
+        primary->listenSocket = -1;
+        return 0;
+    }
+    return 1;
+}
+
+static int sendFull(int fd, const void *data, size_t len) {
+    const uint8_t *cur = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t sent = send(fd, cur, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (-1 == sent && EINTR == errno)
+                continue;
+            return 0;
+        }
+        cur += sent;
+        len -= sent;
+    }
+    return 1;
+}
+
+static int sendSnapshot(ReplicationPrimary *primary, int fd) {
+    ReplicaSnapshot snapshot;
+    int table;
+
+    memset(&snapshot, 0, sizeof(snapshot));
+    memcpy(snapshot.magic, REPLICA_MAGIC, sizeof(REPLICA_MAGIC));
+    snapshot.sequence = primary->sequence;
+    for (table = TableCoils; table <= TableInputRegisters; ++table) {
+        int elementSize;
+        tableOf(primary->mapping, table, &snapshot.sizes[table], &elementSize);
+    }
+    if (0 == sendFull(fd, &snapshot, sizeof(snapshot)))
+        return 0;
+    for (table = TableCoils; table <= TableInputRegisters; ++table) {
+        int size, elementSize;
+        const uint8_t *values = tableOf(primary->mapping, table, &size, &elementSize);
+        if (0 != size && 0 == sendFull(fd, values, (size_t)size * elementSize))
+            return 0;
+    }
+    return 1;
+}
+
+void replicationAccept(ReplicationPrimary *primary) {
+    int size = REPLICA_SNDBUF;
+    int fd = accept(primary->listenSocket, NULL, NULL);
+
+    if (-1 == fd) {
+        perror("Replica accept() error");
+        return;
+    }
+    if (REPLICA_MAX_REPLICAS == primary->replicasNo) {
+        printf("At most %d replicas are supported, replica refused\n", REPLICA_MAX_REPLICAS);
+        close(fd);
+        return;
+    }
+    /* Changes recorded so far are in the snapshot already */
+    replicationFlush(primary);
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    if (0 == sendSnapshot(primary, fd)) {
+        printf("Cannot send snapshot to the replica: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+    primary->replicas[primary->replicasNo++] = fd;
+    printf("Replica joined on socket %d at sequence %llu\n", fd, (unsigned long long)primary->sequence);
+}
+
+static void addRecord(ReplicationPrimary *primary, int table, int address, int count, int maxCount) {
+    ReplicaRecord record;
+    int size, elementSize;
+    const uint8_t *values = tableOf(primary->mapping, table, &size, &elementSize);
+
+    /* Out of range writes were refused, they changed nothing */
+    if (count <= 0 || count > maxCount || address + count > size
+            || sizeof(record) + (size_t)count * elementSize > sizeof(primary->batch))
+        return;
+    memset(&record, 0, sizeof(record));
+    record.sequence = ++primary->sequence;
+    record.table = table;
+    record.address = address;
+    record.count = count;
+    record.valuesLen = count * elementSize;
+    if (primary->batchLen + sizeof(record) + record.valuesLen > sizeof(primary->batch))
+        replicationFlush(primary);
+    memcpy(primary->batch + primary->batchLen, &record, sizeof(record));
+    memcpy(primary->batch + primary->batchLen + sizeof(record), values + address * elementSize, record.valuesLen);
+    primary->batchLen += sizeof(record) + record.valuesLen;
+}
+
+void replicationRecord(ReplicationPrimary *primary, const uint8_t frame[], int len) {
+    int address, count;
+
+    if (0 == replicationIsWrite(frame, len) || len < 6)
+        return;
+    address = (frame[2] << 8) | frame[3];
+    count = (frame[4] << 8) | frame[5];
+
+    switch (frame[1]) {
+    case MbuWriteSingleCoil:
+        addRecord(primary, TableCoils, address, 1, 1);
+        break;
+    case MbuWriteSingleRegister:
+    case MbuMaskWriteRegister:
+        addRecord(primary, TableHoldingRegisters, address, 1, 1);
+        break;
+    case MbuWriteMultipleCoils:
+        addRecord(primary, TableCoils, address, count, MODBUS_MAX_WRITE_BITS);
+        break;
+    case MbuWriteMultipleRegisters:
+        addRecord(primary, TableHoldingRegisters, address, count, MODBUS_MAX_WRITE_REGISTERS);
+        break;
+    case MbuWriteAndReadRegisters:
+        if (len >= 10)
+            addRecord(primary, TableHoldingRegisters, (frame[6] << 8) | frame[7], (frame[8] << 8) | frame[9],
+                      MODBUS_MAX_WR_WRITE_REGISTERS);
+        break;
+    }
+}
+
+void replicationFlush(ReplicationPrimary *primary) {
+    int i;
+
+    if (0 == primary->batchLen)
+        return;
+    for (i = 0; i < primary->replicasNo; ++i) {
+        ssize_t sent = send(primary->replicas[i], primary->batch, primary->batchLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent == (ssize_t)primary->batchLen)
+            continue;
+        if (-1 == sent && (EPIPE == errno || ECONNRESET == errno)) {
+            printf("Replica on socket %d left\n", primary->replicas[i]);
+        }
+        else {
+            /* Partially sent batch cannot be completed later without stalling the server */
+            printf("Replica on socket %d falls behind, disconnected\n", primary->replicas[i]);
+            primary->droppedNo++;
+        }
+        close(primary->replicas[i]);
+        primary->replicas[i--] = primary->replicas[--primary->replicasNo];
+    }
+    primary->batchLen = 0;
+    primary->batchesNo++;
+}
+
+void replicationClose(ReplicationPrimary *primary) {
+    int i;
+
+    replicationFlush(primary);
+    for (i = 0; i < primary->replicasNo; ++i)
+        close(primary->replicas[i]);
+    primary->replicasNo = 0;
+    if (-1 != primary->listenSocket)
+        close(primary->listenSocket);
+    primary->listenSocket = -1;
+}
+
+static int receiveSnapshot(ReplicationReplica *replica) {
+    ReplicaSnapshot snapshot;
+    modbus_mapping_t *primaryMapping;
+    int table, ok = 1;
+
+    if (0 == mbuReadFull(replica->socket, (uint8_t*)&snapshot, sizeof(snapshot))
+            || 0 != memcmp(snapshot.magic, REPLICA_MAGIC, sizeof(REPLICA_MAGIC))) {
+        printf("No snapshot received from the primary\n");
+        return 0;
+    }
+    primaryMapping = modbus_mapping_new(snapshot.sizes[TableCoils], snapshot.sizes[TableDiscreteInputs],
+                                        snapshot.sizes[TableHoldingRegisters], snapshot.sizes[TableInputRegisters]);
+    if (primaryMapping == NULL) {
+        printf("Cannot allocate snapshot of the primary\n");
+        return 0;
+    }
+    for (table = TableCoils; ok && table <= TableInputRegisters; ++table) {
+        int size, elementSize;
+        uint8_t *values = tableOf(primaryMapping, table, &size, &elementSize);
+        ok = (0 == size || 0 != mbuReadFull(replica->socket, values, (size_t)size * elementSize));
+    }
+    if (ok) {
+        copyMapping(replica->mapping, primaryMapping);
+        replica->sequence = snapshot.sequence;
+        replica->snapshotsNo++;
+    }
+    else {
+        printf("Snapshot of the primary is incomplete\n");
+    }
+    modbus_mapping_free(primaryMapping);
+    return ok;
+}
+
+int replicaConnect(ReplicationReplica *replica, const char path[], modbus_mapping_t *mapping) {
+    struct sockaddr_un addr;
+    struct timeval timeout = {REPLICA_SNAPSHOT_TIMEOUT_S, 0};
+
+    if (0 == replicaAddress(path, &addr))
+        return 0;
+    /* Reconnecting passes replica->path */
+    if (path != replica->path)
+        strcpy(replica->path, path);
+    replica->mapping = mapping;
+    replica->inLen = 0;
+    replica->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == replica->socket) {
+        printf("Cannot create replication socket: %s\n", strerror(errno));
+        return 0;
+    }
+    setsockopt(replica->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (-1 == connect(replica->socket, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(replica->socket);
+        replica->socket = -1;
+        return 0;
+    }
+    if (0 == receiveSnapshot(replica)) {
+        replicaClose(replica);
+        return 0;
+    }
+    printf("Replicating primary %s from sequence %llu\n", replica->path, (unsigned long long)replica->sequence);
+    return 1;
+}
+
+static int applyRecord(ReplicationReplica *replica, const ReplicaRecord *record, const uint8_t values[]) {
+    int size, elementSize, count;
+    uint8_t *table;
+
+    if (record->sequence != replica->sequence + 1) {
+        printf("Change %llu of the primary is missed, taking a new snapshot\n",
+               (unsigned long long)(replica->sequence + 1));
+        return 0;
+    }
+    replica->sequence = record->sequence;
+    replica->changesNo++;
+    if (record->table > TableInputRegisters)
+        return 1;
+    table = tableOf(replica->mapping, record->table, &size, &elementSize);
+    if (record->valuesLen != record->count * elementSize)
+        return 0;
+    /* Replica may have a smaller map, common addresses are kept in sync */
+    count = record->count;
+    if (record->address + count > size)
+        count = size - record->address;
+    if (count > 0)
+        memcpy(table + record->address * elementSize, values, count * elementSize);
+    return 1;
+}
+
+int replicaReceive(ReplicationReplica *replica) {
+    ssize_t received;
+    size_t done = 0;
+
+    received = recv(replica->socket, replica->in + replica->inLen, sizeof(replica->in) - replica->inLen, 0);
+    if (received <= 0) {
+        if (-1 == received && EINTR == errno)
+            return 1;
+        printf("Primary %s is gone, registers are not updated until it is back\n", replica->path);
+        replicaClose(replica);
+        return 0;
+    }
+    replica->inLen += received;
+
+    while (replica->inLen - done >= sizeof(ReplicaRecord)) {
+        ReplicaRecord record;
+        memcpy(&record, replica->in + done, sizeof(record));
+        if (replica->inLen - done < sizeof(record) + record.valuesLen)
+            break;
+        if (0 == applyRecord(replica, &record, replica->in + done + sizeof(record))) {
+            replicaClose(replica);
+            return 0;
+        }
+        done += sizeof(record) + record.valuesLen;
+    }
+    memmove(replica->in, replica->in + done, replica->inLen - done);
+    replica->inLen -= done;
+    return 1;
+}
+
+void replicaClose(ReplicationReplica *replica) {
+    if (-1 != replica->socket)
+        close(replica->socket);
+    replica->socket = -1;
+    replica->inLen = 0;
+}
@@ -0,0 +1,99 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_REPLICA_H
+#define MBU_REPLICA_H
+
+/*
+ * Register map replication between tcp/unix servers on one host:
+ *  - the primary serves writes and listens for replicas on a unix stream socket;
+ *  - a joining replica gets a snapshot of all tables with the sequence number of the last change;
+ *  - then changes (table, address range, values after the write, sequence number) are sent
+ *    to all replicas in one batch per server loop round;
+ *  - replicas apply them in order and answer write requests with illegal function exception.
+ * A replica that cannot keep up (socket buffer full) or sees a gap in sequence numbers is
+ * disconnected and catches up with a new snapshot when it reconnects.
+ */
+
+#include "mbu-common.h"
+#include "mbu-preload.h"
+
+#define REPLICA_MAX_REPLICAS 16
+#define REPLICA_BATCH_SIZE (64 * 1024)
+#define REPLICA_RETRY_MS 1000
+
+typedef struct {
+    modbus_mapping_t *mapping;
+    int listenSocket;
+    int replicas[REPLICA_MAX_REPLICAS];
+    int replicasNo;
+
+    uint64_t sequence;//of the last recorded change
+    uint8_t batch[REPLICA_BATCH_SIZE];
+    size_t batchLen;
+
+    uint64_t batchesNo;
+    uint64_t droppedNo;//replicas disconnected for falling behind
+} ReplicationPrimary;
+
+typedef struct {
+    modbus_mapping_t *mapping;
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    int socket;//-1 while the primary is not connected
+
+    uint64_t sequence;//of the last applied change
+    uint8_t in[2 * REPLICA_BATCH_SIZE];
+    size_t inLen;
+
+    uint64_t snapshotsNo;
+    uint64_t changesNo;
+} ReplicationReplica;
+
+//1 for requests changing the register map
+int replicationIsWrite(const uint8_t frame[], int len);
+
+//listens for replicas on the socket path, returns 1 on success
+int replicationListen(ReplicationPrimary *primary, const char path[], modbus_mapping_t *mapping);
+
+//accepts a replica waiting on the listen socket and sends it the snapshot
+void replicationAccept(ReplicationPrimary *primary);
+
+//records values written by the request frame (unit id + PDU), call after it is served
+//without exception (refused writes change nothing)
+void replicationRecord(ReplicationPrimary *primary, const uint8_t frame[], int len);
+
+//sends recorded changes to the replicas
+void replicationFlush(ReplicationPrimary *primary);
+
+void replicationClose(ReplicationPrimary *primary);
+
+//connects to the primary and loads its snapshot into the mapping, returns 1 on success
+int replicaConnect(ReplicationReplica *replica, const char path[], modbus_mapping_t *mapping);
+
+//reads and applies changes available on replica->socket, returns 0 if the connection is lost
+int replicaReceive(ReplicationReplica *replica);
+
+void replicaClose(ReplicationReplica *replica);
+
+#endif //MBU_REPLICA_H
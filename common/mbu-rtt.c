@@ -0,0 +1,101 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include "mbu-rtt.h"
+
+#define RTT_DEFAULT_RETRIES 1
+#define RTT_DEFAULT_DOWN_AFTER 3
+#define RTT_DEFAULT_PROBE_INTERVAL_US 5000000
+
+void rttPolicyInit(RttPolicy *policy, uint32_t minRtoUs, uint32_t maxRtoUs) {
+    policy->minRtoUs = minRtoUs;
+    policy->maxRtoUs = (maxRtoUs < minRtoUs) ? minRtoUs : maxRtoUs;
+    policy->retries = RTT_DEFAULT_RETRIES;
+    policy->downAfter = RTT_DEFAULT_DOWN_AFTER;
+    policy->probeIntervalUs = RTT_DEFAULT_PROBE_INTERVAL_US;
+}
+
+static uint32_t clampRto(const RttPolicy *policy, uint64_t rtoUs) {
+    if (rtoUs < policy->minRtoUs)
+        return policy->minRtoUs;
+    if (rtoUs > policy->maxRtoUs)
+        return policy->maxRtoUs;
+    return (uint32_t)rtoUs;
+}
+
+void rttInit(RttEstimator *rtt, const RttPolicy *policy, uint32_t initialRtoUs) {
+    rtt->srttUs = 0;
+    rtt->rttvarUs = 0;
+    rtt->rtoUs = clampRto(policy, initialRtoUs);
+    rtt->failures = 0;
+    rtt->down = 0;
+    rtt->nextProbeNs = 0;
+}
+
+int rttSkip(const RttEstimator *rtt, uint64_t nowNs) {
+    return (rtt->down && nowNs < rtt->nextProbeNs);
+}
+
+int rttAttempts(const RttEstimator *rtt, const RttPolicy *policy) {
+    return rtt->down ? 1 : 1 + policy->retries;
+}
+
+uint32_t rttTimeoutUs(const RttEstimator *rtt, const RttPolicy *policy, int attempt) {
+    if (attempt > 16)
+        attempt = 16;
+    return clampRto(policy, (uint64_t)rtt->rtoUs << attempt);
+}
+
+int rttRetryable(int error) {
+    if (error > MODBUS_ENOBASE && error <= EMBXGTAR)
+        return 0;//device answered with exception
+    return (EMBMDATA != error);
+}
+
+void rttAnswered(RttEstimator *rtt, const RttPolicy *policy, int attempts, uint32_t rttUs) {
+    if (1 == attempts) {
+        if (0 == rtt->srttUs) {
+            rtt->srttUs = rttUs;
+            rtt->rttvarUs = rttUs / 2;
+        }
+        else {
+            uint32_t delta = (rtt->srttUs > rttUs) ? rtt->srttUs - rttUs : rttUs - rtt->srttUs;
+            rtt->rttvarUs = (3 * (uint64_t)rtt->rttvarUs + delta) / 4;
+            rtt->srttUs = (7 * (uint64_t)rtt->srttUs + rttUs) / 8;
+        }
+        rtt->rtoUs = clampRto(policy, rtt->srttUs + 4 * (uint64_t)rtt->rttvarUs);
+    }
+    rtt->failures = 0;
+    rtt->down = 0;
+}
+
+void rttFailed(RttEstimator *rtt, const RttPolicy *policy, uint64_t nowNs) {
+    //as tcp, keep the backed off timeout until a new sample is taken
+    rtt->rtoUs = clampRto(policy, 2 * (uint64_t)rtt->rtoUs);
+    rtt->failures++;
+    if (rtt->failures >= policy->downAfter) {
+        rtt->down = 1;
+        rtt->nextProbeNs = nowNs + policy->probeIntervalUs * 1000ULL;
+    }
+}
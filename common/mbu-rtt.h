@@ -0,0 +1,78 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_RTT_H
+#define MBU_RTT_H
+
+/*
+ * Per-target response timeouts adapted to measured round trip times, as tcp computes
+ * its RTO (RFC 6298): smoothed rtt plus four times its variation, kept within bounds.
+ * Timed out requests are retried with doubled timeout; a target failing several requests
+ * in a row is marked down and only probed once per probe interval until it answers.
+ */
+
+#include "mbu-common.h"
+
+typedef struct {
+    uint32_t minRtoUs;
+    uint32_t maxRtoUs;
+    int retries;//extra attempts after a timeout or garbled response
+    int downAfter;//failed requests in a row that mark the target down
+    uint32_t probeIntervalUs;
+} RttPolicy;
+
+typedef struct {
+    uint32_t srttUs;//0 until the first sample
+    uint32_t rttvarUs;
+    uint32_t rtoUs;
+    int failures;//requests failed in a row
+    int down;
+    uint64_t nextProbeNs;//CLOCK_MONOTONIC
+} RttEstimator;
+
+void rttPolicyInit(RttPolicy *policy, uint32_t minRtoUs, uint32_t maxRtoUs);
+
+//initial timeout is used until the first response is measured
+void rttInit(RttEstimator *rtt, const RttPolicy *policy, uint32_t initialRtoUs);
+
+//whether the request should be skipped, because the target is down and not due for a probe
+int rttSkip(const RttEstimator *rtt, uint64_t nowNs);
+
+//number of attempts the request may take: a probe of a down target gets only one
+int rttAttempts(const RttEstimator *rtt, const RttPolicy *policy);
+
+//timeout of the given attempt (0 - first one), doubled with each retry
+uint32_t rttTimeoutUs(const RttEstimator *rtt, const RttPolicy *policy, int attempt);
+
+//whether the error (errno of libmodbus call) is worth a retry, exception responses are not
+int rttRetryable(int error);
+
+/*
+ * Outcome of the whole request. The rtt is sampled only if the first attempt got the answer,
+ * retried ones are ambiguous (Karn's algorithm). An exception response counts as an answer.
+ */
+void rttAnswered(RttEstimator *rtt, const RttPolicy *policy, int attempts, uint32_t rttUs);
+void rttFailed(RttEstimator *rtt, const RttPolicy *policy, uint64_t nowNs);
+
+#endif //MBU_RTT_H
@@ -0,0 +1,328 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "mbu-series.h"
+
+int seriesOpen(SeriesRecorder *rec, const char path[]) {
+    rec->series = 0;
+    rec->seriesNo = 0;
+    rec->encoded = 0;
+    rec->encodedCapacity = 0;
+
+    if (0 == asyncWriterOpen(&rec->writer, path, SERIES_BUFFER_SIZE)) {
+        return 0;
+    }
+
+    if (0 == asyncWriterFileSize(&rec->writer)) {
+        asyncWriterAppend(&rec->writer, SERIES_MAGIC, SERIES_HEADER_LENGTH);
+    }
+    else {
+        //appending - make sure it is a recording indeed
+        char magic[SERIES_HEADER_LENGTH];
+        int fd = open(path, O_RDONLY);
+        int ok = (SERIES_HEADER_LENGTH == read(fd, magic, SERIES_HEADER_LENGTH)
+                  && 0 == memcmp(magic, SERIES_MAGIC, SERIES_HEADER_LENGTH));
+        close(fd);
+        if (0 == ok) {
+            printf("%s exists and is not a recording\n", path);
+            asyncWriterClose(&rec->writer);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+//worst case: 10 bytes per timestamp, 3 per value
+static size_t maxEncodedLength(int nb) {
+    return SERIES_BLOCK_HEADER_LENGTH + SERIES_BLOCK_ROWS * (10 + 3 * (size_t)nb);
+}
+
+int seriesAdd(SeriesRecorder *rec, int slave, int fType, int addr, int nb) {
+    size_t encodedLength = maxEncodedLength(nb);
+    uint16_t *values = malloc(SERIES_BLOCK_ROWS * nb * sizeof(uint16_t));
+    uint8_t *encoded = (encodedLength > rec->encodedCapacity) ? malloc(encodedLength) : 0;
+    SeriesBuffer *series = 0;
+    SeriesBuffer *s;
+
+    //rec is changed only once everything is allocated
+    if (0 != values && (0 != encoded || encodedLength <= rec->encodedCapacity))
+        series = realloc(rec->series, (rec->seriesNo + 1) * sizeof(SeriesBuffer));
+    if (0 == series) {
+        printf("Cannot allocate recording buffers of %d points\n", nb);
+        free(values);
+        free(encoded);
+        return -1;
+    }
+    rec->series = series;
+    if (0 != encoded) {
+        free(rec->encoded);
+        rec->encoded = encoded;
+        rec->encodedCapacity = encodedLength;
+    }
+
+    s = &rec->series[rec->seriesNo];
+    s->slave = slave;
+    s->fType = fType;
+    s->addr = addr;
+    s->nb = nb;
+    s->rows = 0;
+    s->values = values;
+
+    return rec->seriesNo++;
+}
+
+static uint8_t *putVarint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int isBitFunction(int fType) {
+    return (MbuReadCoils == fType || MbuReadDiscreteInput == fType);
+}
+
+static uint8_t *encodeColumn(uint8_t *p, const uint16_t values[], int stride, int rows, int bits) {
+    int r = 1;
+
+    p = putVarint(p, values[0]);
+    while (r < rows) {
+        uint16_t cur = values[r * stride];
+        uint16_t prev = values[(r - 1) * stride];
+        uint64_t change = bits ? (uint64_t)(cur ^ prev) : zigzag((int16_t)(cur - prev));
+
+        if (0 == change) {
+            int run = 1;
+            while (r + run < rows && values[(r + run) * stride] == cur)
+                run++;
+            p = putVarint(p, 0);
+            p = putVarint(p, run - 1);
+            r += run;
+        }
+        else {
+            p = putVarint(p, change);
+            r++;
+        }
+    }
+
+    return p;
+}
+
+static void writeBlock(SeriesRecorder *rec, SeriesBuffer *s) {
+    uint8_t *p = rec->encoded + SERIES_BLOCK_HEADER_LENGTH;
+    uint32_t len;
+    int64_t prevDelta = 0;
+    int r, i;
+
+    p = putVarint(p, s->ts[0]);
+    for (r = 1; r < s->rows; ++r) {
+        int64_t delta = (int64_t)(s->ts[r] - s->ts[r - 1]);
+        p = putVarint(p, zigzag(delta - prevDelta));
+        prevDelta = delta;
+    }
+    for (i = 0; i < s->nb; ++i)
+        p = encodeColumn(p, s->values + i, s->nb, s->rows, isBitFunction(s->fType));
+
+    len = (uint32_t)(p - rec->encoded - SERIES_BLOCK_HEADER_LENGTH);
+    rec->encoded[0] = s->slave;
+    rec->encoded[1] = s->fType;
+    rec->encoded[2] = s->addr & 0xff;
+    rec->encoded[3] = s->addr >> 8;
+    rec->encoded[4] = s->nb & 0xff;
+    rec->encoded[5] = s->nb >> 8;
+    rec->encoded[6] = s->rows & 0xff;
+    rec->encoded[7] = s->rows >> 8;
+    for (i = 0; i < 4; ++i)
+        rec->encoded[8 + i] = (uint8_t)(len >> (8 * i));
+
+    asyncWriterAppend(&rec->writer, rec->encoded, SERIES_BLOCK_HEADER_LENGTH + len);
+    s->rows = 0;
+}
+
+void seriesAppend(SeriesRecorder *rec, int id, uint64_t timestampNs, const void *values) {
+    SeriesBuffer *s = &rec->series[id];
+    uint16_t *row = s->values + s->rows * s->nb;
+    int i;
+
+    s->ts[s->rows] = timestampNs;
+    if (isBitFunction(s->fType)) {
+        for (i = 0; i < s->nb; ++i)
+            row[i] = ((const uint8_t*)values)[i];
+    }
+    else {
+        memcpy(row, values, s->nb * sizeof(uint16_t));
+    }
+
+    if (SERIES_BLOCK_ROWS == ++s->rows)
+        writeBlock(rec, s);
+}
+
+void seriesClose(SeriesRecorder *rec) {
+    int i;
+
+    for (i = 0; i < rec->seriesNo; ++i) {
+        if (0 != rec->series[i].rows)
+            writeBlock(rec, &rec->series[i]);
+        free(rec->series[i].values);
+    }
+    asyncWriterClose(&rec->writer);
+    free(rec->series);
+    free(rec->encoded);
+    rec->series = 0;
+    rec->encoded = 0;
+}
+
+int seriesReaderOpen(SeriesReader *reader, const char path[]) {
+    memset(reader, 0, sizeof(*reader));
+    if (0 == mbuMapFile(path, &reader->file)) {
+        return 0;
+    }
+    if (reader->file.size < SERIES_HEADER_LENGTH
+            || 0 != memcmp(reader->file.data, SERIES_MAGIC, SERIES_HEADER_LENGTH)) {
+        printf("%s is not a recording\n", path);
+        mbuUnmapFile(&reader->file);
+        return 0;
+    }
+    reader->pos = SERIES_HEADER_LENGTH;
+    return 1;
+}
+
+//returns 0 if the varint runs past the end
+static int getVarint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    int shift = 0;
+    *v = 0;
+    while (*p < end && shift < 64) {
+        uint8_t b = *(*p)++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (0 == (b & 0x80))
+            return 1;
+        shift += 7;
+    }
+    return 0;
+}
+
+static int decodeColumn(const uint8_t **p, const uint8_t *end, uint16_t values[], int stride, int rows, int bits) {
+    uint64_t v;
+    int r = 1;
+
+    if (0 == getVarint(p, end, &v))
+        return 0;
+    values[0] = (uint16_t)v;
+    while (r < rows) {
+        uint16_t prev = values[(r - 1) * stride];
+        if (0 == getVarint(p, end, &v))
+            return 0;
+        if (0 == v) {
+            uint64_t run;
+            if (0 == getVarint(p, end, &run) || r + run >= (uint64_t)rows)
+                return 0;
+            for (run++; run > 0; --run, ++r)
+                values[r * stride] = prev;
+        }
+        else {
+            values[r * stride] = bits ? (uint16_t)(prev ^ v) : (uint16_t)(prev + unzigzag(v));
+            r++;
+        }
+    }
+
+    return 1;
+}
+
+int seriesReaderNext(SeriesReader *reader, const SeriesBlock **block) {
+    const uint8_t *data = (const uint8_t*)reader->file.data;
+    SeriesBlock *b = &reader->block;
+    const uint8_t *p, *end;
+    uint32_t len = 0;
+    uint64_t v;
+    int64_t delta = 0;
+    int r, i;
+
+    if (reader->pos == reader->file.size)
+        return 0;
+    if (reader->file.size - reader->pos < SERIES_BLOCK_HEADER_LENGTH)
+        return -1;
+
+    p = data + reader->pos;
+    b->slave = p[0];
+    b->fType = p[1];
+    b->addr = p[2] | (p[3] << 8);
+    b->nb = p[4] | (p[5] << 8);
+    b->rows = p[6] | (p[7] << 8);
+    for (i = 0; i < 4; ++i)
+        len |= (uint32_t)p[8 + i] << (8 * i);
+    p += SERIES_BLOCK_HEADER_LENGTH;
+    end = p + len;
+    if (len > reader->file.size - reader->pos - SERIES_BLOCK_HEADER_LENGTH || 0 == b->rows
+            || b->rows > SERIES_BLOCK_ROWS || 0 == b->nb)
+        return -1;
+
+    if ((size_t)b->rows * b->nb > reader->capacity) {
+        free(b->values);
+        reader->capacity = (size_t)SERIES_BLOCK_ROWS * b->nb;
+        b->values = malloc(reader->capacity * sizeof(uint16_t));
+    }
+    if (0 == b->ts)
+        b->ts = malloc(SERIES_BLOCK_ROWS * sizeof(uint64_t));
+
+    if (0 == getVarint(&p, end, &v))
+        return -1;
+    b->ts[0] = v;
+    for (r = 1; r < b->rows; ++r) {
+        if (0 == getVarint(&p, end, &v))
+            return -1;
+        delta += unzigzag(v);
+        b->ts[r] = b->ts[r - 1] + delta;
+    }
+    for (i = 0; i < b->nb; ++i) {
+        if (0 == decodeColumn(&p, end, b->values + i, b->nb, b->rows, isBitFunction(b->fType)))
+            return -1;
+    }
+
+    reader->pos += SERIES_BLOCK_HEADER_LENGTH + len;
+    *block = b;
+    return 1;
+}
+
+void seriesReaderClose(SeriesReader *reader) {
+    free(reader->block.ts);
+    free(reader->block.values);
+    mbuUnmapFile(&reader->file);
+}
@@ -0,0 +1,103 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_SERIES_H
+#define MBU_SERIES_H
+
+/*
+ * Compressed recording of polled values. Every polled range is a series; its samples are
+ * collected into blocks of up to SERIES_BLOCK_ROWS rows, stored column by column:
+ *  header: "MBUSER1\0"
+ *  block:  uint8 slave, uint8 function, uint16 address, uint16 points, uint16 rows,
+ *          uint32 payload length (little endian), payload
+ *  payload: timestamps [ns since epoch] - first one, then deltas of deltas;
+ *           then one column per point - first value, then changes to the previous row:
+ *           zigzag delta for registers, xor for bits.
+ * Numbers are LEB128 varints (deltas zigzag encoded), a zero change is followed by the number
+ * of further zero ones, so an unchanged point takes two bytes per block.
+ */
+
+#include "mbu-common.h"
+#include "mbu-writer.h"
+
+#define SERIES_MAGIC "MBUSER1"
+#define SERIES_HEADER_LENGTH 8
+#define SERIES_BLOCK_HEADER_LENGTH 12
+#define SERIES_BLOCK_ROWS 256
+#define SERIES_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    uint8_t slave;
+    uint8_t fType;
+    uint16_t addr;
+    uint16_t nb;
+    int rows;
+    uint64_t ts[SERIES_BLOCK_ROWS];
+    uint16_t *values;//rows x nb
+} SeriesBuffer;
+
+typedef struct {
+    AsyncWriter writer;
+    SeriesBuffer *series;
+    int seriesNo;
+    uint8_t *encoded;
+    size_t encodedCapacity;
+} SeriesRecorder;
+
+int seriesOpen(SeriesRecorder *rec, const char path[]);
+
+//registers a polled range, returns its id or -1
+int seriesAdd(SeriesRecorder *rec, int slave, int fType, int addr, int nb);
+
+//values are uint8_t per point for coils/discrete inputs, uint16_t for registers
+void seriesAppend(SeriesRecorder *rec, int id, uint64_t timestampNs, const void *values);
+
+//writes partial blocks and closes the file
+void seriesClose(SeriesRecorder *rec);
+
+typedef struct {
+    int slave;
+    int fType;
+    int addr;
+    int nb;
+    int rows;
+    uint64_t *ts;//rows
+    uint16_t *values;//rows x nb, owned by the reader
+} SeriesBlock;
+
+typedef struct {
+    MbuMappedFile file;
+    size_t pos;
+    SeriesBlock block;
+    size_t capacity;//of block.values
+} SeriesReader;
+
+int seriesReaderOpen(SeriesReader *reader, const char path[]);
+
+//returns 1 if next block was decoded, 0 at the end of the file, -1 if the file is corrupted
+int seriesReaderNext(SeriesReader *reader, const SeriesBlock **block);
+
+void seriesReaderClose(SeriesReader *reader);
+
+#endif //MBU_SERIES_H
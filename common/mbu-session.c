@@ -0,0 +1,138 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <errno.h>
+
+#include "mbu-session.h"
+
+int mbuSessionOpen(MbuSession *session, MbuBackendParams *backend, int slave, int timeoutMs) {
+    session->backend = backend;
+    session->slave = slave;
+    session->connected = 0;
+    session->ctx = backend->createCtxt(backend);
+    if (0 == session->ctx) {
+        return 0;
+    }
+
+    modbus_set_slave(session->ctx, slave);
+    modbus_set_response_timeout(session->ctx, timeoutMs / 1000, (timeoutMs % 1000) * 1000);
+    if (-1 == backend->connectCtxt(backend, session->ctx)) {
+        mbuSessionClose(session);
+        return 0;
+    }
+    session->connected = 1;
+
+    return 1;
+}
+
+int mbuExecuteRequest(modbus_t *ctx, const MbuRequest *request) {
+    switch (request->fType) {
+    case MbuReadCoils:
+        return modbus_read_bits(ctx, request->addr, request->nb, (uint8_t*)request->data);
+    case MbuReadDiscreteInput:
+        return modbus_read_input_bits(ctx, request->addr, request->nb, (uint8_t*)request->data);
+    case MbuReadHoldingRegisters:
+        return modbus_read_registers(ctx, request->addr, request->nb, (uint16_t*)request->data);
+    case MbuReadInputRegisters:
+        return modbus_read_input_registers(ctx, request->addr, request->nb, (uint16_t*)request->data);
+    case MbuWriteSingleCoil:
+        return modbus_write_bit(ctx, request->addr, *(const uint8_t*)request->data);
+    case MbuWriteSingleRegister:
+        return modbus_write_register(ctx, request->addr, *(const uint16_t*)request->data);
+    case MbuWriteMultipleCoils:
+        return modbus_write_bits(ctx, request->addr, request->nb, (const uint8_t*)request->data);
+    case MbuWriteMultipleRegisters:
+        return modbus_write_registers(ctx, request->addr, request->nb, (const uint16_t*)request->data);
+    case MbuMaskWriteRegister:
+        return modbus_mask_write_register(ctx, request->addr, ((const uint16_t*)request->data)[0],
+                                          ((const uint16_t*)request->data)[1]);
+    case MbuWriteAndReadRegisters:
+        return modbus_write_and_read_registers(ctx, request->addr, request->nb, (const uint16_t*)request->data,
+                                               request->readAddr, request->readNb, request->readData);
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+//failures after which the connection is not usable any more (as opposed to timeouts or exceptions)
+static int isLinkError(int error) {
+    return (ECONNRESET == error || EPIPE == error || EBADF == error || ENOTCONN == error
+            || ECONNREFUSED == error);
+}
+
+static int reconnect(MbuSession *session) {
+    modbus_close(session->ctx);
+    session->backend->closeConnection(session->backend);
+    session->connected = (0 == session->backend->connectCtxt(session->backend, session->ctx));
+    return session->connected;
+}
+
+int mbuSessionExecute(MbuSession *session, MbuRequest requests[], int count) {
+    int okNo = 0;
+    int reconnected = 0;
+    int i;
+
+    if (0 == session->connected && 0 == reconnect(session)) {
+        for (i = 0; i < count; ++i) {
+            requests[i].result = -1;
+            requests[i].error = errno;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < count; ++i) {
+        MbuRequest *r = &requests[i];
+        int slave = (-1 == r->slave) ? session->slave : r->slave;
+
+        modbus_set_slave(session->ctx, slave);
+        r->result = mbuExecuteRequest(session->ctx, r);
+        r->error = (-1 == r->result) ? errno : 0;
+
+        if (-1 == r->result && isLinkError(r->error) && 0 == reconnected) {
+            reconnected = 1;
+            if (reconnect(session)) {
+                modbus_set_slave(session->ctx, slave);
+                r->result = mbuExecuteRequest(session->ctx, r);
+                r->error = (-1 == r->result) ? errno : 0;
+            }
+        }
+
+        if (-1 != r->result)
+            okNo++;
+    }
+
+    return okNo;
+}
+
+void mbuSessionClose(MbuSession *session) {
+    if (0 != session->ctx) {
+        if (session->connected)
+            modbus_close(session->ctx);
+        session->backend->closeConnection(session->backend);
+        modbus_free(session->ctx);
+        session->ctx = 0;
+    }
+    session->connected = 0;
+}
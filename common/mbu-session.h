@@ -0,0 +1,84 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_SESSION_H
+#define MBU_SESSION_H
+
+/*
+ * In-process polling: a session keeps the connection open between calls and
+ * executes batches of requests into buffers owned by the caller, so steady
+ * state polling allocates nothing.
+ */
+
+#include "mbu-common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    MbuBackendParams *backend;//not owned
+    modbus_t *ctx;
+    int slave;
+    int connected;
+} MbuSession;
+
+typedef struct {
+    MbuFuncType fType;
+    int slave;//-1 for session default
+    int addr;
+    int nb;
+    //caller owned: uint8_t[nb] for coils/discrete inputs, uint16_t[nb] for registers,
+    //single writes take data[0] of the matching type, mask write uint16_t[2] (and, or)
+    void *data;
+
+    //filled in by mbuSessionExecute()
+    int result;//elements read/written, -1 on failure
+    int error;//errno of the failure
+
+    //read part of 0x17 (data are written first)
+    int readAddr;
+    int readNb;
+    uint16_t *readData;
+} MbuRequest;
+
+//creates the context and connects it; returns 1 on success, on failure the session is closed
+int mbuSessionOpen(MbuSession *session, MbuBackendParams *backend, int slave, int timeoutMs);
+
+/*
+ * Executes requests in order. A broken connection is re-established once per batch
+ * and the failed request repeated. Returns number of successful requests.
+ */
+int mbuSessionExecute(MbuSession *session, MbuRequest requests[], int count);
+
+void mbuSessionClose(MbuSession *session);
+
+//executes single request on a connected context, returns as libmodbus functions do
+int mbuExecuteRequest(modbus_t *ctx, const MbuRequest *request);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MBU_SESSION_H
@@ -0,0 +1,301 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "mbu-trace.h"
+
+static unsigned traceGenerations = 0;
+
+//ring of the calling thread, valid while threadGeneration matches the tracer
+static __thread TraceRing *threadRing = 0;
+static __thread unsigned threadGeneration = 0;
+
+static int writeAll(int fd, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            if (EINTR == errno)
+                continue;
+            return 0;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 1;
+}
+
+//copies ready records of all rings to the file, returns number of records written
+static int drainRings(Tracer *tracer) {
+    TraceRing *ring;
+    int drained = 0;
+
+    for (ring = __atomic_load_n(&tracer->rings, __ATOMIC_ACQUIRE); 0 != ring; ring = ring->next) {
+        uint32_t tail = ring->tail;
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        while (tail != head) {
+            uint32_t first = tail & (TRACE_RING_RECORDS - 1);
+            uint32_t n = head - tail;
+            //contiguous part up to the end of the ring
+            if (first + n > TRACE_RING_RECORDS)
+                n = TRACE_RING_RECORDS - first;
+            if (0 == writeAll(tracer->fd, &ring->records[first], n * sizeof(TraceRecord))) {
+                printf("Trace: write failed (%s)\n", strerror(errno));
+            }
+            tail += n;
+            drained += n;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return drained;
+}
+
+static void *traceDrainThread(void *arg) {
+    Tracer *tracer = (Tracer*)arg;
+
+    pthread_mutex_lock(&tracer->lock);
+    while (0 == tracer->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TRACE_DRAIN_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&tracer->stopCond, &tracer->lock, &deadline);
+
+        pthread_mutex_unlock(&tracer->lock);
+        drainRings(tracer);
+        pthread_mutex_lock(&tracer->lock);
+    }
+    pthread_mutex_unlock(&tracer->lock);
+
+    drainRings(tracer);
+    return 0;
+}
+
+int traceOpen(Tracer *tracer, const char path[], int sampleEvery) {
+    uint8_t header[TRACE_HEADER_LENGTH];
+    uint64_t offset = mbuClockNs(CLOCK_REALTIME) - mbuClockNs(CLOCK_MONOTONIC);
+    uint32_t recordSize = sizeof(TraceRecord);
+
+    tracer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (-1 == tracer->fd) {
+        printf("Cannot open %s (%s)\n", path, strerror(errno));
+        return 0;
+    }
+
+    memcpy(header, TRACE_MAGIC, 8);
+    memcpy(header + 8, &offset, sizeof(offset));
+    memcpy(header + 16, &recordSize, sizeof(recordSize));
+    if (0 == writeAll(tracer->fd, header, sizeof(header))) {
+        printf("Cannot write %s (%s)\n", path, strerror(errno));
+        close(tracer->fd);
+        return 0;
+    }
+
+    tracer->generation = __atomic_add_fetch(&traceGenerations, 1, __ATOMIC_RELAXED);
+    tracer->sampleEvery = (sampleEvery > 0) ? sampleEvery : 1;
+    tracer->rings = 0;
+    tracer->ringsNo = 0;
+    tracer->stop = 0;
+    tracer->recordsNo = 0;
+    tracer->droppedNo = 0;
+    pthread_mutex_init(&tracer->lock, 0);
+    pthread_cond_init(&tracer->stopCond, 0);
+
+    if (0 != pthread_create(&tracer->drainer, 0, traceDrainThread, tracer)) {
+        printf("Cannot start trace thread\n");
+        close(tracer->fd);
+        return 0;
+    }
+
+    return 1;
+}
+
+void traceClose(Tracer *tracer) {
+    TraceRing *ring;
+
+    pthread_mutex_lock(&tracer->lock);
+    tracer->stop = 1;
+    pthread_cond_signal(&tracer->stopCond);
+    pthread_mutex_unlock(&tracer->lock);
+    pthread_join(tracer->drainer, 0);
+
+    close(tracer->fd);
+    if (0 != tracer->droppedNo)
+        printf("Trace: %llu records dropped, rings were full\n", (unsigned long long)tracer->droppedNo);
+    while (0 != (ring = tracer->rings)) {
+        tracer->rings = ring->next;
+        free(ring);
+    }
+    pthread_mutex_destroy(&tracer->lock);
+    pthread_cond_destroy(&tracer->stopCond);
+}
+
+static TraceRing *ringOfThread(Tracer *tracer) {
+    TraceRing *ring;
+
+    if (threadGeneration == tracer->generation)
+        return threadRing;
+
+    //first record of this thread: the ring is published to the drain thread once initialized
+    ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+    if (0 == ring)
+        return 0;
+    pthread_mutex_lock(&tracer->lock);
+    ring->id = tracer->ringsNo++;
+    ring->next = tracer->rings;
+    __atomic_store_n(&tracer->rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&tracer->lock);
+
+    threadRing = ring;
+    threadGeneration = tracer->generation;
+    return ring;
+}
+
+void traceRecord(Tracer *tracer, TraceDirection dir, int fd, int slave, int function, int addr, int count,
+                 uint64_t startNs, uint64_t endNs, int status) {
+    TraceRing *ring = ringOfThread(tracer);
+    TraceRecord *rec;
+    uint32_t head;
+
+    if (0 == ring)
+        return;
+    //sampling never hides failures
+    if (0 == status && 0 != (ring->sampleCounter++ % tracer->sampleEvery))
+        return;
+
+    head = ring->head;
+    ring->seq++;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_RECORDS) {
+        __atomic_add_fetch(&tracer->droppedNo, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec = &ring->records[head & (TRACE_RING_RECORDS - 1)];
+    rec->startNs = startNs;
+    rec->latencyUs = (uint32_t)((endNs - startNs) / 1000);
+    rec->fd = fd;
+    rec->seq = ring->seq;
+    rec->thread = ring->id;
+    rec->addr = (uint16_t)addr;
+    rec->count = (uint16_t)count;
+    rec->direction = (uint8_t)dir;
+    rec->slave = (uint8_t)slave;
+    rec->function = (uint8_t)function;
+    rec->exception = (status > 0) ? (uint8_t)status : 0;
+    rec->failed = (TRACE_FAILED == status);
+    rec->reserved = 0;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&tracer->recordsNo, 1, __ATOMIC_RELAXED);
+}
+
+void traceFrame(Tracer *tracer, TraceDirection dir, int fd, const uint8_t frame[], int len,
+                uint64_t startNs, uint64_t endNs, int status) {
+    int addr = 0, count = 0;
+
+    if (len < 2)
+        return;
+    if (len >= 6) {
+        switch (frame[1]) {
+        case MbuReadCoils:
+        case MbuReadDiscreteInput:
+        case MbuReadHoldingRegisters:
+        case MbuReadInputRegisters:
+        case MbuWriteMultipleCoils:
+        case MbuWriteMultipleRegisters:
+        case MbuWriteAndReadRegisters://read part
+            addr = (frame[2] << 8) | frame[3];
+            count = (frame[4] << 8) | frame[5];
+            break;
+        case MbuWriteSingleCoil:
+        case MbuWriteSingleRegister:
+        case MbuMaskWriteRegister:
+            addr = (frame[2] << 8) | frame[3];
+            count = 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    traceRecord(tracer, dir, fd, frame[0], frame[1], addr, count, startNs, endNs, status);
+}
+
+int traceStatus(int result, int error) {
+    if (-1 != result)
+        return 0;
+    if (error > MODBUS_ENOBASE && error <= EMBXGTAR)
+        return error - MODBUS_ENOBASE;
+    return TRACE_FAILED;
+}
+
+int traceReaderOpen(TraceReader *reader, const char path[]) {
+    uint32_t recordSize;
+
+    if (0 == mbuMapFile(path, &reader->file)) {
+        return 0;
+    }
+    if (reader->file.size < TRACE_HEADER_LENGTH || 0 != memcmp(reader->file.data, TRACE_MAGIC, 8)) {
+        printf("%s is not a trace file\n", path);
+        mbuUnmapFile(&reader->file);
+        return 0;
+    }
+    memcpy(&reader->realtimeOffsetNs, reader->file.data + 8, sizeof(reader->realtimeOffsetNs));
+    memcpy(&recordSize, reader->file.data + 16, sizeof(recordSize));
+    if (sizeof(TraceRecord) != recordSize) {
+        printf("%s has records of %u bytes, expected %zu\n", path, recordSize, sizeof(TraceRecord));
+        mbuUnmapFile(&reader->file);
+        return 0;
+    }
+    reader->pos = TRACE_HEADER_LENGTH;
+
+    return 1;
+}
+
+int traceReaderNext(TraceReader *reader, TraceRecord *record) {
+    size_t left = reader->file.size - reader->pos;
+
+    if (0 == left) {
+        return 0;
+    }
+    if (left < sizeof(TraceRecord)) {
+        return -1;
+    }
+    memcpy(record, reader->file.data + reader->pos, sizeof(TraceRecord));
+    reader->pos += sizeof(TraceRecord);
+
+    return 1;
+}
+
+void traceReaderClose(TraceReader *reader) {
+    mbuUnmapFile(&reader->file);
+}
@@ -0,0 +1,127 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_TRACE_H
+#define MBU_TRACE_H
+
+/*
+ * Binary request tracing, cheap enough to stay on in production (unlike modbus_set_debug()).
+ * Every thread writes fixed size records into its own ring without locking, a background
+ * thread drains the rings into the file. A full ring drops records instead of blocking,
+ * drops show up as gaps in the per-thread sequence numbers.
+ *
+ * File: "MBUTRC1\0", uint64 CLOCK_REALTIME - CLOCK_MONOTONIC offset [ns], uint32 record size,
+ *       then TraceRecords; all in host byte order (the file is read on the machine it was taken on).
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mbu-common.h"
+
+#define TRACE_MAGIC "MBUTRC1"
+#define TRACE_HEADER_LENGTH 20
+#define TRACE_RING_RECORDS 8192 //power of 2, 256kB per thread
+#define TRACE_DRAIN_MS 10
+
+typedef enum {
+    TraceServed = 0,//request received and answered by this process
+    TraceIssued = 1//request sent by this process
+} TraceDirection;
+
+#define TRACE_FAILED -1 //no valid answer (timeout, connection or crc error)
+#define TRACE_EXCEPTION_UNKNOWN 0xff //exception response with the code not known to the tracer
+
+typedef struct {
+    uint64_t startNs;//CLOCK_MONOTONIC
+    uint32_t latencyUs;
+    int32_t fd;
+    uint32_t seq;//per thread
+    uint16_t thread;
+    uint16_t addr;
+    uint16_t count;
+    uint8_t direction;
+    uint8_t slave;
+    uint8_t function;
+    uint8_t exception;//0 - normal response
+    uint8_t failed;
+    uint8_t reserved;
+} TraceRecord;
+
+typedef struct TraceRing {
+    TraceRecord records[TRACE_RING_RECORDS];
+    uint32_t head;//written by the owning thread only
+    uint32_t tail;//written by the drain thread only
+    uint32_t seq;
+    uint32_t sampleCounter;
+    uint16_t id;
+    struct TraceRing *next;
+} TraceRing;
+
+typedef struct {
+    int fd;
+    unsigned generation;
+    int sampleEvery;//1 - every request; failures and exceptions are always traced
+    TraceRing *rings;
+    uint16_t ringsNo;
+    pthread_mutex_t lock;
+    pthread_cond_t stopCond;
+    pthread_t drainer;
+    int stop;
+
+    uint64_t recordsNo;
+    uint64_t droppedNo;
+} Tracer;
+
+//creates (truncates) the trace file and starts the drain thread, returns 1 on success
+int traceOpen(Tracer *tracer, const char path[], int sampleEvery);
+
+//drains what is left and closes the file; threads must not trace any more
+void traceClose(Tracer *tracer);
+
+//status: 0 - normal response, 1-255 - exception code, TRACE_FAILED
+void traceRecord(Tracer *tracer, TraceDirection dir, int fd, int slave, int function, int addr, int count,
+                 uint64_t startNs, uint64_t endNs, int status);
+
+//as above, with slave, function, address and count taken from the request frame (slave id + PDU)
+void traceFrame(Tracer *tracer, TraceDirection dir, int fd, const uint8_t frame[], int len,
+                uint64_t startNs, uint64_t endNs, int status);
+
+//status of a libmodbus call which returned result and set errno to error
+int traceStatus(int result, int error);
+
+typedef struct {
+    MbuMappedFile file;
+    size_t pos;
+    uint64_t realtimeOffsetNs;
+} TraceReader;
+
+int traceReaderOpen(TraceReader *reader, const char path[]);
+
+//returns 1 if next record was read, 0 at the end of the trace, -1 if the trace is truncated
+int traceReaderNext(TraceReader *reader, TraceRecord *record);
+
+void traceReaderClose(TraceReader *reader);
+
+#endif //MBU_TRACE_H
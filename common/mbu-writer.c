@@ -0,0 +1,171 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "mbu-writer.h"
+
+static void *asyncWriterThread(void *arg) {
+    AsyncWriter *w = (AsyncWriter*)arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        //buffered data doesn't wait longer than ASYNC_WRITER_FLUSH_MS to get to the file
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += ASYNC_WRITER_FLUSH_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        while (0 == w->stop && 0 == w->flush && w->frontLen < w->capacity / 2) {
+            if (ETIMEDOUT == pthread_cond_timedwait(&w->dataReady, &w->lock, &deadline))
+                break;
+        }
+        w->flush = 0;
+        if (0 == w->frontLen) {
+            if (0 != w->stop)
+                break;
+            continue;
+        }
+
+        //swap buffers, so producers can continue while data is written
+        uint8_t *toWrite = w->front;
+        size_t len = w->frontLen;
+        w->front = w->back;
+        w->back = toWrite;
+        w->frontLen = 0;
+        pthread_cond_broadcast(&w->spaceReady);
+        pthread_mutex_unlock(&w->lock);
+
+        size_t written = 0;
+        while (written < len) {
+            ssize_t ret = write(w->fd, toWrite + written, len - written);
+            if (ret < 0) {
+                if (EINTR == errno)
+                    continue;
+                printf("Writer: write failed (%s), %zu bytes lost\n", strerror(errno), len - written);
+                break;
+            }
+            written += ret;
+        }
+
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return 0;
+}
+
+int asyncWriterOpen(AsyncWriter *w, const char path[], size_t capacity) {
+    w->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (-1 == w->fd) {
+        printf("Cannot open %s (%s)\n", path, strerror(errno));
+        return 0;
+    }
+
+    w->front = (uint8_t*)malloc(capacity);
+    w->back = (uint8_t*)malloc(capacity);
+    if (0 == w->front || 0 == w->back) {
+        printf("Cannot allocate %zu bytes of write buffers for %s\n", 2 * capacity, path);
+        close(w->fd);
+        free(w->front);
+        free(w->back);
+        return 0;
+    }
+    w->frontLen = 0;
+    w->capacity = capacity;
+    w->flush = 0;
+    w->stop = 0;
+    pthread_mutex_init(&w->lock, 0);
+    pthread_cond_init(&w->dataReady, 0);
+    pthread_cond_init(&w->spaceReady, 0);
+
+    if (0 != pthread_create(&w->thread, 0, asyncWriterThread, w)) {
+        printf("Cannot start writer thread\n");
+        close(w->fd);
+        free(w->front);
+        free(w->back);
+        return 0;
+    }
+
+    return 1;
+}
+
+off_t asyncWriterFileSize(AsyncWriter *w) {
+    struct stat st;
+    if (-1 == fstat(w->fd, &st))
+        return 0;
+    return st.st_size;
+}
+
+int asyncWriterAppend(AsyncWriter *w, const void *data, size_t len) {
+    if (len > w->capacity) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    while (w->frontLen + len > w->capacity) {
+        pthread_cond_signal(&w->dataReady);
+        pthread_cond_wait(&w->spaceReady, &w->lock);
+    }
+    memcpy(w->front + w->frontLen, data, len);
+    w->frontLen += len;
+    //wake the thread once there is something substantial to write
+    if (w->frontLen >= w->capacity / 2)
+        pthread_cond_signal(&w->dataReady);
+    pthread_mutex_unlock(&w->lock);
+
+    return 1;
+}
+
+void asyncWriterFlush(AsyncWriter *w) {
+    pthread_mutex_lock(&w->lock);
+    if (0 < w->frontLen) {
+        w->flush = 1;
+        pthread_cond_signal(&w->dataReady);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+void asyncWriterClose(AsyncWriter *w) {
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_signal(&w->dataReady);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, 0);
+
+    close(w->fd);
+    free(w->front);
+    free(w->back);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->dataReady);
+    pthread_cond_destroy(&w->spaceReady);
+}
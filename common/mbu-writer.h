@@ -0,0 +1,70 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+#ifndef MBU_WRITER_H
+#define MBU_WRITER_H
+
+/*
+ * Append-only file writer: producers copy records into an in-memory buffer,
+ * a background thread writes filled buffers to the file (double buffering),
+ * so the request path never waits for disk i/o unless the buffer overflows.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define ASYNC_WRITER_FLUSH_MS 500
+
+typedef struct {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t dataReady;
+    pthread_cond_t spaceReady;
+
+    uint8_t *front;//filled by producers
+    uint8_t *back;//written out by the thread
+    size_t frontLen;
+    size_t capacity;
+    int flush;//front is to be written out before it fills up
+    int stop;
+} AsyncWriter;
+
+//opens (creates or appends to) the file and starts the writer thread, returns 1 on success
+int asyncWriterOpen(AsyncWriter *w, const char path[], size_t capacity);
+
+//returns current size of the underlying file
+off_t asyncWriterFileSize(AsyncWriter *w);
+
+//copies len bytes into the buffer; blocks only if the record doesn't fit until the thread frees the buffer
+int asyncWriterAppend(AsyncWriter *w, const void *data, size_t len);
+
+//hands whatever is buffered over to the writer thread
+void asyncWriterFlush(AsyncWriter *w);
+
+//writes remaining data, stops the thread and closes the file
+void asyncWriterClose(AsyncWriter *w);
+
+#endif //MBU_WRITER_H
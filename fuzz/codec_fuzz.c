@@ -0,0 +1,72 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+/*
+ * libFuzzer harness of the frame codec (cmake -DMBU_FUZZ=ON with clang):
+ * arbitrary bytes are parsed as rtu requests, rtu responses and tcp ADUs; a parsed
+ * frame has to lie within the input and encode back to the same bytes, and slicing
+ * CRC has to agree with the bytewise one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mbu-codec.h"
+
+static void checkRtu(const uint8_t *data, size_t size, int isRequest) {
+    uint8_t adu[CODEC_RTU_MAX_ADU_LENGTH + 2];
+    CodecFrame frame;
+    int rc = codecParseRtu(data, (int)size, isRequest, &frame);
+
+    if (CodecOk != rc)
+        return;
+    if (frame.frame != data || frame.aduLen > (int)size || frame.len != frame.aduLen - 2)
+        abort();
+    if (frame.aduLen != codecEncodeRtu(adu, frame.frame, frame.len) || 0 != memcmp(adu, data, frame.aduLen))
+        abort();
+}
+
+static void checkTcp(const uint8_t *data, size_t size) {
+    uint8_t adu[CODEC_TCP_MAX_ADU_LENGTH];
+    CodecFrame frame;
+    int rc = codecParseTcp(data, (int)size, &frame);
+
+    if (CodecOk != rc)
+        return;
+    if (frame.frame != data + MBU_MBAP_HEADER_LENGTH || frame.aduLen > (int)size || frame.len < 2)
+        abort();
+    if (frame.aduLen != codecEncodeTcp(adu, frame.transactionId, frame.frame, frame.len)
+            || 0 != memcmp(adu, data, frame.aduLen))
+        abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (codecCrc16(data, size) != codecCrc16Bytewise(data, size))
+        abort();
+    checkRtu(data, size, 1);
+    checkRtu(data, size, 0);
+    checkTcp(data, size);
+    return 0;
+}
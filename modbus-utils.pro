@@ -2,4 +2,7 @@ TEMPLATE = subdirs
 
 SUBDIRS += modbus_client \
         modbus_server \
+        modbus_tsdump \
+        modbus_tracedump \
+        modbus_broker \
         modbus_threaded_server
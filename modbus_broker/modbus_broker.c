@@ -0,0 +1,322 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+/*
+ * Keeps tcp sessions to modbus devices open and shares them among clients connecting
+ * over a unix socket (modbus_client --broker), see mbu-broker.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mbu-common.h"
+#include "mbu-codec.h"
+#include "mbu-broker.h"
+
+#define NB_CONNECTION 128
+
+const char SessionsOpt[] = "sessions";
+const char DepthOpt[] = "depth";
+const char TimeoutOpt[] = "timeout";
+const char IdleOpt[] = "idle";
+
+static Broker broker;
+static int server_socket = -1;
+static volatile sig_atomic_t statsRequested = 0;
+static volatile sig_atomic_t stopSignal = 0;
+static BrokerTarget *clientTargets[FD_SETSIZE];//NULL until the client says hello
+static CodecStream clientStreams[FD_SETSIZE];
+
+static void request_stats(int dummy)
+{
+    (void)dummy;
+    statsRequested = 1;
+}
+
+/* Stopping locks targets and joins workers, so the loop does it, not the handler */
+static void request_stop(int sig)
+{
+    stopSignal = sig;
+}
+
+static void close_broker(int status)
+{
+    if (server_socket != -1) {
+        close(server_socket);
+    }
+    brokerPrintStats(&broker, stdout);
+    brokerStop(&broker);
+
+    exit(status);
+}
+
+void printUsage(const char progName[]) {
+    printf("%s [--%s=<n>=1] [--%s=<n>=1] [--%s=<ms>=%d] [--%s=<s>=%d] socket-path\n", progName,
+           SessionsOpt, DepthOpt, TimeoutOpt, BROKER_DEFAULT_TIMEOUT_MS, IdleOpt, BROKER_DEFAULT_IDLE_S);
+    printf("NOTE: clients (modbus_client -mtcp --broker=socket-path ...) name their target device, the broker keeps\n" \
+           "\t--%s (at most %d) tcp connections to each target and sends requests of all its clients over them\n",
+           SessionsOpt, BROKER_MAX_SESSIONS);
+    printf("NOTE: --%s requests (at most %d) are sent on a session before waiting for answers, 1 serializes them;\n" \
+           "\tonly devices handling several transactions at once should get more\n", DepthOpt, BROKER_MAX_DEPTH);
+    printf("NOTE: requests not answered within --%s get exception 0x0B, ones that cannot be sent 0x0A;\n" \
+           "\tsessions unused for --%s are closed; statistics are printed on SIGUSR1 and on exit\n",
+           TimeoutOpt, IdleOpt);
+}
+
+//listening unix socket, file left by previous instance is removed
+static int listenUnix(const char path[])
+{
+    struct sockaddr_un addr;
+    int s;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == s)
+        return -1;
+    unlink(path);
+    if (-1 == bind(s, (struct sockaddr*)&addr, sizeof(addr)) || -1 == listen(s, NB_CONNECTION)) {
+        printf("Cannot listen on %s (%s)\n", path, strerror(errno));
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+//takes the hello of a new client from its stream, returns 0 if the client is to be closed
+static int takeHello(int fd, CodecStream *stream)
+{
+    BrokerHello hello;
+
+    memcpy(&hello, stream->buf + stream->start, sizeof(hello));
+    stream->start += sizeof(hello);
+    if (0 != memcmp(hello.magic, BROKER_MAGIC, sizeof(hello.magic))) {
+        printf("Client on socket %d is not a broker client\n", fd);
+        return 0;
+    }
+    hello.target[sizeof(hello.target) - 1] = '\0';
+    clientTargets[fd] = brokerTarget(&broker, hello.target);
+    return (NULL != clientTargets[fd]);
+}
+
+/*
+ * Hello and ADUs are put together from reads that do not block, so a client sending
+ * a part of them does not hold up the others; returns 0 if the client is to be closed
+ */
+static int serveClient(int fd)
+{
+    CodecStream *stream = &clientStreams[fd];
+    const uint8_t *adu;
+    int len;
+
+    if (0 == codecStreamFill(stream, fd))
+        return 0;
+    if (NULL == clientTargets[fd]) {
+        if (stream->len - stream->start < (int)sizeof(BrokerHello))
+            return 1;//the rest of the hello is yet to come
+        if (0 == takeHello(fd, stream))
+            return 0;
+    }
+    while ((len = codecStreamNext(stream, &adu)) > 0)
+        brokerSubmit(clientTargets[fd], fd, adu, len);
+    if (CodecInvalid == len) {
+        printf("Client on socket %d does not speak modbus tcp\n", fd);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int ok;
+    int rc;
+
+    int sessionsNo = 1;
+    int depth = 1;
+    int timeoutMs = BROKER_DEFAULT_TIMEOUT_MS;
+    int idleS = BROKER_DEFAULT_IDLE_S;
+    int master_socket;
+    fd_set refset;
+    fd_set rdset;
+    int fdmax;
+    sigset_t stopSignals;
+    sigset_t waitMask;//SIGINT and SIGTERM are let in only while waiting
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {SessionsOpt, required_argument, 0, 0},
+            {DepthOpt, required_argument, 0, 0},
+            {TimeoutOpt, required_argument, 0, 0},
+            {IdleOpt, required_argument, 0, 0},
+            {0, 0,  0,  0}
+        };
+
+        c = getopt_long(argc, argv, "", long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 0:
+            if (0 == strcmp(long_options[option_index].name, SessionsOpt)) {
+                sessionsNo = mbuGetInt(optarg, &ok);
+                if (0 == ok || sessionsNo < 1 || sessionsNo > BROKER_MAX_SESSIONS) {
+                    printf("Sessions number (%s) should be 1-%d\n", optarg, BROKER_MAX_SESSIONS);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, DepthOpt)) {
+                depth = mbuGetInt(optarg, &ok);
+                if (0 == ok || depth < 1 || depth > BROKER_MAX_DEPTH) {
+                    printf("Pipeline depth (%s) should be 1-%d\n", optarg, BROKER_MAX_DEPTH);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, TimeoutOpt)) {
+                timeoutMs = mbuGetInt(optarg, &ok);
+                if (0 == ok || timeoutMs < 1) {
+                    printf("Timeout (%s) should be a positive number of ms\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, IdleOpt)) {
+                idleS = mbuGetInt(optarg, &ok);
+                if (0 == ok || idleS < 1) {
+                    printf("Idle time (%s) should be a positive number of seconds\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            break;
+
+        case '?':
+            break;
+
+        default:
+            printf("?? getopt returned character code 0%o ??\n", c);
+        }
+    }
+
+    if (1 != argc - optind) {
+        printf("Expecting only socket-path as free parameter!\n");
+        printUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 == brokerInit(&broker, sessionsNo, depth, timeoutMs, idleS)) {
+        exit(EXIT_FAILURE);
+    }
+    server_socket = listenUnix(argv[optind]);
+    if (server_socket == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+    signal(SIGUSR1, request_stats);
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stopSignals, &waitMask);
+
+    FD_ZERO(&refset);
+    FD_SET(server_socket, &refset);
+    /* Session workers tell about answered requests through the pipe */
+    FD_SET(broker.wakePipe[0], &refset);
+    fdmax = (server_socket > broker.wakePipe[0]) ? server_socket : broker.wakePipe[0];
+
+    for (;;) {
+        rdset = refset;
+        rc = pselect(fdmax+1, &rdset, NULL, NULL, NULL, &waitMask);
+        if (stopSignal) {
+            close_broker(stopSignal);
+        }
+        if (rc == -1 && errno != EINTR) {
+            perror("Broker select() failure.");
+            close_broker(1);
+        }
+        if (statsRequested) {
+            statsRequested = 0;
+            brokerPrintStats(&broker, stdout);
+        }
+        if (rc <= 0) {
+            continue;
+        }
+
+        for (master_socket = 0; master_socket <= fdmax; master_socket++) {
+            if (!FD_ISSET(master_socket, &rdset)) {
+                continue;
+            }
+
+            if (master_socket == broker.wakePipe[0]) {
+                brokerDeliver(&broker);
+            } else if (master_socket == server_socket) {
+                int newfd = accept(server_socket, NULL, NULL);
+                if (newfd == -1) {
+                    perror("Broker accept() error");
+                } else if (newfd >= FD_SETSIZE) {
+                    printf("Too many clients, socket %d is closed\n", newfd);
+                    close(newfd);
+                } else {
+                    FD_SET(newfd, &refset);
+                    clientTargets[newfd] = NULL;
+                    codecStreamReset(&clientStreams[newfd]);
+                    if (newfd > fdmax) {
+                        fdmax = newfd;
+                    }
+                }
+            } else {
+                if (0 == serveClient(master_socket)) {
+                    brokerDrop(&broker, master_socket);
+                    clientTargets[master_socket] = NULL;
+                    close(master_socket);
+                    FD_CLR(master_socket, &refset);
+                    if (master_socket == fdmax) {
+                        fdmax--;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
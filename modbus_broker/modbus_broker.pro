@@ -0,0 +1,19 @@
+######################################################################
+# Automatically generated by qmake (2.01a) Wed Jul 10 03:22:43 2013
+######################################################################
+
+TEMPLATE = app
+TARGET = mbBroker
+DESTDIR = ../
+DEPENDPATH += .
+INCLUDEPATH += .
+
+# Input
+SOURCES += modbus_broker.c \
+    $$files(../common/*.c)
+
+INCLUDEPATH += ../libmodbus/src \
+    ../common
+
+LIBS += -L../libmodbus/src/.libs
+LIBS += -lmodbus -pthread -lm
@@ -27,63 +27,514 @@
 #include <getopt.h>
 #include <string.h>
 #include <stdint.h>
+#include <signal.h>
 
 #include <modbus.h>
 #include "errno.h"
 
 #include "mbu-common.h"
+#include "mbu-capture.h"
+#include "mbu-bulk.h"
+#include "mbu-poll.h"
+#include "mbu-rbe.h"
+#include "mbu-series.h"
+#include "mbu-trace.h"
+#include "mbu-discover.h"
+#include "mbu-decode.h"
+#include "mbu-broker.h"
 
 const char DebugOpt[]   = "debug";
 const char TcpOptVal[]  = "tcp";
 const char RtuOptVal[]  = "rtu";
+const char UnixOptVal[] = "unix";
+const char UdpOptVal[]  = "udp";
+const char CaptureOpt[] = "capture";
+const char ReplayOpt[] = "replay";
+const char ReplaySpeedOpt[] = "replay-speed";
+const char WriteFileOpt[] = "write-file";
+const char WriteFormatOpt[] = "write-format";
+const char PipelineOpt[] = "pipeline";
+const char SlavesOpt[] = "slaves";
+const char CyclesOpt[] = "cycles";
+const char TurnaroundOpt[] = "turnaround";
+const char RtoMinOpt[] = "rto-min";
+const char RetriesOpt[] = "retries";
+const char DownAfterOpt[] = "down-after";
+const char ProbeOpt[] = "probe-interval";
+const char RbeOpt[] = "rbe";
+const char DeadbandOpt[] = "deadband";
+const char DeadbandFileOpt[] = "deadband-file";
+const char RecordOpt[] = "record";
+const char ReadAddrOpt[] = "read-addr";
+const char TraceOpt[] = "trace";
+const char TraceSampleOpt[] = "trace-sample";
+const char DiscoverOpt[] = "discover";
+const char BaudsOpt[] = "bauds";
+const char ParitiesOpt[] = "parities";
+const char TypeOpt[] = "type";
+const char FormatOpt[] = "format";
+const char BrokerOpt[] = "broker";
 
-typedef enum {
-    FuncNone =          -1,
-
-    ReadCoils           = 0x01,
-    ReadDiscreteInput   = 0x02,
-    ReadHoldingRegisters= 0x03,
-    ReadInputRegisters  = 0x04,
-    WriteSingleCoil     = 0x05,
-    WriteSingleRegister = 0x06,
-    WriteMultipleCoils  = 0x0f,
-    WriteMultipleRegisters  = 0x10
-} FuncType;
+#define DEFAULT_TURNAROUND_MS 20
+#define MAX_SLAVES 247
+#define DEFAULT_RETRIES 1
+#define DEFAULT_DOWN_AFTER 3
+#define DEFAULT_PROBE_INTERVAL_MS 5000
+#define DEFAULT_BAUDS "9600,19200,38400,57600,115200"
+#define DEFAULT_PARITIES "ENO"
+#define MAX_BAUDS 16
+#define MAX_DISCOVER_PORTS 16
 
 void printUsage(const char progName[]) {
-    printf("%s [--%s] [-m {rtu|tcp}] [-a<slave-addr=1>] [-c<read-no>=1]\n\t" \
-           "[-r<start-addr>=100] [-t<f-type>] [-o<timeout-ms>=1000] [{rtu-params|tcp-params}] serialport|host [<write-data>]\n", progName, DebugOpt);
+    printf("%s [--%s] [-m {rtu|tcp|unix|udp}] [-a<slave-addr=1>] [-c<read-no>=1]\n\t" \
+           "[-r<start-addr>=100] [-t<f-type>] [-o<timeout-ms>=1000] [{rtu-params|tcp-params|udp-params}] serialport|host|socket-path [<write-data>]\n\t" \
+           "[--%s=<read-start-addr>=start-addr]\n\t" \
+           "[--%s=<capture-file>] [--%s=<capture-file> [--%s=<factor>|max=1]]\n\t" \
+           "[--%s=<file>|- [--%s={bin|text}=bin] [--%s=<requests-in-flight>=%d]]\n\t" \
+           "[--%s=<addr>[-<addr>][,...] [--%s=<n>|0=1] [--%s=<ms>=%d]\n\t" \
+           " [--%s=<ms>=0] [--%s=<n>=%d] [--%s=<n>=%d] [--%s=<ms>=%d]\n\t" \
+           " [--%s [--%s=<abs>[:<percent>]] [--%s=<csv-file>]] [--%s=<file>]]\n\t" \
+           "[--%s=<trace-file> [--%s=<n>=1]]\n\t" \
+           "[--%s [--%s=<baud>[,...]=%s] [--%s=<E|N|O...>=%s]]\n\t" \
+           "[--%s=<type>[:<order>]=raw] [--%s={text|csv|jsonl|bin}=text]\n\t" \
+           "[--%s=<socket-path>]\n",
+           progName, DebugOpt, ReadAddrOpt, CaptureOpt, ReplayOpt, ReplaySpeedOpt, WriteFileOpt, WriteFormatOpt, PipelineOpt, BULK_DEFAULT_WINDOW,
+           SlavesOpt, CyclesOpt, TurnaroundOpt, DEFAULT_TURNAROUND_MS,
+           RtoMinOpt, RetriesOpt, DEFAULT_RETRIES, DownAfterOpt, DEFAULT_DOWN_AFTER, ProbeOpt, DEFAULT_PROBE_INTERVAL_MS,
+           RbeOpt, DeadbandOpt, DeadbandFileOpt, RecordOpt, TraceOpt, TraceSampleOpt,
+           DiscoverOpt, BaudsOpt, DEFAULT_BAUDS, ParitiesOpt, DEFAULT_PARITIES, TypeOpt, FormatOpt,
+           BrokerOpt);
+    printf("NOTE: with --%s requests from the capture file are sent instead of -t request\n", ReplayOpt);
+    printf("NOTE: --%s takes (0x0F, 0x10) write data from file or stdin instead of command line, as big-endian words/LSB first\n" \
+           "\tpacked coils (bin) or dec/hex numbers (text); it is split into maximal requests, pipelined over tcp\n", WriteFileOpt);
+    printf("NOTE: --%s polls (rtu only) the same read request from all the slaves, --%s times (0 - forever);\n" \
+           "\tframe gaps follow from line settings, the first timeout also from slave turnaround; timeouts adapt to\n" \
+           "\tmeasured response times of each slave within --%s and -o, a timed out request is retried --%s times\n" \
+           "\twith doubled timeout; a slave failing --%s requests in a row is only probed every --%s\n",
+           SlavesOpt, CyclesOpt, RtoMinOpt, RetriesOpt, DownAfterOpt, ProbeOpt);
+    printf("NOTE: with --%s polled values are printed only when they change by more than deadband, with the poll\n" \
+           "\ttime; --%s lines are address,absolute[,percent] for single registers, errors are printed when they change\n",
+           RbeOpt, DeadbandFileOpt);
+    printf("NOTE: --%s stores polled values in a compressed file instead of printing them, export it with modbus_tsdump\n",
+           RecordOpt);
+    printf("NOTE: --%s writes binary records of requests (time, function, address, count, latency, exception)\n" \
+           "\tat negligible cost, every --%s-th successful one; failures are always traced; read it with modbus_tracedump\n",
+           TraceOpt, TraceSampleOpt);
+    printf("NOTE: --%s (rtu only) probes --%s addresses (all by default) with the -t read request at every --%s and\n" \
+           "\t--%s setting on all the serial ports given, in parallel; timeouts follow from the line timing and --%s;\n" \
+           "\tany answer, also an exception, means a slave; prints port,baud,line,address,{ok|exception:<code>},ms\n",
+           DiscoverOpt, SlavesOpt, BaudsOpt, ParitiesOpt, TurnaroundOpt);
+    printf("NOTE: --%s decodes read registers as {uint16|int16|uint32|int32|uint64|int64|float32|float64} with word order\n" \
+           "\t{abcd|cdab|badc|dcba}=abcd (A - most significant byte); --%s prints read and polled values as text,\n" \
+           "\tcsv (<timestamp>,<slave>,<function>,<address>,<values>...), json lines or binary rows (see mbu-decode.h)\n",
+           TypeOpt, FormatOpt);
+    printf("NOTE: with --%s (tcp only) the request goes through modbus_broker listening on the socket, which keeps\n" \
+           "\tthe connection to the device open and shares it with other clients\n", BrokerOpt);
     printf("NOTE: if first reference address starts at 0, set -0\n");
     printf("f-type:\n" \
            "\t(0x01) Read Coils, (0x02) Read Discrete Inputs, (0x05) Write Single Coil\n" \
            "\t(0x03) Read Holding Registers, (0x04) Read Input Registers, (0x06) WriteSingle Register\n" \
-           "\t(0x0F) WriteMultipleCoils, (0x10) Write Multiple register\n");
+           "\t(0x0F) WriteMultipleCoils, (0x10) Write Multiple register\n" \
+           "\t(0x16) Mask Write Register - write data are <and-mask> <or-mask>\n" \
+           "\t(0x17) Write and Read Registers - writes write data at start-addr, then reads read-no registers\n" \
+           "\t       from --%s in one transaction\n", ReadAddrOpt);
     printf("rtu-params:\n" \
            "\tb<baud-rate>=9600\n" \
            "\td{7|8}<data-bits>=8\n" \
            "\ts{1|2}<stop-bits>=1\n" \
            "\tp{none|even|odd}=even\n");
-    printf("tcp-params:\n" \
+    printf("tcp-params, udp-params:\n" \
            "\tp<port>=502\n");
     printf("Examples (run with default mbServer at port 1502): \n" \
            "\tWrite data: \t%s --debug -mtcp -t0x10 -r0 -p1502 127.0.0.1 0x01 0x02 0x03\n" \
-           "\tRead that data:\t%s --debug -mtcp -t0x03 -r0 -p1502 127.0.0.1 -c3\n", progName, progName);
+           "\tRead that data:\t%s --debug -mtcp -t0x03 -r0 -p1502 127.0.0.1 -c3\n" \
+           "\tReplay traffic at double speed:\t%s -mtcp -p1502 --%s=traffic.cap --%s=2 127.0.0.1\n" \
+           "\tSet bit 0, clear bit 1 of register 0:\t%s -mtcp -t0x16 -r0 -p1502 127.0.0.1 0xfffc 0x0001\n" \
+           "\tWrite 2 registers, read 4 back:\t%s -mtcp -t0x17 -r0 --%s=0 -c4 -p1502 127.0.0.1 0x05 0x06\n" \
+           "\tWrite registers from stdin:\tseq 1 20000 | %s -mtcp -t0x10 -r0 -p1502 --%s=- --%s=text 127.0.0.1\n" \
+           "\tPoll rtu bus continuously:\t%s -mrtu -b9600 -t0x03 -r0 -c10 --%s=1-8,12 --%s=0 /dev/ttyUSB0\n" \
+           "\tFind slaves on two ports:\t%s -mrtu -t0x03 -r0 --%s --%s=5 /dev/ttyUSB0 /dev/ttyUSB1\n",
+           progName, progName, progName, ReplayOpt, ReplaySpeedOpt, progName, progName, ReadAddrOpt,
+           progName, WriteFileOpt, WriteFormatOpt,
+           progName, SlavesOpt, CyclesOpt, progName, DiscoverOpt, TurnaroundOpt);
+}
+
+//parses comma separated baud rates, returns their number or 0 if the list is invalid
+static int parseBauds(const char str[], int bauds[], int maxNo) {
+    const char *cur = str;
+    int no = 0;
+
+    while (no < maxNo) {
+        char *end;
+        long baud = strtol(cur, &end, 10);
+        if (end == cur || baud <= 0)
+            return 0;
+        bauds[no++] = (int)baud;
+        if ('\0' == *end)
+            return no;
+        if (',' != *end)
+            return 0;
+        cur = end + 1;
+    }
+
+    return 0;
+}
+
+static int discoverSlaves(MbuBackendParams *backend, char *ports[], int portsNo, const int bauds[], int baudsNo,
+                          const char parities[], const int slaves[], int slavesNo, int fType, int addr, int nb,
+                          int turnaroundMs) {
+    static DiscoverPort discoverPorts[MAX_DISCOVER_PORTS];
+    int allSlaves[MAX_SLAVES];
+    int foundNo = 0;
+    int i, j;
+
+    if (0 == slavesNo) {
+        for (i = 0; i < MAX_SLAVES; ++i)
+            allSlaves[i] = i + 1;
+        slaves = allSlaves;
+        slavesNo = MAX_SLAVES;
+    }
+
+    for (i = 0; i < portsNo; ++i) {
+        DiscoverPort *port = &discoverPorts[i];
+        port->line = *(MbuRtuBackend*)backend;
+        mbuSetBackendAddress(&port->line.base, ports[i]);
+        port->bauds = bauds;
+        port->baudsNo = baudsNo;
+        port->parities = parities;
+        port->addresses = slaves;
+        port->addressesNo = slavesNo;
+        port->fType = fType;
+        port->addr = addr;
+        port->nb = nb;
+        port->turnaroundMs = turnaroundMs;
+        if (0 == discoverStart(port)) {
+            portsNo = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < portsNo; ++i) {
+        DiscoverPort *port = &discoverPorts[i];
+        discoverJoin(port);
+        for (j = 0; j < port->slavesNo; ++j) {
+            const DiscoveredSlave *slave = &port->slaves[j];
+            printf("%s,%d,%d%c%d,%d,", port->line.devName, slave->baud, port->line.dataBits, slave->parity,
+                   port->line.stopBits, slave->address);
+            if (0 != slave->exception)
+                printf("exception:%d", slave->exception);
+            else
+                printf("ok");
+            printf(",%.1f\n", slave->responseUs / 1000.0);
+        }
+        foundNo += port->slavesNo;
+    }
+
+    for (i = 0; i < portsNo; ++i) {
+        const DiscoverPort *port = &discoverPorts[i];
+        fprintf(stderr, "%s: %d slaves, %d probes at %d settings in %.1fs%s\n", port->line.devName, port->slavesNo,
+                port->probesNo, port->settingsNo, port->elapsedNs / 1e9, port->failed ? " (port failed)" : "");
+        for (j = 0; j < port->settingsNo; ++j) {
+            const DiscoverSetting *setting = &port->settings[j];
+            if (0 != setting->garbledNo)
+                fprintf(stderr, "\t%d %c: %d garbled answers, slaves with other settings may be there\n",
+                        setting->baud, setting->parity, setting->garbledNo);
+        }
+    }
+
+    return foundNo;
+}
+
+//backend and request data live in static storage; the heap is used at setup only (data loaded
+//from files, capture/series writer buffers, report by exception state), not while polling
+static union {
+    MbuRtuBackend rtu;
+    MbuTcpBackend tcp;
+    MbuUnixBackend unixB;
+    MbuUdpBackend udp;
+} backendStorage;
+static BrokerBackend brokerStorage;
+
+//one request at most, MODBUS_MAX_READ_BITS is the largest of the per request limits
+static uint8_t requestBits[MODBUS_MAX_READ_BITS];
+static uint16_t requestRegisters[MODBUS_MAX_READ_BITS];
+static uint16_t writeReadRegisters[MODBUS_MAX_WR_READ_REGISTERS];
+
+//one buffer per polled slave
+static uint16_t pollBuffers[MAX_SLAVES][MODBUS_MAX_READ_BITS];
+static RbeChange pollChanges[MODBUS_MAX_READ_BITS];
+
+static volatile sig_atomic_t stopPolling = 0;
+
+static void stopPollingOnSignal(int sig)
+{
+    (void)sig;
+    stopPolling = 1;
+}
+
+//typed and machine-readable printing of read values
+static struct {
+    OutputFormat format;
+    ValueType type;
+    WordOrder order;
+    OutputBuffer buffer;
+    uint64_t raw[MODBUS_MAX_READ_BITS];
+} output;
+
+static int isPlainOutput(void) {
+    return (OutputText == output.format && TypeRaw == output.type);
+}
+
+//prints read data as --type and --format say
+static void outputRead(uint64_t tsNs, int slave, int fType, int addr, const void *data, int nb) {
+    int isBits = (MbuReadCoils == fType || MbuReadDiscreteInput == fType);
+    int count;
+    int i;
+
+    if (isBits) {
+        for (i = 0; i < nb; ++i)
+            output.raw[i] = ((const uint8_t*)data)[i];
+        count = nb;
+    }
+    else {
+        count = decodeRegisters((const uint16_t*)data, nb, output.type, output.order, output.raw);
+    }
+
+    if (OutputText == output.format)
+        outputValues(&output.buffer, isBits ? TypeUint16 : output.type, output.raw, count, ' ');
+    else
+        outputRow(&output.buffer, output.format, tsNs, slave, fType, addr, isBits ? TypeRaw : output.type,
+                  output.raw, count);
+}
+
+static void printPolled(const MbuRequest *r, int isBits, uint64_t polledNs) {
+    char line[128];
+    int j;
+
+    if (0 == isPlainOutput()) {
+        if (-1 != r->result) {
+            if (OutputText == output.format) {
+                snprintf(line, sizeof(line), "slave %d: ", r->slave);
+                outputText(&output.buffer, line);
+            }
+            outputRead(polledNs, r->slave, r->fType, r->addr, r->data, r->result);
+            if (OutputText == output.format)
+                outputText(&output.buffer, "\n");
+        }
+        else if (OutputJsonl == output.format || OutputText == output.format) {
+            snprintf(line, sizeof(line), (OutputJsonl == output.format) ? "{\"slave\":%d,\"error\":\"%s\"}\n" : "slave %d: %s\n",
+                     r->slave, (EHOSTDOWN == r->error) ? "DOWN" : modbus_strerror(r->error));
+            outputText(&output.buffer, line);
+        }
+        else {
+            fprintf(stderr, "slave %d: %s\n", r->slave, (EHOSTDOWN == r->error) ? "DOWN" : modbus_strerror(r->error));
+        }
+        return;
+    }
+
+    if (-1 == r->result) {
+        if (EHOSTDOWN == r->error)
+            printf("slave %d: DOWN\n", r->slave);
+        else
+            printf("slave %d: ERROR %s\n", r->slave, modbus_strerror(r->error));
+        return;
+    }
+    printf("slave %d:", r->slave);
+    for (j = 0; j < r->result; ++j) {
+        if (isBits)
+            printf(" 0x%02x", ((const uint8_t*)r->data)[j]);
+        else
+            printf(" 0x%04x", ((const uint16_t*)r->data)[j]);
+    }
+    printf("\n");
+}
+
+static void printChanges(const MbuRequest *r, const RbeChange changes[], int changesNo, int isBits) {
+    int j;
+
+    for (j = 0; j < changesNo; ++j) {
+        const RbeChange *ch = &changes[j];
+        printf("%llu.%03u slave %d addr %d: ", (unsigned long long)(ch->timestampNs / 1000000000ULL),
+               (unsigned)(ch->timestampNs % 1000000000ULL / 1000000), r->slave, r->addr + ch->index);
+        printf(isBits ? "0x%02x\n" : "0x%04x\n", ch->value);
+    }
+}
+
+//rbeDeadband is given if only changes are to be printed
+static int pollSlaves(MbuBackendParams *backend, const int slaves[], int slavesNo, int fType, int addr, int nb,
+                      int cycles, int turnaroundMs, const RttPolicy *policy,
+                      const RbeDeadband *rbeDeadband, const char deadbandFile[], const char recordFile[],
+                      Tracer *tracer, int debug) {
+    MbuRequest requests[RTU_POLL_MAX_REQUESTS];
+    RbeBlock blocks[RTU_POLL_MAX_REQUESTS];
+    int lastErrors[RTU_POLL_MAX_REQUESTS];
+    RbeChange *changes = pollChanges;
+    SeriesRecorder recorder;
+    RtuPoller poller;
+    int isBits = (MbuReadCoils == fType || MbuReadDiscreteInput == fType);
+    int cycle;
+    int i;
+
+    modbus_t *ctx = backend->createCtxt(backend);
+    modbus_set_debug(ctx, debug);
+    if (backend->connectCtxt(backend, ctx) == -1) {
+        fprintf(stderr, "Connection failed: %s\n", modbus_strerror(errno));
+        modbus_free(ctx);
+        return 0;
+    }
+
+    for (i = 0; i < slavesNo; ++i) {
+        requests[i].fType = fType;
+        requests[i].slave = slaves[i];
+        requests[i].addr = addr;
+        requests[i].nb = nb;
+        requests[i].data = pollBuffers[i];
+    }
+    rtuPollerInit(&poller, ctx, (MbuRtuBackend*)backend, requests, slavesNo, turnaroundMs, policy);
+    poller.tracer = tracer;
+
+    if (0 != recordFile) {
+        if (0 == seriesOpen(&recorder, recordFile))
+            exit(EXIT_FAILURE);
+        for (i = 0; i < slavesNo; ++i) {
+            if (-1 == seriesAdd(&recorder, slaves[i], fType, addr, nb))
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (0 != rbeDeadband) {
+        for (i = 0; i < slavesNo; ++i) {
+            if (0 == rbeInit(&blocks[i], isBits, nb)) {
+                printf("Cannot allocate reported values of %d points\n", nb);
+                exit(EXIT_FAILURE);
+            }
+            blocks[i].deadband = *rbeDeadband;
+            if (0 != deadbandFile && 0 == rbeLoadDeadbands(&blocks[i], deadbandFile, addr)) {
+                exit(EXIT_FAILURE);
+            }
+            lastErrors[i] = -1;
+        }
+    }
+    if (debug)
+        printf("Char time %uus, t1.5 %uus, t3.5 %uus\n", poller.timing.charUs, poller.timing.t15Us, poller.timing.t35Us);
+
+    //finish the cycle and write out the recording on ctrl-c
+    signal(SIGINT, stopPollingOnSignal);
+    signal(SIGTERM, stopPollingOnSignal);
+
+    uint64_t startNs = mbuClockNs(CLOCK_MONOTONIC);
+    for (cycle = 0; (0 == cycles || cycle < cycles) && 0 == stopPolling; ++cycle) {
+        rtuPollCycle(&poller);
+        if (0 != recordFile) {
+            uint64_t polledNs = mbuClockNs(CLOCK_REALTIME);
+            for (i = 0; i < slavesNo; ++i) {
+                if (nb == requests[i].result)
+                    seriesAppend(&recorder, i, polledNs, requests[i].data);
+            }
+        }
+        if (0 == rbeDeadband) {
+            for (i = 0; i < slavesNo; ++i) {
+                if (0 == recordFile || -1 == requests[i].result)
+                    printPolled(&requests[i], isBits, mbuClockNs(CLOCK_REALTIME));
+            }
+            outputFlush(&output.buffer);
+            continue;
+        }
+
+        uint64_t polledNs = mbuClockNs(CLOCK_REALTIME);
+        for (i = 0; i < slavesNo; ++i) {
+            const MbuRequest *r = &requests[i];
+            if (-1 == r->result) {
+                if (lastErrors[i] != r->error)
+                    printPolled(r, isBits, polledNs);
+            }
+            else {
+                printChanges(r, changes, rbeUpdate(&blocks[i], r->data, polledNs, changes), isBits);
+            }
+            lastErrors[i] = r->error;
+        }
+        outputFlush(&output.buffer);
+    }
+    double secs = (mbuClockNs(CLOCK_MONOTONIC) - startNs) / 1e9;
+
+    if (debug) {
+        for (i = 0; i < slavesNo; ++i) {
+            printf("slave %d: srtt %uus, rttvar %uus, timeout %uus%s\n", slaves[i], poller.rtt[i].srttUs,
+                   poller.rtt[i].rttvarUs, poller.rtt[i].rtoUs, poller.rtt[i].down ? ", down" : "");
+        }
+    }
+    //machine-readable output is kept clean
+    fprintf(isPlainOutput() ? stdout : stderr,
+            "Polled %llu requests (%llu failed, %llu skipped, %llu retries), %llu points in %.3fs (%.0f points/s)\n",
+            (unsigned long long)poller.requestsNo, (unsigned long long)poller.failuresNo,
+            (unsigned long long)poller.skippedNo, (unsigned long long)poller.retriesNo,
+            (unsigned long long)poller.pointsNo, secs, (secs > 0) ? poller.pointsNo / secs : 0.0);
+
+    if (0 != rbeDeadband) {
+        for (i = 0; i < slavesNo; ++i)
+            rbeFree(&blocks[i]);
+    }
+    if (0 != recordFile)
+        seriesClose(&recorder);
+    modbus_close(ctx);
+    modbus_free(ctx);
+
+    return (0 == poller.failuresNo);
 }
 
 int main(int argc, char **argv)
 {
     int c;
     int ok;
+    int ret;
 
     int debug = 0;
-    BackendParams *backend = 0;
+    MbuBackendParams *backend = 0;
     int slaveAddr = 1;
     int startAddr = 100;
     int startReferenceAt0 = 0;
     int readWriteNo = 1;
-    int fType = FuncNone;
+    int fType = MbuFuncNone;
     int timeout_ms = 1000;
     int hasDevice = 0;
+    const char *captureFile = 0;
+    const char *replayFile = 0;
+    double replaySpeed = 1.0;
+    const char *writeFile = 0;
+    int writeBinary = 1;
+    int pipeline = BULK_DEFAULT_WINDOW;
+    int countGiven = 0;
+    int slaves[MAX_SLAVES];
+    int slavesNo = 0;
+    int cycles = 1;
+    int turnaroundMs = DEFAULT_TURNAROUND_MS;
+    int rtoMinMs = 0;
+    int retries = DEFAULT_RETRIES;
+    int downAfter = DEFAULT_DOWN_AFTER;
+    int probeIntervalMs = DEFAULT_PROBE_INTERVAL_MS;
+    int rbe = 0;
+    RbeDeadband deadband = {0, 0};
+    const char *deadbandFile = 0;
+    const char *recordFile = 0;
+    const char *pollOnlyOpt = 0;//option that has effect only when polling slaves
+    int readAddr = -1;
+    const char *traceFile = 0;
+    int traceSample = 1;
+    int discover = 0;
+    int bauds[MAX_BAUDS];
+    int baudsNo = parseBauds(DEFAULT_BAUDS, bauds, MAX_BAUDS);
+    const char *parities = DEFAULT_PARITIES;
+    const char *brokerPath = 0;
+
+    output.format = OutputText;
+    output.type = TypeRaw;
+    output.order = OrderABCD;
+    outputInit(&output.buffer, fileno(stdout));
+    Tracer tracer;
+    int readNo = 0;
+    uint16_t *readData = writeReadRegisters;
+    int expectedRet;
+    CaptureLog captureLog;
 
     int isWriteFunction = 0;
     enum WriteDataType {
@@ -101,6 +552,32 @@ int main(int argc, char **argv)
         int option_index = 0;
         static struct option long_options[] = {
             {DebugOpt,  no_argument, 0,  0},
+            {CaptureOpt, required_argument, 0, 0},
+            {ReplayOpt, required_argument, 0, 0},
+            {ReplaySpeedOpt, required_argument, 0, 0},
+            {WriteFileOpt, required_argument, 0, 0},
+            {WriteFormatOpt, required_argument, 0, 0},
+            {PipelineOpt, required_argument, 0, 0},
+            {SlavesOpt, required_argument, 0, 0},
+            {CyclesOpt, required_argument, 0, 0},
+            {TurnaroundOpt, required_argument, 0, 0},
+            {RtoMinOpt, required_argument, 0, 0},
+            {RetriesOpt, required_argument, 0, 0},
+            {DownAfterOpt, required_argument, 0, 0},
+            {ProbeOpt, required_argument, 0, 0},
+            {RbeOpt, no_argument, 0, 0},
+            {DeadbandOpt, required_argument, 0, 0},
+            {DeadbandFileOpt, required_argument, 0, 0},
+            {RecordOpt, required_argument, 0, 0},
+            {ReadAddrOpt, required_argument, 0, 0},
+            {TraceOpt, required_argument, 0, 0},
+            {TraceSampleOpt, required_argument, 0, 0},
+            {DiscoverOpt, no_argument, 0, 0},
+            {BaudsOpt, required_argument, 0, 0},
+            {ParitiesOpt, required_argument, 0, 0},
+            {TypeOpt, required_argument, 0, 0},
+            {FormatOpt, required_argument, 0, 0},
+            {BrokerOpt, required_argument, 0, 0},
             {0, 0,  0,  0}
         };
 
@@ -115,10 +592,184 @@ int main(int argc, char **argv)
             if (0 == strcmp(long_options[option_index].name, DebugOpt)) {
                 debug = 1;
             }
+            else if (0 == strcmp(long_options[option_index].name, CaptureOpt)) {
+                captureFile = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, ReplayOpt)) {
+                replayFile = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, ReplaySpeedOpt)) {
+                if (0 == strcmp(optarg, "max"))
+                    replaySpeed = 0;
+                else if (1 != sscanf(optarg, "%lf", &replaySpeed) || replaySpeed <= 0) {
+                    printf("Replay speed (%s) is not a positive number!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, WriteFileOpt)) {
+                writeFile = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, WriteFormatOpt)) {
+                if (0 == strcmp(optarg, "bin"))
+                    writeBinary = 1;
+                else if (0 == strcmp(optarg, "text"))
+                    writeBinary = 0;
+                else {
+                    printf("Unrecognized write data format %s\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, PipelineOpt)) {
+                pipeline = mbuGetInt(optarg, &ok);
+                if (0 == ok || pipeline < 1 || pipeline > BULK_MAX_WINDOW) {
+                    printf("Pipeline depth (%s) should be 1-%d!\n\n", optarg, BULK_MAX_WINDOW);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, SlavesOpt)) {
+                slavesNo = mbuParseAddressList(optarg, slaves, MAX_SLAVES);
+                if (0 == slavesNo) {
+                    printf("Slave list (%s) is invalid, addresses should be 1-247!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, CyclesOpt)) {
+                cycles = mbuGetInt(optarg, &ok);
+                if (0 == ok || cycles < 0) {
+                    printf("Cycles number (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                pollOnlyOpt = CyclesOpt;
+            }
+            else if (0 == strcmp(long_options[option_index].name, TurnaroundOpt)) {
+                turnaroundMs = mbuGetInt(optarg, &ok);
+                if (0 == ok || turnaroundMs < 0) {
+                    printf("Turnaround (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, RtoMinOpt)) {
+                rtoMinMs = mbuGetInt(optarg, &ok);
+                if (0 == ok || rtoMinMs < 0) {
+                    printf("Minimal timeout (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, RetriesOpt)) {
+                retries = mbuGetInt(optarg, &ok);
+                if (0 == ok || retries < 0) {
+                    printf("Retries number (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, DownAfterOpt)) {
+                downAfter = mbuGetInt(optarg, &ok);
+                if (0 == ok || downAfter < 1) {
+                    printf("Failures number (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, ProbeOpt)) {
+                probeIntervalMs = mbuGetInt(optarg, &ok);
+                if (0 == ok || probeIntervalMs < 0) {
+                    printf("Probe interval (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, RbeOpt)) {
+                rbe = 1;
+                pollOnlyOpt = RbeOpt;
+            }
+            else if (0 == strcmp(long_options[option_index].name, DeadbandOpt)) {
+                int absolute = 0;
+                double percent = 0;
+                if (sscanf(optarg, "%i:%lf", &absolute, &percent) < 1 || absolute < 0 || absolute > 0xffff
+                        || percent < 0 || percent > 655) {
+                    printf("Deadband (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                deadband.absolute = (uint16_t)absolute;
+                deadband.percentX100 = (uint16_t)(percent * 100 + 0.5);
+                pollOnlyOpt = DeadbandOpt;
+            }
+            else if (0 == strcmp(long_options[option_index].name, DeadbandFileOpt)) {
+                deadbandFile = optarg;
+                pollOnlyOpt = DeadbandFileOpt;
+            }
+            else if (0 == strcmp(long_options[option_index].name, RecordOpt)) {
+                recordFile = optarg;
+                pollOnlyOpt = RecordOpt;
+            }
+            else if (0 == strcmp(long_options[option_index].name, ReadAddrOpt)) {
+                readAddr = mbuGetInt(optarg, &ok);
+                if (0 == ok || readAddr < 0) {
+                    printf("Read start address (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, TraceOpt)) {
+                traceFile = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, TraceSampleOpt)) {
+                traceSample = mbuGetInt(optarg, &ok);
+                if (0 == ok || traceSample < 1) {
+                    printf("Trace sampling (%s) should be a positive integer!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, DiscoverOpt)) {
+                discover = 1;
+            }
+            else if (0 == strcmp(long_options[option_index].name, BaudsOpt)) {
+                baudsNo = parseBauds(optarg, bauds, MAX_BAUDS);
+                if (0 == baudsNo) {
+                    printf("Baud list (%s) is invalid, at most %d rates are allowed!\n\n", optarg, MAX_BAUDS);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, ParitiesOpt)) {
+                parities = optarg;
+                if ('\0' == *parities || strlen(parities) != strspn(parities, "ENO")) {
+                    printf("Parities (%s) should be letters E, N, O!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, TypeOpt)) {
+                if (0 == parseValueType(optarg, &output.type, &output.order)) {
+                    printf("Value type (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, FormatOpt)) {
+                if (0 == parseOutputFormat(optarg, &output.format)) {
+                    printf("Output format (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, BrokerOpt)) {
+                brokerPath = optarg;
+            }
             break;
 
         case 'a': {
-            slaveAddr = getInt(optarg, &ok);
+            slaveAddr = mbuGetInt(optarg, &ok);
             if (0 == ok) {
                 printf("Slave address (%s) is not integer!\n\n", optarg);
                 printUsage(argv[0]);
@@ -128,21 +779,26 @@ int main(int argc, char **argv)
             break;
 
         case 'c': {
-            readWriteNo = getInt(optarg, &ok);
+            readWriteNo = mbuGetInt(optarg, &ok);
             if (0 == ok) {
                 printf("# elements to read/write (%s) is not integer!\n\n", optarg);
                 printUsage(argv[0]);
                 exit(EXIT_FAILURE);
             }
+            countGiven = 1;
         }
             break;
 
         case 'm':
             if (0 == strcmp(optarg, TcpOptVal)) {
-                backend = createTcpBackend((TcpBackend*)malloc(sizeof(TcpBackend)));
+                backend = mbuInitTcpBackend(&backendStorage.tcp);
             }
             else if (0 == strcmp(optarg, RtuOptVal))
-                backend = createRtuBackend((RtuBackend*)malloc(sizeof(RtuBackend)));
+                backend = mbuInitRtuBackend(&backendStorage.rtu);
+            else if (0 == strcmp(optarg, UnixOptVal))
+                backend = mbuInitUnixBackend(&backendStorage.unixB);
+            else if (0 == strcmp(optarg, UdpOptVal))
+                backend = mbuInitUdpBackend(&backendStorage.udp);
             else {
                 printf("Unrecognized connection type %s\n\n", optarg);
                 printUsage(argv[0]);
@@ -151,7 +807,7 @@ int main(int argc, char **argv)
             break;
 
         case 'r': {
-            startAddr = getInt(optarg, &ok);
+            startAddr = mbuGetInt(optarg, &ok);
             if (0 == ok) {
                 printf("Start address (%s) is not integer!\n\n", optarg);
                 printUsage(argv[0]);
@@ -161,7 +817,7 @@ int main(int argc, char **argv)
             break;
 
         case 't': {
-            fType = getInt(optarg, &ok);
+            fType = mbuGetInt(optarg, &ok);
             if (0 == ok) {
                 printf("Function type (%s) is not integer!\n\n", optarg);
                 printUsage(argv[0]);
@@ -171,7 +827,7 @@ int main(int argc, char **argv)
             break;
 
         case 'o': {
-            timeout_ms = getInt(optarg, &ok);
+            timeout_ms = mbuGetInt(optarg, &ok);
             if (0 == ok) {
                 printf("Timeout (%s) is not integer!\n\n", optarg);
                 printUsage(argv[0]);
@@ -214,33 +870,166 @@ int main(int argc, char **argv)
         printUsage(argv[0]);
         exit(EXIT_FAILURE);
     }
+    if (0 != brokerPath) {
+        if (MbuTcp != backend->type) {
+            printf("Broker can be used only with tcp connection!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        backend = initBrokerBackend(&brokerStorage, backend, brokerPath);
+        if (0 == backend) {
+            exit(EXIT_FAILURE);
+        }
+    }
 
     if (1 == startReferenceAt0) {
         startAddr--;
+        if (-1 != readAddr)
+            readAddr--;
+    }
+    if (-1 == readAddr)
+        readAddr = startAddr;
+
+    if (0 != captureFile && 0 == captureOpen(&captureLog, captureFile)) {
+        exit(EXIT_FAILURE);
+    }
+    if (0 != traceFile && 0 == traceOpen(&tracer, traceFile, traceSample)) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 != replayFile) {
+        if (1 != argc - optind) {
+            printf("Expecting only serialport|host|socket-path as free parameter!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        mbuSetBackendAddress(backend, argv[optind]);
+
+        modbus_t *ctx = backend->createCtxt(backend);
+        modbus_set_debug(ctx, debug);
+        modbus_set_response_timeout(ctx, timeout_ms / 1000, (timeout_ms % 1000) * 1000);
+        if (backend->connectCtxt(backend, ctx) == -1) {
+            fprintf(stderr, "Connection failed: %s\n",
+                    modbus_strerror(errno));
+            modbus_free(ctx);
+            return -1;
+        }
+        ret = replayCapture(ctx, backend->type, replayFile, replaySpeed, (0 != captureFile) ? &captureLog : 0);
+
+        if (0 != captureFile)
+            captureClose(&captureLog);
+        modbus_close(ctx);
+        modbus_free(ctx);
+        backend->del(backend);
+        exit((ret < 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    if (0 == isPlainOutput()) {
+        if (rbe) {
+            printf("Changes (--%s) are printed only as text!\n", RbeOpt);
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (TypeRaw != output.type && (MbuReadCoils == fType || MbuReadDiscreteInput == fType)) {
+            printf("Coils and discrete inputs have no value type!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if ((MbuReadHoldingRegisters == fType || MbuReadInputRegisters == fType || MbuFuncNone == fType)
+            && 0 != readWriteNo % valueWords(output.type)) {
+            printf("Read count (%d) is not a multiple of %d registers per value!\n",
+                   readWriteNo, valueWords(output.type));
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (discover) {
+        if (MbuRtu != backend->type) {
+            printf("Discovery is supported only with rtu connection!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (optind == argc || argc - optind > MAX_DISCOVER_PORTS) {
+            printf("Expecting 1-%d serial ports as free parameters!\n", MAX_DISCOVER_PORTS);
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        ret = discoverSlaves(backend, argv + optind, argc - optind, bauds, baudsNo, parities, slaves, slavesNo,
+                             (MbuFuncNone == fType) ? MbuReadHoldingRegisters : fType, startAddr, readWriteNo, turnaroundMs);
+        backend->del(backend);
+        exit((ret > 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (0 == slavesNo && 0 != pollOnlyOpt) {
+        printf("--%s is supported only when polling slaves (--%s)!\n", pollOnlyOpt, SlavesOpt);
+        printUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 != slavesNo) {
+        if (MbuRtu != backend->type) {
+            printf("Polling many slaves is supported only with rtu connection!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (MbuReadCoils != fType && MbuReadDiscreteInput != fType && MbuReadHoldingRegisters != fType && MbuReadInputRegisters != fType) {
+            printf("Only read functions (0x01-0x04) can be polled!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (readWriteNo < 1 || readWriteNo > ((MbuReadCoils == fType || MbuReadDiscreteInput == fType)
+                                              ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS)) {
+            printf("Read count (%d) does not fit one request!\n", readWriteNo);
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (1 != argc - optind) {
+            printf("Expecting only serialport as free parameter!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        mbuSetBackendAddress(backend, argv[optind]);
+
+        RttPolicy policy;
+        rttPolicyInit(&policy, rtoMinMs * 1000, timeout_ms * 1000);
+        policy.retries = retries;
+        policy.downAfter = downAfter;
+        policy.probeIntervalUs = probeIntervalMs * 1000;
+
+        ret = pollSlaves(backend, slaves, slavesNo, fType, startAddr, readWriteNo, cycles, turnaroundMs, &policy,
+                         rbe ? &deadband : 0, deadbandFile, recordFile, (0 != traceFile) ? &tracer : 0, debug);
+        if (0 != traceFile)
+            traceClose(&tracer);
+        backend->del(backend);
+        exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
     //choose write data type
     switch (fType) {
-    case(ReadCoils):
+    case(MbuReadCoils):
         wDataType = Data8Array;
         break;
-    case(ReadDiscreteInput):
-        wDataType = DataInt;
+    case(MbuReadDiscreteInput):
+        wDataType = Data8Array;
         break;
-    case(ReadHoldingRegisters):
-    case(ReadInputRegisters):
+    case(MbuReadHoldingRegisters):
+    case(MbuReadInputRegisters):
         wDataType = Data16Array;
         break;
-    case(WriteSingleCoil):
-    case(WriteSingleRegister):
+    case(MbuWriteSingleCoil):
+    case(MbuWriteSingleRegister):
         wDataType = DataInt;
         isWriteFunction = 1;
         break;
-    case(WriteMultipleCoils):
+    case(MbuWriteMultipleCoils):
         wDataType = Data8Array;
         isWriteFunction = 1;
         break;
-    case(WriteMultipleRegisters):
+    case(MbuWriteMultipleRegisters):
+    case(MbuMaskWriteRegister):
+    case(MbuWriteAndReadRegisters):
         wDataType = Data16Array;
         isWriteFunction = 1;
         break;
@@ -250,26 +1039,73 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (isWriteFunction) {
+    if (0 != writeFile) {
+        if (MbuWriteMultipleCoils != fType && MbuWriteMultipleRegisters != fType) {
+            printf("Write data file can be used only with multiple coils/registers write!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (1 != argc - optind) {
+            printf("Expecting only serialport|host|socket-path as free parameter, write data come from %s!\n", writeFile);
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        int dataNo = 0;
+        if (0 == loadWriteData(writeFile, writeBinary, (MbuWriteMultipleCoils == fType), (void**)&data.data8, &dataNo)) {
+            exit(EXIT_FAILURE);
+        }
+        //packed coils are padded to full bytes, -c tells how many are meaningful
+        if (0 == countGiven || readWriteNo > dataNo)
+            readWriteNo = dataNo;
+        if (debug)
+            printf("Loaded %d elements to write\n", dataNo);
+    }
+    else if (isWriteFunction) {
         int dataNo = argc - optind - 1;
         /*if (-1 != readWriteNo && dataNo != readWriteNo) {
             printf("Write count specified, not equal to data values count!");
             printUsage(argv[0]);
             exit(EXIT_FAILURE);
         }
-        else*/ readWriteNo = dataNo;
+        else*/
+        if (MbuWriteAndReadRegisters == fType)
+            readNo = countGiven ? readWriteNo : dataNo;
+        readWriteNo = dataNo;
+    }
+
+    if (MbuMaskWriteRegister == fType && 2 != readWriteNo) {
+        printf("Mask write takes 2 values: and-mask, or-mask!\n");
+        printUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (MbuWriteAndReadRegisters == fType) {
+        if (readWriteNo < 1 || readWriteNo > MODBUS_MAX_WR_WRITE_REGISTERS
+                || readNo < 1 || readNo > MODBUS_MAX_WR_READ_REGISTERS) {
+            printf("Write and read takes 1-%d registers to write and 1-%d to read!\n",
+                   MODBUS_MAX_WR_WRITE_REGISTERS, MODBUS_MAX_WR_READ_REGISTERS);
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (0 == writeFile && readWriteNo > MODBUS_MAX_READ_BITS) {
+        printf("At most %d elements fit one request!\n", MODBUS_MAX_READ_BITS);
+        printUsage(argv[0]);
+        exit(EXIT_FAILURE);
     }
 
-    //allocate buffer for data
+    //point at buffer for data (write file data are already loaded)
     switch (wDataType) {
     case (DataInt):
-        //no need to alloc anything
+        //no buffer needed
         break;
     case (Data8Array):
-        data.data8 = malloc(readWriteNo * sizeof(uint8_t));
+        if (0 == writeFile)
+            data.data8 = requestBits;
         break;
     case (Data16Array):
-        data.data16 = malloc(readWriteNo * sizeof(uint16_t));
+        if (0 == writeFile)
+            data.data16 = requestRegisters;
         break;
     default:
         printf("Data alloc error!\n");
@@ -283,33 +1119,25 @@ int main(int argc, char **argv)
         while (optind < argc) {
             if (0 == hasDevice) {
                 if (0 != backend) {
-                    if (Rtu == backend->type) {
-                        RtuBackend *rtuP = (RtuBackend*)backend;
-                        strcpy(rtuP->devName, argv[optind]);
-                        hasDevice = 1;
-                    }
-                    else if (Tcp == backend->type) {
-                        TcpBackend *tcpP = (TcpBackend*)backend;
-                        strcpy(tcpP->ip, argv[optind]);
-                        hasDevice = 1;
-                    }
+                    mbuSetBackendAddress(backend, argv[optind]);
+                    hasDevice = 1;
                 }
             }
             else {//setting write data buffer
                 switch (wDataType) {
                 case (DataInt):
-                    data.dataInt = getInt(argv[optind], 0);
+                    data.dataInt = mbuGetInt(argv[optind], 0);
                     if (debug)
                         printf("0x%x", data.dataInt);
                     break;
                 case (Data8Array): {
-                    data.data8[wDataIdx] = getInt(argv[optind], 0);
+                    data.data8[wDataIdx] = mbuGetInt(argv[optind], 0);
                     if (debug)
                         printf("0x%02x ", data.data8[wDataIdx]);
                 }
                     break;
                 case (Data16Array): {
-                    data.data16[wDataIdx] = getInt(argv[optind], 0);
+                    data.data16[wDataIdx] = mbuGetInt(argv[optind], 0);
                     if (debug)
                         printf("0x%04x ", data.data16[wDataIdx]);
                 }
@@ -327,50 +1155,107 @@ int main(int argc, char **argv)
     modbus_t *ctx = backend->createCtxt(backend);
     modbus_set_debug(ctx, debug);
     modbus_set_slave(ctx, slaveAddr);
+    modbus_set_response_timeout(ctx, timeout_ms / 1000, (timeout_ms % 1000) * 1000);
 
     //issue the request
-    int ret = -1;
-    if (modbus_connect(ctx) == -1) {
+    ret = -1;
+    if (backend->connectCtxt(backend, ctx) == -1) {
         fprintf(stderr, "Connection failed: %s\n",
                 modbus_strerror(errno));
         modbus_free(ctx);
         return -1;
     } else {
+        if (0 != captureFile && 0 == writeFile) {
+            uint8_t frame[MBU_MAX_FRAME_LENGTH];
+            int len = (MbuWriteAndReadRegisters == fType)
+                    ? buildWriteReadFrame(frame, slaveAddr, startAddr, readWriteNo, data.data16, readAddr, readNo)
+                    : buildRequestFrame(frame, slaveAddr, fType, startAddr, readWriteNo,
+                                        (DataInt == wDataType) ? (const void*)&data.dataInt : (const void*)data.data8);
+            captureRecord(&captureLog, CaptureRequest, frame, len);
+        }
+
+        uint64_t requestNs = mbuClockNs(CLOCK_MONOTONIC);
         switch (fType) {
-        case(ReadCoils):
+        case(MbuReadCoils):
             ret = modbus_read_bits(ctx, startAddr, readWriteNo, data.data8);
             break;
-        case(ReadDiscreteInput):
-            printf("ReadDiscreteInput: not implemented yet!\n");
-            wDataType = DataInt;
+        case(MbuReadDiscreteInput):
+            ret = modbus_read_input_bits(ctx, startAddr, readWriteNo, data.data8);
             break;
-        case(ReadHoldingRegisters):
+        case(MbuReadHoldingRegisters):
             ret = modbus_read_registers(ctx, startAddr, readWriteNo, data.data16);
             break;
-        case(ReadInputRegisters):
+        case(MbuReadInputRegisters):
             ret = modbus_read_input_registers(ctx, startAddr, readWriteNo, data.data16);
             break;
-        case(WriteSingleCoil):
+        case(MbuWriteSingleCoil):
             ret = modbus_write_bit(ctx, startAddr, data.dataInt);
             break;
-        case(WriteSingleRegister):
+        case(MbuWriteSingleRegister):
             ret = modbus_write_register(ctx, startAddr, data.dataInt);
             break;
-        case(WriteMultipleCoils):
-            ret = modbus_write_bits(ctx, startAddr, readWriteNo, data.data8);
+        case(MbuWriteMultipleCoils):
+            if (0 != writeFile)
+                ret = bulkWrite(ctx, backend->type, slaveAddr, fType, startAddr, readWriteNo, data.data8, pipeline,
+                                (0 != captureFile) ? &captureLog : 0);
+            else
+                ret = modbus_write_bits(ctx, startAddr, readWriteNo, data.data8);
+            break;
+        case(MbuWriteMultipleRegisters):
+            if (0 != writeFile)
+                ret = bulkWrite(ctx, backend->type, slaveAddr, fType, startAddr, readWriteNo, data.data16, pipeline,
+                                (0 != captureFile) ? &captureLog : 0);
+            else
+                ret = modbus_write_registers(ctx, startAddr, readWriteNo, data.data16);
+            break;
+        case(MbuMaskWriteRegister):
+            ret = modbus_mask_write_register(ctx, startAddr, data.data16[0], data.data16[1]);
             break;
-        case(WriteMultipleRegisters):
-            ret = modbus_write_registers(ctx, startAddr, readWriteNo, data.data16);
+        case(MbuWriteAndReadRegisters):
+            ret = modbus_write_and_read_registers(ctx, startAddr, readWriteNo, data.data16, readAddr, readNo, readData);
             break;
         default:
             printf("No correct function type chosen");
             printUsage(argv[0]);
             exit(EXIT_FAILURE);
         }
+        //bulk writes are many requests, not traced
+        if (0 != traceFile && 0 == writeFile) {
+            int error = errno;
+            traceRecord(&tracer, TraceIssued, modbus_get_socket(ctx), slaveAddr, fType,
+                        (MbuWriteAndReadRegisters == fType) ? readAddr : startAddr,
+                        (MbuWriteAndReadRegisters == fType) ? readNo : readWriteNo,
+                        requestNs, mbuClockNs(CLOCK_MONOTONIC), traceStatus(ret, error));
+            errno = error;
+        }
     }
 
-    if (ret == readWriteNo) {//success
-        if (isWriteFunction)
+    //mask write confirms one register, write and read returns number of read ones
+    expectedRet = (MbuMaskWriteRegister == fType) ? 1 : ((MbuWriteAndReadRegisters == fType) ? readNo : readWriteNo);
+    if (ret == expectedRet) {//success
+        if (0 == isPlainOutput() && (0 == isWriteFunction || MbuWriteAndReadRegisters == fType)) {
+            int isWriteRead = (MbuWriteAndReadRegisters == fType);
+            if (OutputText == output.format) {
+                if (isWriteRead)
+                    printf("SUCCESS: written %d and read %d of elements:\n\tData: ", readWriteNo, readNo);
+                else
+                    printf("SUCCESS: read %d of elements:\n\tData: ", readWriteNo);
+                fflush(stdout);
+            }
+            outputRead(mbuClockNs(CLOCK_REALTIME), slaveAddr, fType, isWriteRead ? readAddr : startAddr,
+                       isWriteRead ? (const void*)readData : (const void*)data.data8, isWriteRead ? readNo : readWriteNo);
+            if (OutputText == output.format)
+                outputText(&output.buffer, "\n");
+            outputFlush(&output.buffer);
+        }
+        else if (MbuWriteAndReadRegisters == fType) {
+            int i;
+            printf("SUCCESS: written %d and read %d of elements:\n\tData: ", readWriteNo, readNo);
+            for (i = 0; i < readNo; ++i)
+                printf("0x%04x ", readData[i]);
+            printf("\n");
+        }
+        else if (isWriteFunction)
             printf("SUCCESS: written %d elements!\n", readWriteNo);
         else {
             printf("SUCCESS: read %d of elements:\n\tData: ", readWriteNo);
@@ -395,21 +1280,17 @@ int main(int argc, char **argv)
     }
 
     //cleanup
+    if (0 != captureFile)
+        captureClose(&captureLog);
+    if (0 != traceFile)
+        traceClose(&tracer);
     modbus_close(ctx);
     modbus_free(ctx);
     backend->del(backend);
 
-    switch (wDataType) {
-    case (DataInt):
-        //nothing to be done
-        break;
-    case (Data8Array):
+    //only data loaded from the write file are allocated
+    if (0 != writeFile)
         free(data.data8);
-        break;
-    case (Data16Array):
-        free(data.data16);
-        break;
-    }
 
     exit(EXIT_SUCCESS);
 }
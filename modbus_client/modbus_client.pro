@@ -9,10 +9,11 @@ DEPENDPATH += .
 INCLUDEPATH += .
 
 # Input
-SOURCES += modbus_client.c
+SOURCES += modbus_client.c \
+    $$files(../common/*.c)
 
 INCLUDEPATH += ../libmodbus/src \
     ../common
 
 LIBS += -L../libmodbus/src/.libs
-LIBS += -lmodbus
+LIBS += -lmodbus -pthread -lm
@@ -26,18 +26,33 @@
  * The file is strongly based upon libmodbus/tests/random-test-server.c of libmodbus library
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 
 #include <modbus.h>
 #include <errno.h>
 #include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
 
 #include "mbu-common.h"
+#include "mbu-codec.h"
+#include "mbu-preload.h"
+#include "mbu-capture.h"
+#include "mbu-gateway.h"
+#include "mbu-latency.h"
+#include "mbu-trace.h"
+#include "mbu-fault.h"
+#include "mbu-heatmap.h"
+#include "mbu-handoff.h"
+#include "mbu-replica.h"
+#include "mbu-pool.h"
 
 #if defined(_WIN32)
 #include <ws2tcpip.h>
@@ -45,61 +60,551 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #endif
 
 #define NB_CONNECTION    10
+#define HANDOFF_DRAIN_MS 2000
 
 static modbus_t *ctx = NULL;
 static modbus_mapping_t *mb_mapping;
 
 static int server_socket = -1;
+static CaptureLog *capture = NULL;
+static Gateway *gateway = NULL;
+/* Per client socket, partial ADUs read for the gateway */
+static CodecStream *gatewayStreams = NULL;
+static Tracer *tracer = NULL;
+static FaultPlan *faults = NULL;
+static ReplyQueue delayedReplies;
+/* libmodbus writes replies to be altered or delayed into faultPair[1] */
+static int faultPair[2] = {-1, -1};
+static Heatmap *heatmap = NULL;
+static uint64_t heatmapIntervalNs = 0;
+static uint64_t heatmapDueNs = UINT64_MAX;
+/* Set with handoff, mb_mapping then points into it */
+static SharedMapping *sharedMapping = NULL;
+static int handoffSocket = -1;
+static char **restartArgv = NULL;
+static volatile sig_atomic_t restartRequested = 0;
+static volatile sig_atomic_t stopSignal = 0;
 
-static void close_sigint(int dummy)
+static ReplicationPrimary *replication = NULL;
+static ReplicationReplica *replica = NULL;
+static uint64_t replicaRetryNs = UINT64_MAX;
+
+/* Time from the request being readable (modbus_receive() return for rtu) to the reply sent */
+static LatencyStats replyStats;
+static long long setupAllocationsNo = 0;//heap allocations made before serving
+static volatile sig_atomic_t statsRequested = 0;
+
+static void request_stats(int dummy)
+{
+    (void)dummy;
+    statsRequested = 1;
+}
+
+static void request_restart(int dummy)
+{
+    (void)dummy;
+    restartRequested = 1;
+}
+
+static void print_stats(void)
+{
+    latencyPrint(&replyStats, "Reply latency", stdout);
+    if (faults != NULL)
+        printf("Faults: %llu delayed, %llu dropped, %llu exception, %llu corrupted replies\n",
+               (unsigned long long)faults->delayedNo, (unsigned long long)faults->droppedNo,
+               (unsigned long long)faults->exceptionsNo, (unsigned long long)faults->corruptedNo);
+    if (replication != NULL)
+        printf("Replication: sequence %llu, %d replicas, %llu batches, %llu replicas fell behind\n",
+               (unsigned long long)replication->sequence, replication->replicasNo,
+               (unsigned long long)replication->batchesNo, (unsigned long long)replication->droppedNo);
+    if (replica != NULL)
+        printf("Replica: sequence %llu, %llu changes applied, %llu snapshots, primary %s\n",
+               (unsigned long long)replica->sequence, (unsigned long long)replica->changesNo,
+               (unsigned long long)replica->snapshotsNo, (-1 != replica->socket) ? "connected" : "gone");
+    if (-1 != heapAllocationsNo())
+        printf("Heap: %lld allocations at setup, %lld while serving\n",
+               setupAllocationsNo, heapAllocationsNo() - setupAllocationsNo);
+    fflush(stdout);
+}
+
+static void free_mapping(void)
+{
+    if (sharedMapping != NULL)
+        sharedMappingFree(sharedMapping);
+    else
+        modbus_mapping_free(mb_mapping);
+}
+
+/* Teardown takes locks and joins threads, so the serving loop does it, not the handler */
+static void request_stop(int sig)
+{
+    stopSignal = sig;
+}
+
+static void close_server(int status)
 {
     if (server_socket != -1) {
         close(server_socket);
     }
+    if (gateway != NULL) {
+        gatewayStop(gateway);
+    }
+    print_stats();
+    if (heatmap != NULL) {
+        heatmapDump(heatmap, stdout);
+    }
+    if (capture != NULL) {
+        captureClose(capture);
+    }
+    if (tracer != NULL) {
+        traceClose(tracer);
+    }
+    if (replication != NULL) {
+        replicationClose(replication);
+    }
+    if (replica != NULL) {
+        replicaClose(replica);
+    }
     modbus_free(ctx);
-    modbus_mapping_free(mb_mapping);
+    free_mapping();
+
+    exit(status);
+}
+
+static void captureQuery(const uint8_t query[], int rc, MbuConnType type)
+{
+    const uint8_t *frame;
+    int len = frameFromAdu(type, query, rc, &frame);
+    captureRecord(capture, CaptureRequest, frame, len);
+}
+
+static void profileQuery(const uint8_t query[], int rc, MbuConnType type, int fd)
+{
+    const uint8_t *frame;
+    int len = frameFromAdu(type, query, rc, &frame);
+    heatmapRecord(heatmap, fd, frame, len);
+}
+
+static void onUdpQuery(const uint8_t query[], int rc)
+{
+    if (capture != NULL)
+        captureQuery(query, rc, MbuUdp);
+    if (heatmap != NULL)
+        profileQuery(query, rc, MbuUdp, -1);
+}
+
+static void dumpHeatmapIfDue(void)
+{
+    uint64_t nowNs = mbuClockNs(CLOCK_MONOTONIC);
+    if (nowNs >= heatmapDueNs) {
+        heatmapDump(heatmap, stdout);
+        heatmapDueNs = nowNs + heatmapIntervalNs;
+    }
+}
+
+/* modbus_reply() doesn't tell the exception code, only the short response shows there was one */
+static int isExceptionReply(MbuConnType type, int replyLen)
+{
+    return replyLen == codecHeaderLength(type) + 3 + ((MbuRtu == type) ? 2 : 0);
+}
+
+/* replyLen is what modbus_reply() returned */
+static void traceReply(const uint8_t query[], int rc, MbuConnType type, int fd, int replyLen, uint64_t startNs)
+{
+    const uint8_t *frame;
+    int len = frameFromAdu(type, query, rc, &frame);
+    int status = 0;
+
+    if (-1 == replyLen)
+        status = TRACE_FAILED;
+    else if (isExceptionReply(type, replyLen))
+        status = TRACE_EXCEPTION_UNKNOWN;
+    traceFrame(tracer, TraceServed, fd, frame, len, startNs, mbuClockNs(CLOCK_MONOTONIC), status);
+}
+
+/* Replies to the request as fault rules say, returns what modbus_reply() would (-1 if the request is dropped) */
+static int replyWithFaults(int fd, MbuConnType type, const uint8_t query[], int rc)
+{
+    const uint8_t *frame;
+    int len = frameFromAdu(type, query, rc, &frame);
+    FaultAction action;
+    uint8_t adu[REPLY_MAX_LENGTH];
+    int replyLen;
+
+    if (len < 2 || 0 == faultDecide(faults, frame[0], frame[1], &action))
+        return modbus_reply(ctx, query, rc, mb_mapping);
+    if (action.drop)
+        return -1;
+
+    modbus_set_socket(ctx, faultPair[1]);
+    if (0 != action.exceptionCode)
+        replyLen = modbus_reply_exception(ctx, query, action.exceptionCode);
+    else
+        replyLen = modbus_reply(ctx, query, rc, mb_mapping);
+    modbus_set_socket(ctx, fd);
+    /* rtu broadcasts are not answered */
+    if (replyLen <= 0)
+        return replyLen;
+
+    replyLen = read(faultPair[0], adu, sizeof(adu));
+    if (replyLen <= 0)
+        return -1;
+    if (action.corrupt)
+        faultCorrupt(adu, replyLen, type);
+    if (0 == action.delayUs
+            || 0 == replyQueueAdd(&delayedReplies, mbuClockNs(CLOCK_MONOTONIC) + action.delayUs * 1000ULL, fd, adu, replyLen))
+        sendReply(fd, adu, replyLen);
+
+    return replyLen;
+}
+
+static void replicateQuery(const uint8_t query[], int rc, MbuConnType type)
+{
+    const uint8_t *frame;
+    int len = frameFromAdu(type, query, rc, &frame);
+    replicationRecord(replication, frame, len);
+}
+
+/* Writes go to the primary, replicas only follow it */
+static int refusedByReplica(const uint8_t query[], int rc, MbuConnType type)
+{
+    const uint8_t *frame;
+    int len = frameFromAdu(type, query, rc, &frame);
+    return replicationIsWrite(frame, len);
+}
+
+static int reply(int fd, MbuConnType type, const uint8_t query[], int rc)
+{
+    if (replica != NULL && refusedByReplica(query, rc, type))
+        return modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+    return (faults != NULL) ? replyWithFaults(fd, type, query, rc) : modbus_reply(ctx, query, rc, mb_mapping);
+}
+
+/* Serves the query of a tcp or unix client, unless the gateway forwards it */
+static void serveQuery(int fd, MbuConnType type, const uint8_t query[], int rc, uint64_t readyNs)
+{
+    int replyLen;
 
-    exit(dummy);
+    if (capture != NULL)
+        captureQuery(query, rc, type);
+    if (gateway != NULL && 0 != gatewaySubmit(gateway, fd, query, rc))
+        return;
+    replyLen = reply(fd, type, query, rc);
+    latencyRecord(&replyStats, mbuClockNs(CLOCK_MONOTONIC) - readyNs);
+    if (heatmap != NULL)
+        profileQuery(query, rc, type, fd);
+    if (tracer != NULL)
+        traceReply(query, rc, type, fd, replyLen, readyNs);
+    /* Refused and dropped requests changed nothing */
+    if (replication != NULL && replyLen > 0 && 0 == isExceptionReply(type, replyLen))
+        replicateQuery(query, rc, type);
+}
+
+/*
+ * Whole ADUs are needed to be forwarded (libmodbus would check the unit), they are put together
+ * without blocking, so a client sending a part of one does not hold up the others.
+ * Returns the number of queries served or -1 if the connection is to be closed.
+ */
+static int serveGatewayClient(int fd, MbuConnType type, uint64_t readyNs)
+{
+    CodecStream *stream = &gatewayStreams[fd];
+    const uint8_t *adu;
+    int len;
+    int servedNo = 0;
+
+    if (0 == codecStreamFill(stream, fd))
+        return -1;
+    while ((len = codecStreamNext(stream, &adu)) > 0) {
+        serveQuery(fd, type, adu, len, readyNs);
+        ++servedNo;
+    }
+    if (CodecInvalid == len) {
+        printf("Not a modbus tcp stream on socket %d\n", fd);
+        return -1;
+    }
+    return servedNo;
+}
+
+/*
+ * Waits for the request with SIGINT let in (libmodbus would go on waiting after it), sending
+ * delayed replies as they become due; returns 0 on timeout or signal
+ */
+static int waitForRequest(int fd, const sigset_t *waitMask)
+{
+    uint64_t dueNs = (faults != NULL) ? replyQueueNextNs(&delayedReplies) : UINT64_MAX;
+    uint64_t nowNs = mbuClockNs(CLOCK_MONOTONIC);
+    struct timespec timeout;
+    fd_set rdset;
+
+    if (dueNs > nowNs) {
+        timeout.tv_sec = (dueNs - nowNs) / 1000000000ULL;
+        timeout.tv_nsec = (dueNs - nowNs) % 1000000000ULL;
+        FD_ZERO(&rdset);
+        FD_SET(fd, &rdset);
+        if (pselect(fd + 1, &rdset, NULL, NULL, (UINT64_MAX == dueNs) ? NULL : &timeout, waitMask) > 0)
+            return 1;
+    }
+    if (faults != NULL)
+        replyQueueSendDue(&delayedReplies, mbuClockNs(CLOCK_MONOTONIC));
+    return 0;
 }
 
 const char DebugOpt[]   = "debug";
 const char TcpOptVal[]  = "tcp";
 const char RtuOptVal[]  = "rtu";
+const char UnixOptVal[] = "unix";
+const char UdpOptVal[]  = "udp";
 const char DiscreteInputsNo[] = "di";
 const char CoilsNo[] = "co";
 const char InputRegistersNo[] = "ir";
 const char HoldingRegistersNo[] = "hr";
+const char LoadCoilsOpt[] = "load-co";
+const char LoadDiscreteInputsOpt[] = "load-di";
+const char LoadInputRegistersOpt[] = "load-ir";
+const char LoadHoldingRegistersOpt[] = "load-hr";
+const char CaptureOpt[] = "capture";
+const char GatewayOpt[] = "gateway";
+const char GatewayTtlOpt[] = "gateway-ttl";
+const char CpuOpt[] = "cpu";
+const char FifoOpt[] = "fifo";
+const char MlockOpt[] = "mlock";
+const char BusyPollOpt[] = "busy-poll";
+const char SpinOpt[] = "spin";
+const char QuickAckOpt[] = "quickack";
+const char TraceOpt[] = "trace";
+const char TraceSampleOpt[] = "trace-sample";
+const char FaultOpt[] = "fault";
+const char FaultSeedOpt[] = "fault-seed";
+const char HeatmapOpt[] = "heatmap";
+const char HeatmapAddressesOpt[] = "heatmap-addresses";
+const char HandoffOpt[] = "handoff";
+const char TakeoverOpt[] = "takeover";
+const char ReplicateOpt[] = "replicate";
+const char ReplicaOfOpt[] = "replica-of";
+
+/*
+ * Called when the new server connects to the handoff socket. Serving stops until it takes
+ * over (the process exits then) or gives up (serving goes on).
+ */
+static void handOver(const fd_set *refset, int fdmax, MbuConnType type)
+{
+    HandoffState state;
+    uint64_t drainEndNs = mbuClockNs(CLOCK_MONOTONIC) + HANDOFF_DRAIN_MS * 1000000ULL;
+    int conn, fd;
+
+    conn = accept(handoffSocket, NULL, NULL);
+    if (conn == -1) {
+        perror("Handoff accept() error");
+        return;
+    }
+
+    /* Answers owed to the clients are sent before the connections change hands */
+    if (faults != NULL)
+        replyQueueSendDue(&delayedReplies, UINT64_MAX);
+    while (gateway != NULL && 0 != gatewayPending(gateway)) {
+        if (mbuClockNs(CLOCK_MONOTONIC) > drainEndNs) {
+            printf("%d gateway transactions are not finished, their answers are lost\n", gatewayPending(gateway));
+            break;
+        }
+        usleep(1000);
+        gatewayDeliver(gateway);
+    }
+
+    memset(&state, 0, sizeof(state));
+    state.type = type;
+    state.serverSocket = server_socket;
+    state.controlSocket = handoffSocket;
+    state.mappingFd = sharedMapping->fd;
+    for (fd = 0; fd <= fdmax; ++fd) {
+        if (FD_ISSET(fd, refset) && fd != server_socket && fd != handoffSocket
+                && (gateway == NULL || fd != gateway->wakePipe[0])
+                && (replication == NULL || fd != replication->listenSocket)
+                && (replica == NULL || fd != replica->socket))
+            state.clients[state.clientsNo++] = fd;
+    }
+
+    if (0 != handoffSend(conn, &state) && 0 != handoffWaitAck(conn, HANDOFF_ACK_TIMEOUT_MS)) {
+        printf("New server has taken over %d connections\n", state.clientsNo);
+        close(conn);
+        close_server(0);
+    }
+    printf("New server has not taken over, serving on\n");
+    close(conn);
+}
+
+//arguments to start the server again, so that it takes over from this one
+static char **restartArguments(int argc, char **argv)
+{
+    static char takeoverArg[32];
+    char **args = (char**)calloc(argc + 2, sizeof(char*));
+    int i;
+
+    snprintf(takeoverArg, sizeof(takeoverArg), "--%s", TakeoverOpt);
+    for (i = 0; i < argc; ++i)
+        args[i] = argv[i];
+    for (i = 1; i < argc && 0 != strcmp(argv[i], takeoverArg); ++i)
+        ;
+    if (i == argc)
+        args[argc] = takeoverArg;
+    return args;
+}
+
+#define DEFAULT_HEATMAP_INTERVAL_S 10
 
 void printUsage(const char progName[]) {
-    printf("%s [--%s] -m{tcp|rtu}\n\t" \
+    printf("%s [--%s] -m{tcp|rtu|unix|udp}\n\t" \
            "[-a<slave-addr=1>] --%s<discrete-inputs-no>=100 --%s<coils-no>=100 --%s<input-registers-no>=100 --%s<holding-registers-no>=100\n\t" \
-           "[{rtu-params|tcp-params}]\n", progName, DebugOpt, DiscreteInputsNo, CoilsNo, InputRegistersNo, HoldingRegistersNo);           
+           "[--%s=<file>] [--%s=<file>] [--%s=<file>] [--%s=<file>]\n\t" \
+           "[--%s=<capture-file>] [--%s=<serialport>[:<baud>[:<8E1>]][@<units>] ... [--%s=<ms>=%d]]\n\t" \
+           "[--%s=<n>] [--%s=<priority>] [--%s] [--%s=<us>] [--%s] [--%s]\n\t" \
+           "[--%s=<trace-file> [--%s=<n>=1]]\n\t" \
+           "[--%s=<rule> ... [--%s=<n>]]\n\t" \
+           "[--%s[=<seconds>=%d] [--%s]]\n\t" \
+           "[--%s=<control-socket> [--%s]]\n\t" \
+           "[--%s=<replication-socket> | --%s=<replication-socket>]\n\t" \
+           "[{rtu-params|tcp-params|udp-params}] serialport|ip|socket-path\n", progName, DebugOpt, DiscreteInputsNo, CoilsNo, InputRegistersNo, HoldingRegistersNo,
+           LoadCoilsOpt, LoadDiscreteInputsOpt, LoadInputRegistersOpt, LoadHoldingRegistersOpt, CaptureOpt,
+           GatewayOpt, GatewayTtlOpt, GATEWAY_DEFAULT_TTL_MS, CpuOpt, FifoOpt, MlockOpt, BusyPollOpt, SpinOpt, QuickAckOpt,
+           TraceOpt, TraceSampleOpt, FaultOpt, FaultSeedOpt, HeatmapOpt, DEFAULT_HEATMAP_INTERVAL_S, HeatmapAddressesOpt,
+           HandoffOpt, TakeoverOpt, ReplicateOpt, ReplicaOfOpt);
+    printf("load files:\n" \
+           "\t*.csv - lines of <address>,<value>\n" \
+           "\tother - binary image, registers as big-endian words, bits packed LSB first\n");
+    printf("gateway (tcp, unix only):\n" \
+           "\trequests for units (e.g. 1,3,5-9, all if not given) are forwarded to rtu slaves on the serial port,\n" \
+           "\tother ones are served by the server; equal reads are sent once, answers are cached for --%s (0 - off)\n",
+           GatewayTtlOpt);
+    printf("low latency:\n" \
+           "\t--%s pins the server to the cpu, --%s runs it with SCHED_FIFO priority (1-99), --%s locks its memory,\n" \
+           "\t--%s sets SO_BUSY_POLL on client sockets, --%s polls sockets without sleeping, --%s acks requests\n" \
+           "\timmediately (tcp); tcp replies are never delayed (TCP_NODELAY)\n" \
+           "\treply latency statistics are printed on SIGUSR1 and on exit\n",
+           CpuOpt, FifoOpt, MlockOpt, BusyPollOpt, SpinOpt, QuickAckOpt);
+    printf("tracing (tcp, unix, rtu):\n" \
+           "\tbinary records of served requests are written to the file in the background, every n-th one;\n" \
+           "\trequests answered with an exception are always traced; read the file with modbus_tracedump\n");
+    printf("faults (tcp, unix, rtu):\n" \
+           "\trule: <unit|*>[/<function|*>]:<param>=<value>[,...], the first matching rule applies\n" \
+           "\tdelay=<ms>, jitter=<ms>, dist={uniform|normal|exp} - reply delay: mean +-jitter, normal with jitter as\n" \
+           "\t  standard deviation or exponential; other requests are served while a reply is delayed\n" \
+           "\tdrop=<p>, exception=<p>[/<code>=%d], corrupt=<p> - probability (0-1) of no reply, exception reply\n" \
+           "\t  and damaged reply (rtu crc, tcp transaction id); --%s makes them repeatable\n" \
+           "\te.g. --%s=3/0x03:delay=200,jitter=50,drop=0.05 --%s=*:exception=0.01/6\n",
+           FAULT_DEFAULT_EXCEPTION, FaultSeedOpt, FaultOpt, FaultOpt);
+    printf("heatmap:\n" \
+           "\tevery interval (and on exit) the hottest address ranges, request sizes per function and per client\n" \
+           "\tstats are printed; ranges are found by pages of %d addresses, --%s counts every address\n" \
+           "\t(2MB more memory); clients reading blocks piecewise are pointed out\n",
+           HEATMAP_PAGE_SIZE, HeatmapAddressesOpt);
+    printf("handoff (tcp, unix):\n" \
+           "\tthe register map is kept in shared memory; a server started with the same --%s and --%s gets\n" \
+           "\tthe map, the listening socket and the client connections of the running one, which then exits;\n" \
+           "\tSIGHUP makes the server start itself again that way (e.g. after an upgrade); load files are not\n" \
+           "\tread when taking over, registers of a resized map keep the values of common addresses\n",
+           HandoffOpt, TakeoverOpt);
+    printf("replication (tcp, unix):\n" \
+           "\t--%s makes the server primary: replicas connecting to the socket get a snapshot of its map\n" \
+           "\tand then every change, so reads can be spread over several servers; --%s starts a replica,\n" \
+           "\twhich answers writes with illegal function exception (01); a replica that falls behind or\n" \
+           "\tloses the primary serves the last known values and takes a new snapshot when reconnected\n",
+           ReplicateOpt, ReplicaOfOpt);
     printf("rtu-params:\n" \
            "\tb<baud-rate>=9600\n" \
            "\td{7|8}<data-bits>=8\n" \
            "\ts{1|2}<stop-bits>=1\n" \
            "\tp{none|even|odd}=even\n");
-    printf("tcp-params:\n" \
+    printf("tcp-params, udp-params:\n" \
            "\tp<port>=502\n");
 }
 
+static int setupLowLatency(int cpu, int fifoPriority, int lockMemory)
+{
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (-1 == sched_setaffinity(0, sizeof(cpus), &cpus)) {
+            printf("Cannot pin to cpu %d: %s\n", cpu, strerror(errno));
+            return 0;
+        }
+    }
+    if (fifoPriority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = fifoPriority;
+        if (-1 == sched_setscheduler(0, SCHED_FIFO, &param)) {
+            printf("Cannot set SCHED_FIFO priority %d: %s\n", fifoPriority, strerror(errno));
+            return 0;
+        }
+    }
+    if (lockMemory && -1 == mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        printf("Cannot lock memory: %s\n", strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+static void setupClientSocket(int fd, int family, int busyPollUs)
+{
+    int one = 1;
+
+    if (AF_INET == family || AF_INET6 == family) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (busyPollUs > 0 && -1 == setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs))) {
+        printf("Cannot set busy polling on socket %d: %s\n", fd, strerror(errno));
+    }
+}
+
 int main(int argc, char **argv)
 {
     int c;
     int ok;
     int rc;
 
-    BackendParams *backend = 0;
+    MbuBackendParams *backend = 0;
     int slaveAddr = 1;
     int debug = 0;
     int diNo = 100;
     int coilsNo = 100;
     int irNo = 100;
     int hrNo = 100;
+    const char *loadFiles[4] = {0, 0, 0, 0};//indexed with TableType
+    const char *captureFile = 0;
+    CaptureLog captureLog;
+    const char *gatewayPorts[GATEWAY_MAX_PORTS];
+    int gatewayPortsNo = 0;
+    int gatewayTtlMs = GATEWAY_DEFAULT_TTL_MS;
+    Gateway gatewayState;
+    int cpu = -1;
+    int fifoPriority = 0;
+    int lockMemory = 0;
+    int busyPollUs = 0;
+    int spin = 0;
+    int quickAck = 0;
+    const char *traceFile = 0;
+    int traceSample = 1;
+    Tracer tracerState;
+    FaultPlan faultPlan;
+    int faultSeed = 0;
+    int heatmapIntervalS = 0;
+    int heatmapAddresses = 0;
+    const char *handoffPath = 0;
+    int takeover = 0;
+    HandoffState takenOver;
+    int takeoverConn = -1;
+    const char *replicatePath = 0;
+    const char *replicaOfPath = 0;
+    ReplicationPrimary replicationState;
+    ReplicationReplica replicaState;
+    sigset_t stopSignals;
+    sigset_t waitMask;//while waiting for requests, SIGINT is blocked otherwise
 
     while (1) {
         int option_index = 0;
@@ -109,6 +614,29 @@ int main(int argc, char **argv)
             {CoilsNo, required_argument, 0, 0},
             {InputRegistersNo, required_argument, 0, 0},
             {HoldingRegistersNo, required_argument, 0, 0},
+            {LoadCoilsOpt, required_argument, 0, 0},
+            {LoadDiscreteInputsOpt, required_argument, 0, 0},
+            {LoadInputRegistersOpt, required_argument, 0, 0},
+            {LoadHoldingRegistersOpt, required_argument, 0, 0},
+            {CaptureOpt, required_argument, 0, 0},
+            {GatewayOpt, required_argument, 0, 0},
+            {GatewayTtlOpt, required_argument, 0, 0},
+            {CpuOpt, required_argument, 0, 0},
+            {FifoOpt, required_argument, 0, 0},
+            {MlockOpt, no_argument, 0, 0},
+            {BusyPollOpt, required_argument, 0, 0},
+            {SpinOpt, no_argument, 0, 0},
+            {QuickAckOpt, no_argument, 0, 0},
+            {TraceOpt, required_argument, 0, 0},
+            {TraceSampleOpt, required_argument, 0, 0},
+            {FaultOpt, required_argument, 0, 0},
+            {FaultSeedOpt, required_argument, 0, 0},
+            {HeatmapOpt, optional_argument, 0, 0},
+            {HeatmapAddressesOpt, no_argument, 0, 0},
+            {HandoffOpt, required_argument, 0, 0},
+            {TakeoverOpt, no_argument, 0, 0},
+            {ReplicateOpt, required_argument, 0, 0},
+            {ReplicaOfOpt, required_argument, 0, 0},
             {0, 0,  0,  0}
         };
 
@@ -124,7 +652,7 @@ int main(int argc, char **argv)
                 debug = 1;
             }
             else if (0 == strcmp(long_options[option_index].name, DiscreteInputsNo)) {
-                diNo = getInt(optarg, &ok);
+                diNo = mbuGetInt(optarg, &ok);
                 if (0 == ok || diNo < 0) {
                     printf("Cannot set discrete inputs no from %s", optarg);
                     printUsage(argv[0]);
@@ -132,7 +660,7 @@ int main(int argc, char **argv)
                 }
             }
             else if (0 == strcmp(long_options[option_index].name, CoilsNo)) {
-                coilsNo = getInt(optarg, &ok);
+                coilsNo = mbuGetInt(optarg, &ok);
                 if (0 == ok || coilsNo < 0) {                
                     printf("Cannot set discrete coils no from %s", optarg);
                     printUsage(argv[0]);
@@ -140,7 +668,7 @@ int main(int argc, char **argv)
                 }
             }
             else if (0 == strcmp(long_options[option_index].name, InputRegistersNo)) {
-                irNo = getInt(optarg, &ok);
+                irNo = mbuGetInt(optarg, &ok);
                 if (0 == ok || irNo < 0) {
                     printf("Cannot set input registers no from %s", optarg);
                     printUsage(argv[0]);
@@ -148,18 +676,137 @@ int main(int argc, char **argv)
                 }
             }
             else if (0 == strcmp(long_options[option_index].name, HoldingRegistersNo)) {
-                hrNo = getInt(optarg, &ok);
+                hrNo = mbuGetInt(optarg, &ok);
                 if (0 == ok || hrNo < 0) {
                     printf("Cannot set holding registers no from %s\n", optarg);
                     printUsage(argv[0]);
                     exit(EXIT_FAILURE);
                 }
             }
+            else if (0 == strcmp(long_options[option_index].name, LoadCoilsOpt)) {
+                loadFiles[TableCoils] = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, LoadDiscreteInputsOpt)) {
+                loadFiles[TableDiscreteInputs] = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, LoadInputRegistersOpt)) {
+                loadFiles[TableInputRegisters] = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, LoadHoldingRegistersOpt)) {
+                loadFiles[TableHoldingRegisters] = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, CaptureOpt)) {
+                captureFile = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, GatewayOpt)) {
+                if (GATEWAY_MAX_PORTS == gatewayPortsNo) {
+                    printf("At most %d gateway ports are supported\n", GATEWAY_MAX_PORTS);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                gatewayPorts[gatewayPortsNo++] = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, GatewayTtlOpt)) {
+                gatewayTtlMs = mbuGetInt(optarg, &ok);
+                if (0 == ok || gatewayTtlMs < 0) {
+                    printf("Gateway cache time (%s) is invalid\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, CpuOpt)) {
+                cpu = mbuGetInt(optarg, &ok);
+                if (0 == ok || cpu < 0 || cpu >= CPU_SETSIZE) {
+                    printf("Cpu number (%s) is invalid\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, FifoOpt)) {
+                fifoPriority = mbuGetInt(optarg, &ok);
+                if (0 == ok || fifoPriority < 1 || fifoPriority > 99) {
+                    printf("SCHED_FIFO priority (%s) should be 1-99\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, MlockOpt)) {
+                lockMemory = 1;
+            }
+            else if (0 == strcmp(long_options[option_index].name, BusyPollOpt)) {
+                busyPollUs = mbuGetInt(optarg, &ok);
+                if (0 == ok || busyPollUs < 0) {
+                    printf("Busy poll time (%s) is invalid\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, SpinOpt)) {
+                spin = 1;
+            }
+            else if (0 == strcmp(long_options[option_index].name, QuickAckOpt)) {
+                quickAck = 1;
+            }
+            else if (0 == strcmp(long_options[option_index].name, TraceOpt)) {
+                traceFile = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, TraceSampleOpt)) {
+                traceSample = mbuGetInt(optarg, &ok);
+                if (0 == ok || traceSample < 1) {
+                    printf("Trace sampling (%s) should be a positive integer\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, FaultOpt)) {
+                if (faults == NULL) {
+                    faultPlanInit(&faultPlan, 0);
+                    faults = &faultPlan;
+                }
+                if (0 == faultAddRule(faults, optarg)) {
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, FaultSeedOpt)) {
+                faultSeed = mbuGetInt(optarg, &ok);
+                if (0 == ok || faultSeed <= 0) {
+                    printf("Fault seed (%s) should be a positive integer\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, HeatmapOpt)) {
+                heatmapIntervalS = DEFAULT_HEATMAP_INTERVAL_S;
+                if (NULL != optarg) {
+                    heatmapIntervalS = mbuGetInt(optarg, &ok);
+                    if (0 == ok || heatmapIntervalS <= 0) {
+                        printf("Heatmap interval (%s) should be a positive number of seconds\n", optarg);
+                        printUsage(argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, HeatmapAddressesOpt)) {
+                heatmapAddresses = 1;
+            }
+            else if (0 == strcmp(long_options[option_index].name, HandoffOpt)) {
+                handoffPath = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, TakeoverOpt)) {
+                takeover = 1;
+            }
+            else if (0 == strcmp(long_options[option_index].name, ReplicateOpt)) {
+                replicatePath = optarg;
+            }
+            else if (0 == strcmp(long_options[option_index].name, ReplicaOfOpt)) {
+                replicaOfPath = optarg;
+            }
 
             break;
 
         case 'a': {
-            slaveAddr = getInt(optarg, &ok);
+            slaveAddr = mbuGetInt(optarg, &ok);
             if (0 == ok) {
                 printf("Slave address (%s) is not integer!\n\n", optarg);
                 printUsage(argv[0]);
@@ -170,10 +817,14 @@ int main(int argc, char **argv)
 
         case 'm':
             if (0 == strcmp(optarg, TcpOptVal)) {
-                backend = createTcpBackend();
+                backend = mbuCreateTcpBackend();
             }
             else if (0 == strcmp(optarg, RtuOptVal))
-                backend = createRtuBackend();
+                backend = mbuCreateRtuBackend();
+            else if (0 == strcmp(optarg, UnixOptVal))
+                backend = mbuCreateUnixBackend();
+            else if (0 == strcmp(optarg, UdpOptVal))
+                backend = mbuCreateUdpBackend();
             else {
                 printf("Unrecognized connection type %s\n\n", optarg);
                 printUsage(argv[0]);
@@ -213,43 +864,201 @@ int main(int argc, char **argv)
     }
 
     if (1 == argc - optind) {
-        if (Rtu == backend->type) {
-            RtuBackend *rtuP = (RtuBackend*)backend;
-            strcpy(rtuP->devName, argv[optind]);
-        }
-        else if (Tcp == backend->type) {
-            TcpBackend *tcpP = (TcpBackend*)backend;
-            strcpy(tcpP->ip, argv[optind]);
-        }
+        mbuSetBackendAddress(backend, argv[optind]);
     }
     else {
-        printf("Expecting only serialport|ip as free parameter!\n");
+        printf("Expecting only serialport|ip|socket-path as free parameter!\n");
         printUsage(argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    //prepare mapping
-    mb_mapping = modbus_mapping_new(coilsNo, diNo, hrNo, irNo);
-    if (mb_mapping == NULL) {
-        fprintf(stderr, "Failed to allocate the mapping: %s\n",
-                modbus_strerror(errno));
+    if (0 != handoffPath) {
+        if (MbuTcp != backend->type && MbuUnix != backend->type) {
+            printf("Handoff is supported only with tcp or unix connection!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        restartArgv = restartArguments(argc, argv);
+    }
+    else if (0 != takeover) {
+        printf("Taking over needs --%s socket of the running server\n", HandoffOpt);
+        printUsage(argv[0]);
         exit(EXIT_FAILURE);
     }
+
+    if (0 != replicatePath || 0 != replicaOfPath) {
+        if (MbuTcp != backend->type && MbuUnix != backend->type) {
+            printf("Replication is supported only with tcp or unix connection!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (0 != replicatePath && 0 != replicaOfPath) {
+            printf("Server is either primary (--%s) or replica (--%s)\n", ReplicateOpt, ReplicaOfOpt);
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (0 != takeover) {
+        SharedMapping *previous;
+
+        takeoverConn = handoffReceive(handoffPath, &takenOver);
+        if (-1 == takeoverConn) {
+            exit(EXIT_FAILURE);
+        }
+        if (takenOver.type != backend->type) {
+            printf("Running server uses other connection type\n");
+            exit(EXIT_FAILURE);
+        }
+        previous = sharedMappingAttach(takenOver.mappingFd);
+        if (previous == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        if (previous->mapping.nb_bits == coilsNo && previous->mapping.nb_input_bits == diNo
+                && previous->mapping.nb_registers == hrNo && previous->mapping.nb_input_registers == irNo) {
+            sharedMapping = previous;
+        }
+        else {
+            sharedMapping = sharedMappingNew(coilsNo, diNo, hrNo, irNo);
+            if (sharedMapping == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            copyMapping(&sharedMapping->mapping, &previous->mapping);
+            sharedMappingFree(previous);
+            printf("Register map is resized, values of common addresses are kept\n");
+        }
+        mb_mapping = &sharedMapping->mapping;
+    }
+    //prepare mapping
+    else if (0 != handoffPath) {
+        sharedMapping = sharedMappingNew(coilsNo, diNo, hrNo, irNo);
+        if (sharedMapping == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        mb_mapping = &sharedMapping->mapping;
+    }
+    else {
+        mb_mapping = modbus_mapping_new(coilsNo, diNo, hrNo, irNo);
+        if (mb_mapping == NULL) {
+            fprintf(stderr, "Failed to allocate the mapping: %s\n",
+                    modbus_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
     if (debug)
         printf("Ranges: \n \tCoils: 0-0x%04x\n\tDigital inputs: 0-0x%04x\n\tHolding registers: 0-0x%04x\n\tInput registers: 0-0x%04x\n",
                coilsNo, diNo, hrNo, irNo);
 
+    if (0 == takeover) {
+        int table;
+        for (table = TableCoils; table <= TableInputRegisters; ++table) {
+            if (0 != loadFiles[table] && 0 == preloadTable(mb_mapping, (TableType)table, loadFiles[table])) {
+                free_mapping();
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if (0 != replicaOfPath) {
+        /* Snapshot of the primary replaces the loaded values */
+        if (0 == replicaConnect(&replicaState, replicaOfPath, mb_mapping)) {
+            printf("Cannot replicate primary %s\n", replicaOfPath);
+            free_mapping();
+            exit(EXIT_FAILURE);
+        }
+        replica = &replicaState;
+    }
+
     if (0 == backend) {
         printf("No backend has been specified!\n");
         printUsage(argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    /* SIGINT is let in only while the serving loop waits; threads started from now on keep it blocked */
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigprocmask(SIG_BLOCK, &stopSignals, &waitMask);
+
+    if (0 != captureFile) {
+        if (0 == captureOpen(&captureLog, captureFile)) {
+            exit(EXIT_FAILURE);
+        }
+        capture = &captureLog;
+    }
+    if (0 != traceFile) {
+        if (0 == traceOpen(&tracerState, traceFile, traceSample)) {
+            exit(EXIT_FAILURE);
+        }
+        tracer = &tracerState;
+    }
+    if (0 != heatmapAddresses && 0 == heatmapIntervalS) {
+        heatmapIntervalS = DEFAULT_HEATMAP_INTERVAL_S;
+    }
+    if (0 != heatmapIntervalS) {
+        heatmap = heatmapCreate(heatmapAddresses);
+        if (heatmap == NULL) {
+            printf("Cannot allocate heatmap\n");
+            exit(EXIT_FAILURE);
+        }
+        heatmapIntervalNs = heatmapIntervalS * 1000000000ULL;
+        heatmapDueNs = mbuClockNs(CLOCK_MONOTONIC) + heatmapIntervalNs;
+    }
+    if (faults != NULL) {
+        if (MbuUdp == backend->type) {
+            printf("Faults are not supported with udp connection\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (0 != faultSeed)
+            faults->rng = faultSeed;
+        if (-1 == socketpair(AF_UNIX, SOCK_DGRAM, 0, faultPair) || 0 == replyQueueInit(&delayedReplies, REPLY_QUEUE_CAPACITY)) {
+            printf("Cannot set up fault injection: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (0 != gatewayPortsNo) {
+        int i;
+        if (MbuTcp != backend->type && MbuUnix != backend->type) {
+            printf("Gateway is supported only with tcp or unix connection!\n");
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (0 == gatewayInit(&gatewayState, gatewayTtlMs)) {
+            exit(EXIT_FAILURE);
+        }
+        gateway = &gatewayState;
+        gatewayStreams = calloc(FD_SETSIZE, sizeof(CodecStream));
+        if (gatewayStreams == NULL) {
+            printf("Cannot allocate gateway buffers\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < gatewayPortsNo; ++i) {
+            if (0 == gatewayAddPort(gateway, gatewayPorts[i])) {
+                printUsage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (0 == gatewayStart(gateway)) {
+            gatewayStop(gateway);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     ctx = backend->createCtxt(backend);
     modbus_set_debug(ctx, debug);
     modbus_set_slave(ctx, slaveAddr);
 
-    if (Rtu == backend->type) {
+    if (0 == setupLowLatency(cpu, fifoPriority, lockMemory)) {
+        exit(EXIT_FAILURE);
+    }
+    latencyInit(&replyStats);
+    signal(SIGUSR1, request_stats);
+    setupAllocationsNo = heapAllocationsNo();
+
+    if (MbuRtu == backend->type) {
+        signal(SIGINT, request_stop);
 
         for(;;) {
 
@@ -260,14 +1069,36 @@ int main(int argc, char **argv)
             for (;;) {
                 uint8_t query[MODBUS_RTU_MAX_ADU_LENGTH];
 
-                rc = modbus_receive(ctx, query);
+                if (0 == waitForRequest(modbus_get_socket(ctx), &waitMask)) {
+                    if (stopSignal)
+                        close_server(stopSignal);
+                    rc = 0;
+                }
+                else {
+                    rc = modbus_receive(ctx, query);
+                }
                 if (rc > 0) {
+                    uint64_t receivedNs = mbuClockNs(CLOCK_MONOTONIC);
+                    int replyLen;
+                    if (capture != NULL)
+                        captureQuery(query, rc, backend->type);
+                    if (heatmap != NULL)
+                        profileQuery(query, rc, backend->type, modbus_get_socket(ctx));
                     /* rc is the query size */
-                    modbus_reply(ctx, query, rc, mb_mapping);
+                    replyLen = reply(modbus_get_socket(ctx), backend->type, query, rc);
+                    latencyRecord(&replyStats, mbuClockNs(CLOCK_MONOTONIC) - receivedNs);
+                    if (tracer != NULL)
+                        traceReply(query, rc, backend->type, modbus_get_socket(ctx), replyLen, receivedNs);
                 } else if (rc == -1) {
                     /* Connection closed by the client or error */
                     break;
                 }
+                if (heatmap != NULL)
+                    dumpHeatmapIfDue();
+                if (statsRequested) {
+                    statsRequested = 0;
+                    print_stats();
+                }
             }
             printf("Client disconnected: %s\n", modbus_strerror(errno));
 
@@ -275,7 +1106,40 @@ int main(int argc, char **argv)
         }
 
     }
-    else if (Tcp == backend->type) {
+    else if (MbuUdp == backend->type) {
+        uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+
+        server_socket = backend->listenSocket(backend, ctx, NB_CONNECTION);
+        if (server_socket == -1) {
+            fprintf(stderr, "Unable to bind UDP socket\n");
+            modbus_free(ctx);
+            return -1;
+        }
+
+        signal(SIGINT, request_stop);
+
+        for (;;) {
+            fd_set rdset;
+
+            /* SIGINT is let in only while waiting, so it cannot be missed between the check and the wait */
+            FD_ZERO(&rdset);
+            FD_SET(server_socket, &rdset);
+            rc = pselect(server_socket + 1, &rdset, NULL, NULL, NULL, &waitMask);
+            if (stopSignal)
+                close_server(stopSignal);
+            if (rc <= 0)
+                continue;
+            mbuServeUdpDatagram(backend, ctx, query, mb_mapping,
+                                (capture != NULL || heatmap != NULL) ? &onUdpQuery : NULL);
+            if (heatmap != NULL)
+                dumpHeatmapIfDue();
+            if (statsRequested) {
+                statsRequested = 0;
+                print_stats();
+            }
+        }
+    }
+    else if (MbuTcp == backend->type || MbuUnix == backend->type) {
         uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
         int master_socket;
         fd_set refset;
@@ -283,14 +1147,36 @@ int main(int argc, char **argv)
         /* Maximum file descriptor number */
         int fdmax;
 
-        server_socket = modbus_tcp_listen(ctx, NB_CONNECTION);
-        if (server_socket == -1) {
-            fprintf(stderr, "Unable to listen TCP connection\n");
-            modbus_free(ctx);
-            return -1;
+        if (-1 != takeoverConn) {
+            server_socket = takenOver.serverSocket;
+            handoffSocket = takenOver.controlSocket;
+        }
+        else {
+            server_socket = backend->listenSocket(backend, ctx, NB_CONNECTION);
+            if (server_socket == -1) {
+                fprintf(stderr, "Unable to listen for connections\n");
+                modbus_free(ctx);
+                return -1;
+            }
+            if (0 != handoffPath && -1 == (handoffSocket = handoffListen(handoffPath))) {
+                modbus_free(ctx);
+                return -1;
+            }
+        }
+        if (0 != replicatePath) {
+            if (0 == replicationListen(&replicationState, replicatePath, mb_mapping)) {
+                modbus_free(ctx);
+                return -1;
+            }
+            replication = &replicationState;
         }
 
-        signal(SIGINT, close_sigint);
+        signal(SIGINT, request_stop);
+        if (0 != handoffPath) {
+            signal(SIGHUP, request_restart);
+            /* Started servers which fail to take over are not waited for */
+            signal(SIGCHLD, SIG_IGN);
+        }
 
         /* Clear the reference set of socket */
         FD_ZERO(&refset);
@@ -300,12 +1186,118 @@ int main(int argc, char **argv)
         /* Keep track of the max file descriptor */
         fdmax = server_socket;
 
+        if (gateway != NULL) {
+            /* Workers tell about finished serial transactions through the pipe */
+            FD_SET(gateway->wakePipe[0], &refset);
+            if (gateway->wakePipe[0] > fdmax)
+                fdmax = gateway->wakePipe[0];
+        }
+
+        if (-1 != handoffSocket) {
+            FD_SET(handoffSocket, &refset);
+            if (handoffSocket > fdmax)
+                fdmax = handoffSocket;
+        }
+
+        if (replication != NULL) {
+            FD_SET(replication->listenSocket, &refset);
+            if (replication->listenSocket > fdmax)
+                fdmax = replication->listenSocket;
+        }
+
+        if (replica != NULL) {
+            FD_SET(replica->socket, &refset);
+            if (replica->socket > fdmax)
+                fdmax = replica->socket;
+        }
+
+        if (-1 != takeoverConn) {
+            int i;
+            for (i = 0; i < takenOver.clientsNo; ++i) {
+                int fd = takenOver.clients[i];
+                if (fd >= FD_SETSIZE) {
+                    printf("Taken over socket %d cannot be served, closed\n", fd);
+                    close(fd);
+                    continue;
+                }
+                FD_SET(fd, &refset);
+                if (fd > fdmax)
+                    fdmax = fd;
+                if (heatmap != NULL)
+                    heatmapClientOpened(heatmap, fd, "taken over");
+            }
+            /* The previous server exits when it confirms, it does not touch the registers any more */
+            if (0 == handoffAck(takeoverConn, HANDOFF_ACK_TIMEOUT_MS)) {
+                printf("Running server has not handed over, it goes on serving\n");
+                for (i = 0; i < takenOver.clientsNo; ++i)
+                    close(takenOver.clients[i]);
+                close(server_socket);
+                close(handoffSocket);
+                close(takeoverConn);
+                exit(EXIT_FAILURE);
+            }
+            close(takeoverConn);
+            printf("Took over %d connections\n", takenOver.clientsNo);
+        }
+
         for (;;) {
+            struct timespec timeout = {0, 0};
+            struct timespec *wait = spin ? &timeout : NULL;
+            uint64_t dueNs = heatmapDueNs;
+            uint64_t readyNs;
+
+            /* Wake up for the earliest delayed reply, heatmap dump or reconnection to the primary */
+            if (faults != NULL && replyQueueNextNs(&delayedReplies) < dueNs)
+                dueNs = replyQueueNextNs(&delayedReplies);
+            if (replicaRetryNs < dueNs)
+                dueNs = replicaRetryNs;
+            if (NULL == wait && UINT64_MAX != dueNs) {
+                uint64_t nowNs = mbuClockNs(CLOCK_MONOTONIC);
+                if (dueNs > nowNs) {
+                    timeout.tv_sec = (dueNs - nowNs) / 1000000000ULL;
+                    timeout.tv_nsec = (dueNs - nowNs) % 1000000000ULL;
+                }
+                wait = &timeout;
+            }
+
             rdset = refset;
-            if (select(fdmax+1, &rdset, NULL, NULL, NULL) == -1) {
+            /* Spinning keeps the cpu busy, but a request is seen as soon as it arrives */
+            rc = pselect(fdmax+1, &rdset, NULL, NULL, wait, &waitMask);
+            if (stopSignal) {
+                close_server(stopSignal);
+            }
+            if (rc == -1 && errno != EINTR) {
                 perror("Server select() failure.");
-                close_sigint(1);
+                close_server(1);
+            }
+            if (faults != NULL)
+                replyQueueSendDue(&delayedReplies, mbuClockNs(CLOCK_MONOTONIC));
+            if (heatmap != NULL)
+                dumpHeatmapIfDue();
+            if (statsRequested) {
+                statsRequested = 0;
+                print_stats();
+            }
+            if (restartRequested) {
+                restartRequested = 0;
+                if (-1 != handoffSpawn(restartArgv))
+                    printf("Restarting, the new server takes over on %s\n", handoffPath);
             }
+            if (replica != NULL && mbuClockNs(CLOCK_MONOTONIC) >= replicaRetryNs) {
+                if (0 != replicaConnect(replica, replica->path, mb_mapping)) {
+                    FD_SET(replica->socket, &refset);
+                    if (replica->socket > fdmax)
+                        fdmax = replica->socket;
+                    replicaRetryNs = UINT64_MAX;
+                }
+                else {
+                    replicaRetryNs = mbuClockNs(CLOCK_MONOTONIC) + REPLICA_RETRY_MS * 1000000ULL;
+                }
+            }
+            if (rc <= 0) {
+                continue;
+            }
+            readyNs = mbuClockNs(CLOCK_MONOTONIC);
 
             /* Run through the existing connections looking for data to be
              * read */
@@ -315,10 +1307,21 @@ int main(int argc, char **argv)
                     continue;
                 }
 
-                if (master_socket == server_socket) {
+                if (gateway != NULL && master_socket == gateway->wakePipe[0]) {
+                    gatewayDeliver(gateway);
+                } else if (master_socket == handoffSocket) {
+                    handOver(&refset, fdmax, backend->type);
+                } else if (replication != NULL && master_socket == replication->listenSocket) {
+                    replicationAccept(replication);
+                } else if (replica != NULL && master_socket == replica->socket) {
+                    if (0 == replicaReceive(replica)) {
+                        FD_CLR(master_socket, &refset);
+                        replicaRetryNs = mbuClockNs(CLOCK_MONOTONIC) + REPLICA_RETRY_MS * 1000000ULL;
+                    }
+                } else if (master_socket == server_socket) {
                     /* A client is asking a new connection */
                     socklen_t addrlen;
-                    struct sockaddr_in clientaddr;
+                    struct sockaddr_storage clientaddr;
                     int newfd;
 
                     /* Handle new connections */
@@ -329,20 +1332,50 @@ int main(int argc, char **argv)
                         perror("Server accept() error");
                     } else {
                         FD_SET(newfd, &refset);
+                        setupClientSocket(newfd, clientaddr.ss_family, busyPollUs);
 
                         if (newfd > fdmax) {
                             /* Keep track of the maximum */
                             fdmax = newfd;
                         }
-                        printf("New connection from %s:%d on socket %d\n",
-                            inet_ntoa(clientaddr.sin_addr), clientaddr.sin_port, newfd);
+                        if (AF_INET == clientaddr.ss_family) {
+                            struct sockaddr_in *inaddr = (struct sockaddr_in *)&clientaddr;
+                            char name[32];
+                            printf("New connection from %s:%d on socket %d\n",
+                                inet_ntoa(inaddr->sin_addr), ntohs(inaddr->sin_port), newfd);
+                            snprintf(name, sizeof(name), "%s:%d", inet_ntoa(inaddr->sin_addr), ntohs(inaddr->sin_port));
+                            if (heatmap != NULL)
+                                heatmapClientOpened(heatmap, newfd, name);
+                        }
+                        else {
+                            printf("New local connection on socket %d\n", newfd);
+                        }
                     }
                 } else {
                     modbus_set_socket(ctx, master_socket);
-                    rc = modbus_receive(ctx, query);
+                    if (gateway != NULL) {
+                        rc = serveGatewayClient(master_socket, backend->type, readyNs);
+                    }
+                    else {
+                        rc = modbus_receive(ctx, query);
+                        if (rc > 0)
+                            serveQuery(master_socket, backend->type, query, rc, readyNs);
+                    }
                     if (rc > 0) {
-                        modbus_reply(ctx, query, rc, mb_mapping);
+                        if (quickAck && MbuTcp == backend->type) {
+                            /* Kernel turns quick ack mode off again, it has to be renewed */
+                            int one = 1;
+                            setsockopt(master_socket, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+                        }
                     } else if (rc == -1) {
+                        if (gateway != NULL) {
+                            gatewayDrop(gateway, master_socket);
+                            codecStreamReset(&gatewayStreams[master_socket]);
+                        }
+                        if (faults != NULL)
+                            replyQueueDrop(&delayedReplies, master_socket);
+                        if (heatmap != NULL)
+                            heatmapClientClosed(heatmap, master_socket);
                         /* This example server in ended on connection closing or
                          * any errors. */
                         printf("Connection closed on socket %d\n", master_socket);
@@ -357,10 +1390,23 @@ int main(int argc, char **argv)
                     }
                 }
             }
+            /* Changes of the whole round go to the replicas at once */
+            if (replication != NULL)
+                replicationFlush(replication);
         }
     }
 
-    modbus_mapping_free(mb_mapping);
+    if (capture != NULL)
+        captureClose(capture);
+    if (tracer != NULL)
+        traceClose(tracer);
+    if (heatmap != NULL) {
+        heatmapDump(heatmap, stdout);
+        heatmapDelete(heatmap);
+    }
+    if (gateway != NULL)
+        gatewayStop(gateway);
+    free_mapping();
     modbus_close(ctx);
     modbus_free(ctx);
     backend->del(backend);
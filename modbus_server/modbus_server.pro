@@ -9,10 +9,11 @@ DEPENDPATH += .
 INCLUDEPATH += .
 
 # Input
-SOURCES += modbus_server.c
+SOURCES += modbus_server.c \
+    $$files(../common/*.c)
 
 INCLUDEPATH += ../libmodbus/src \
     ../common
 
 LIBS += -L../libmodbus/src/.libs
-LIBS += -lmodbus
+LIBS += -lmodbus -pthread -lm
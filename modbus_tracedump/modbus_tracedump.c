@@ -0,0 +1,167 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+/*
+ * Decodes trace files written with --trace of modbus_server and modbus_client
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mbu-common.h"
+#include "mbu-trace.h"
+#include "mbu-latency.h"
+
+#define MAX_THREADS 1024
+
+const char FailedOpt[] = "failed";
+const char SlaveOpt[] = "slave";
+const char StatsOpt[] = "stats";
+
+void printUsage(const char progName[]) {
+    printf("%s [--%s] [--%s=<slave-addr>] [--%s] trace-file\n", progName, FailedOpt, SlaveOpt, StatsOpt);
+    printf("Prints csv lines: <timestamp>,<thread>,<seq>,{served|issued},<fd>,<slave>,<function>,<address>,<count>,\n" \
+           "\t<latency-us>,{ok|exception[:<code>]|failed}\n");
+    printf("NOTE: --%s prints only requests which got no normal response\n", FailedOpt);
+    printf("NOTE: with --%s only counts, latency percentiles and records lost to full rings are printed\n", StatsOpt);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int ok;
+    int rc;
+
+    int failedOnly = 0;
+    int slave = -1;
+    int stats = 0;
+    uint64_t recordsNo = 0;
+    uint64_t exceptionsNo = 0;
+    uint64_t failuresNo = 0;
+    uint64_t lostNo = 0;
+    static uint32_t lastSeq[MAX_THREADS];
+    LatencyStats latency;
+    TraceReader reader;
+    TraceRecord rec;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {FailedOpt, no_argument, 0, 0},
+            {SlaveOpt, required_argument, 0, 0},
+            {StatsOpt, no_argument, 0, 0},
+            {0, 0,  0,  0}
+        };
+
+        c = getopt_long(argc, argv, "", long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 0:
+            if (0 == strcmp(long_options[option_index].name, FailedOpt)) {
+                failedOnly = 1;
+            }
+            else if (0 == strcmp(long_options[option_index].name, SlaveOpt)) {
+                slave = mbuGetInt(optarg, &ok);
+                if (0 == ok) {
+                    printf("Slave address (%s) is not integer!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, StatsOpt)) {
+                stats = 1;
+            }
+            break;
+
+        case '?':
+            break;
+
+        default:
+            printf("?? getopt returned character code 0%o ??\n", c);
+        }
+    }
+
+    if (1 != argc - optind) {
+        printf("Expecting only trace file as free parameter!\n");
+        printUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 == traceReaderOpen(&reader, argv[optind])) {
+        exit(EXIT_FAILURE);
+    }
+
+    latencyInit(&latency);
+    while (1 == (rc = traceReaderNext(&reader, &rec))) {
+        uint64_t ts = rec.startNs + reader.realtimeOffsetNs;
+
+        //records of one thread come in order, sampling doesn't advance the sequence
+        if (rec.thread < MAX_THREADS) {
+            if (rec.seq > lastSeq[rec.thread] + 1)
+                lostNo += rec.seq - lastSeq[rec.thread] - 1;
+            lastSeq[rec.thread] = rec.seq;
+        }
+
+        if ((-1 != slave && slave != rec.slave) || (failedOnly && 0 == rec.failed && 0 == rec.exception))
+            continue;
+
+        recordsNo++;
+        exceptionsNo += (0 != rec.exception);
+        failuresNo += rec.failed;
+        latencyRecord(&latency, rec.latencyUs * 1000ULL);
+        if (stats)
+            continue;
+
+        printf("%llu.%06u,%u,%u,%s,%d,%u,%u,%u,%u,%u,", (unsigned long long)(ts / 1000000000ULL),
+               (unsigned)(ts % 1000000000ULL / 1000), rec.thread, rec.seq,
+               (TraceServed == rec.direction) ? "served" : "issued", rec.fd, rec.slave, rec.function,
+               rec.addr, rec.count, rec.latencyUs);
+        if (rec.failed)
+            printf("failed\n");
+        else if (TRACE_EXCEPTION_UNKNOWN == rec.exception)
+            printf("exception\n");
+        else if (0 != rec.exception)
+            printf("exception:%u\n", rec.exception);
+        else
+            printf("ok\n");
+    }
+    if (-1 == rc)
+        fprintf(stderr, "Trace is truncated after %llu records\n", (unsigned long long)recordsNo);
+
+    if (stats) {
+        printf("Records: %llu (%llu exceptions, %llu failures)\n", (unsigned long long)recordsNo,
+               (unsigned long long)exceptionsNo, (unsigned long long)failuresNo);
+        printf("Records lost to full rings: at least %llu\n", (unsigned long long)lostNo);
+        latencyPrint(&latency, "Latency", stdout);
+    }
+
+    traceReaderClose(&reader);
+    exit((-1 == rc) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
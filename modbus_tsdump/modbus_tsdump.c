@@ -0,0 +1,170 @@
+/*
+*  MIT License
+
+*  Copyright (c) 2013  Krzysztow
+
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*/
+
+/*
+ * Exports recordings made with modbus_client --record as csv
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mbu-common.h"
+#include "mbu-series.h"
+
+const char FromOpt[] = "from";
+const char ToOpt[] = "to";
+const char SlaveOpt[] = "slave";
+const char StatsOpt[] = "stats";
+
+void printUsage(const char progName[]) {
+    printf("%s [--%s=<epoch-s>] [--%s=<epoch-s>] [--%s=<slave-addr>] [--%s] recording-file\n",
+           progName, FromOpt, ToOpt, SlaveOpt, StatsOpt);
+    printf("Prints csv lines: <timestamp>,<slave>,<function>,<first-address>,<values>...\n");
+    printf("NOTE: with --%s only block and size statistics are printed\n", StatsOpt);
+}
+
+static int parseTime(const char str[], uint64_t *ns) {
+    double secs;
+    if (1 != sscanf(str, "%lf", &secs) || secs < 0)
+        return 0;
+    *ns = (uint64_t)(secs * 1e9);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int ok;
+    int rc;
+
+    uint64_t fromNs = 0;
+    uint64_t toNs = UINT64_MAX;
+    int slave = -1;
+    int stats = 0;
+    uint64_t blocksNo = 0;
+    uint64_t rowsNo = 0;
+    uint64_t valuesNo = 0;
+    SeriesReader reader;
+    const SeriesBlock *block;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {FromOpt, required_argument, 0, 0},
+            {ToOpt, required_argument, 0, 0},
+            {SlaveOpt, required_argument, 0, 0},
+            {StatsOpt, no_argument, 0, 0},
+            {0, 0,  0,  0}
+        };
+
+        c = getopt_long(argc, argv, "", long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 0:
+            if (0 == strcmp(long_options[option_index].name, FromOpt)) {
+                if (0 == parseTime(optarg, &fromNs)) {
+                    printf("Start time (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, ToOpt)) {
+                if (0 == parseTime(optarg, &toNs)) {
+                    printf("End time (%s) is invalid!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, SlaveOpt)) {
+                slave = mbuGetInt(optarg, &ok);
+                if (0 == ok) {
+                    printf("Slave address (%s) is not integer!\n\n", optarg);
+                    printUsage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (0 == strcmp(long_options[option_index].name, StatsOpt)) {
+                stats = 1;
+            }
+            break;
+
+        case '?':
+            break;
+
+        default:
+            printf("?? getopt returned character code 0%o ??\n", c);
+        }
+    }
+
+    if (1 != argc - optind) {
+        printf("Expecting only recording file as free parameter!\n");
+        printUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 == seriesReaderOpen(&reader, argv[optind])) {
+        exit(EXIT_FAILURE);
+    }
+
+    while (1 == (rc = seriesReaderNext(&reader, &block))) {
+        int r, i;
+
+        if ((-1 != slave && slave != block->slave) || block->ts[0] > toNs || block->ts[block->rows - 1] < fromNs)
+            continue;
+
+        blocksNo++;
+        for (r = 0; r < block->rows; ++r) {
+            const uint16_t *row = block->values + r * block->nb;
+            if (block->ts[r] < fromNs || block->ts[r] > toNs)
+                continue;
+
+            rowsNo++;
+            valuesNo += block->nb;
+            if (stats)
+                continue;
+            printf("%llu.%06u,%d,%d,%d", (unsigned long long)(block->ts[r] / 1000000000ULL),
+                   (unsigned)(block->ts[r] % 1000000000ULL / 1000), block->slave, block->fType, block->addr);
+            for (i = 0; i < block->nb; ++i)
+                printf(",%u", row[i]);
+            printf("\n");
+        }
+    }
+    if (-1 == rc)
+        fprintf(stderr, "Recording is truncated or corrupted after %llu blocks\n", (unsigned long long)blocksNo);
+
+    if (stats) {
+        printf("Blocks: %llu, rows: %llu, values: %llu, file: %llu bytes (%.2f bytes/value)\n",
+               (unsigned long long)blocksNo, (unsigned long long)rowsNo, (unsigned long long)valuesNo,
+               (unsigned long long)reader.file.size, valuesNo ? (double)reader.file.size / valuesNo : 0.0);
+    }
+
+    seriesReaderClose(&reader);
+    exit((-1 == rc) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -24,66 +24,66 @@
 #include <errno.h>
 
 #include "modbus.h"
-#include "modbus-private.h"
-#include "modbus-tcp-private.h"
+#include "mbu-pool.h"
 
 #include <pthread.h>
+#include <semaphore.h>
 
-modbus_t *modbus_clone_tcp(modbus_t* ctx)
-{	
-	modbus_t* new_ctx = (modbus_t *) malloc(sizeof(modbus_t));
-	memcpy(new_ctx, ctx, sizeof(modbus_t));
-	new_ctx->backend_data = (modbus_tcp_t *) malloc(sizeof(modbus_tcp_t));
-	memcpy(new_ctx->backend_data, ctx->backend_data, sizeof(modbus_tcp_t));
-
-	//modbus_tcp_t *mb_tcp = (modbus_tcp_t*)ctx->backend_data;
-	printf("Socket copied %d, should be %d\n", new_ctx->s, ctx->s);
-	ctx->s = 0;
-
-	return new_ctx;
-}
-
+#define MAX_CONNECTIONS 32
 
+/*
+ * Connections are served by threads started up front, each with its own context and
+ * buffer, so accepting and closing connections does not allocate anything.
+ */
 typedef struct {
-	modbus_t *ctxt;
-	modbus_mapping_t *mm;
+	modbus_t *ctx;
+	int socket;
 	int id;
-} SA;
+	sem_t start;
+	uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+} Connection;
+
+static MbuPool connections;
+static modbus_mapping_t *mb_mapping;
 
 void *serveClient(void *threadarg)
 {
-	SA *a;
-	a = (SA *) threadarg;
-	modbus_t *ctx = a->ctxt;
-	modbus_mapping_t *mb_mapping = a->mm;	
-	int id = a->id;
-	printf("(%d) Serving... %p\n", id, ctx);
+	Connection *c = (Connection *) threadarg;
+
 	for (;;) {
-		uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
-		int rc;
-		printf("(%d) receiving...\n", id);
-		rc = modbus_receive(ctx, query);
-		if (rc > 0) {
-		    /* rc is the query size */
-		    modbus_reply(ctx, query, rc, mb_mapping);
-		} else if (rc == -1) {
-			printf("(%d) Disconnected %s\n", id, modbus_strerror(errno));
-		    /* Connection closed by the client or error */
-		    break;
+		sem_wait(&c->start);
+		printf("(%d) Serving on socket %d\n", c->id, c->socket);
+		for (;;) {
+			int rc;
+			rc = modbus_receive(c->ctx, c->query);
+			if (rc > 0) {
+			    /* rc is the query size */
+			    modbus_reply(c->ctx, c->query, rc, mb_mapping);
+			} else if (rc == -1) {
+				printf("(%d) Disconnected %s\n", c->id, modbus_strerror(errno));
+			    /* Connection closed by the client or error */
+			    break;
+			}
 		}
+
+		//clean-up, the connection goes back to the pool
+		close(c->socket);
+		c->socket = -1;
+		poolRelease(&connections, c);
+		poolPrint(&connections, "Connections", stdout);
+		if (-1 != heapAllocationsNo())
+			printf("Heap allocations: %lld\n", heapAllocationsNo());
 	}
 
-	//clean-up
-	free(ctx);
-	free(a);
+	return NULL;
 }
 
 int main(void)
 {
 	int s = -1;
 	modbus_t *ctx;
-	modbus_mapping_t *mb_mapping;
 	int rc = -1;
+	int i;
 	pthread_t tId;
 
 	pthread_attr_t attr;
@@ -102,26 +102,46 @@ int main(void)
 		return -1;
 	}
 
+	if (0 == poolInit(&connections, sizeof(Connection), MAX_CONNECTIONS)) {
+		modbus_mapping_free(mb_mapping);
+		modbus_free(ctx);
+		return -1;
+	}
+	for (i = 0; i < MAX_CONNECTIONS; ++i) {
+		Connection *c = (Connection *) poolBlock(&connections, i);
+		c->ctx = modbus_new_tcp("127.0.0.1", 1502);
+		c->socket = -1;
+		sem_init(&c->start, 0, 0);
+		rc = pthread_create(&tId, &attr, serveClient, (void *)c);
+		if (rc) {
+			printf("ERROR; return code from pthread_create() is %d\n", rc);
+			return -1;
+		}
+	}
+
 	s = modbus_tcp_listen(ctx, 1);
 
 	int id = 0;
 	for (;;) {
-		id++;
-		printf("Waiting for another connection...\n\n");
-		modbus_tcp_accept(ctx, &s);
-
-		modbus_t *new_ctx = modbus_clone_tcp(ctx);
+		int newSocket;
+		Connection *c;
 
-		SA *sa = (SA*)malloc(sizeof(SA));
-		sa->ctxt = new_ctx;
-		sa->mm = mb_mapping;
-		sa->id = id;
-
-		rc = pthread_create(&tId, &attr, serveClient, (void *)sa); 
-		if (rc) {
-			printf("ERROR; return code from pthread_create() is %d\n", rc);
+		printf("Waiting for another connection...\n\n");
+		newSocket = modbus_tcp_accept(ctx, &s);
+		if (newSocket == -1) {
 			break;
 		}
+
+		c = (Connection *) poolAcquire(&connections);
+		if (c == NULL) {
+			printf("All %d connections are in use, refused\n", MAX_CONNECTIONS);
+			close(newSocket);
+			continue;
+		}
+		c->socket = newSocket;
+		c->id = ++id;
+		modbus_set_socket(c->ctx, newSocket);
+		sem_post(&c->start);
 	}
 
 	printf("Quit the loop: %s\n", modbus_strerror(errno));